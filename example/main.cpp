@@ -1,17 +1,41 @@
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
 #include <sstream>
 #include <string>
 #include <exception>
+#include <memory>
+#include <vector>
 
+// Replaces global operator new/delete with counting ones, which enables
+// allocation assertions and statistics. Define it in one source file only
+#define TINY_TEST__TRACK_ALLOCATIONS
 #include <tiny_test.hpp>
 
 using testing::make_test;
 using testing::make_timed_test;
+using testing::make_benchmark;
+using testing::make_param_test;
+using testing::make_property_test;
+using testing::make_async_test;
+using testing::make_comparison;
+using testing::make_scaling_test;
+using testing::require_speedup;
+using testing::serial;
 using testing::PrettyTest;
 using testing::SimpleTest;
 using testing::TestGroup;
 
 using namespace std::chrono_literals;
 
+// Fixtures hold expensive setup shared by tests: the value is built on first use
+// and then shared read-only, even by tests running on other threads. Tests capture
+// the handle, groups it is added to own it: the value is destroyed with the last of them
+const auto big_string = testing::make_fixture([] {
+    return std::string(100'000, 'x');
+});
+
 
 TestGroup all_tests[] = {
     // Test Group is constructed from name and sequence of tests
@@ -93,7 +117,8 @@ TestGroup all_tests[] = {
         }),
 
         // Timed tests are made out of other tests (PrettyTest is this case) and
-        // they time execution of the given test using std::clock
+        // they time a single execution of the given test using std::chrono::steady_clock.
+        // Peak resident memory of the process during the run is printed as well
         make_timed_test<PrettyTest>("raw push_back perfomance", [](auto& test){
             const size_t repeats = 1'000;
 
@@ -104,9 +129,36 @@ TestGroup all_tests[] = {
         }),
 
         // You can (optionally) give test a max allowed execution time(in microseconds).
-        // If execution takes longer than given time, test will fail. However,
-        // test will run to it's end, job cancellation is not supported
-        make_timed_test<PrettyTest>(1us, "reserved push_back perfomance", [](auto& test){
+        // If execution takes longer than given time, test will fail. Tests running
+        // past the limit by `RunOptions::timeout_grace` are asked to stop and reported
+        // with a stack sample, see the "cooperative stop" test below.
+        // `serial` marks a test that should never run concurrently with
+        // other tests, which is useful for timing-sensitive ones
+        serial(make_timed_test<PrettyTest>(1us, "reserved push_back perfomance", [](auto& test){
+            const size_t repeats = 1'000;
+
+            std::string string;
+            string.reserve(repeats);
+            for (size_t i = 0; i < repeats; ++i) {
+                string.push_back('c');
+            }
+        })),
+
+        // Long running bodies can take `std::stop_token` (or call `test.stopToken()`)
+        // and return once stop is requested. Bodies ignoring it run to their end,
+        // unless tests are isolated with --isolate: then the process is killed
+        make_timed_test<SimpleTest>(1ms, "cooperative stop", [](std::stop_token stop) {
+            // this will fail: the loop only ends when the watchdog asks it to
+            while (!stop.stop_requested()) {}
+            return true;
+        }),
+
+        // Benchmarks run the test many times: after a few warm-up iterations the
+        // number of iterations per batch is increased until measurement takes
+        // long enough, then min/median/p99/stddev of time per iteration are printed.
+        // Optional time limit is compared against median time of an iteration.
+        // `do_not_optimize` stops compiler from throwing away measured code
+        serial(make_benchmark<PrettyTest>(200us, "reserved push_back benchmark", [](auto& test){
             const size_t repeats = 1'000;
 
             std::string string;
@@ -114,6 +166,140 @@ TestGroup all_tests[] = {
             for (size_t i = 0; i < repeats; ++i) {
                 string.push_back('c');
             }
+            testing::do_not_optimize(string);
+        })),
+
+        // Comparisons run variants of the same code interleaved in random order on
+        // one core and print how much faster each of them is than the first one,
+        // with a confidence interval. `require_speedup(test, 1, 0, 1.0)` fails the
+        // test unless variant 1 (B) is faster than variant 0 (A)
+        serial(require_speedup(make_comparison<PrettyTest>("push_back vs reserve",
+            [](auto& test){
+                std::vector<int> numbers;
+                for (int i = 0; i < 1'000; ++i) {
+                    numbers.push_back(i);
+                }
+                testing::do_not_optimize(numbers);
+            },
+            [](auto& test){
+                std::vector<int> numbers;
+                numbers.reserve(1'000);
+                for (int i = 0; i < 1'000; ++i) {
+                    numbers.push_back(i);
+                }
+                testing::do_not_optimize(numbers);
+            }), 1, 0, 1.0)),
+
+        // Scaling tests benchmark the body for sizes from `ScalingOptions::min_size`
+        // to `max_size` (passed as the last argument), print the size/time table and
+        // the complexity that fits it best. The test fails if time grows faster
+        // than the declared complexity allows
+        serial(make_scaling_test<PrettyTest>(testing::Complexity::NLogN, "sort scaling", [](auto& test, size_t n){
+            std::vector<int> numbers(n);
+            for (size_t i = 0; i < n; ++i) {
+                numbers[i] = int((i * 7919) % n);
+            }
+            std::sort(numbers.begin(), numbers.end());
+            testing::do_not_optimize(numbers);
+        }))
+    ),
+    TestGroup("fixtures", big_string,
+        make_test<PrettyTest>("read shared", [](auto& test){
+            test.equals(big_string->size(), 100'000u);
+        }),
+
+        // .clone() gives a copy-on-write view for tests that modify the fixture
+        make_test<PrettyTest>("modify copy", [](auto& test){
+            auto str = big_string.clone();
+            str.write().push_back('y');
+            test.check(str->size() == big_string->size() + 1);
+        })
+    ),
+    TestGroup("allocations",
+        // .no_allocations(body) and .max_allocations(count, body) check how many
+        // times `body` allocates on the heap. Timed tests and benchmarks also print
+        // allocation counts when tracking is enabled
+        make_test<PrettyTest>("reserved vector", [](auto& test){
+            std::vector<int> numbers;
+            numbers.reserve(100);
+            test.no_allocations([&] {
+                for (int i = 0; i < 100; ++i) {
+                    numbers.push_back(i);
+                }
+            });
+            // this will fail: every growth of the vector reallocates
+            test.max_allocations(1, [&] {
+                std::vector<int> other;
+                for (int i = 0; i < 100; ++i) {
+                    other.push_back(i);
+                }
+            });
+        }),
+
+        // .max_peak_bytes(bytes, body) limits how much heap `body` uses at once,
+        // .no_leaks(body) checks that it frees everything it allocates.
+        // .max_peak_rss(bytes, body) samples resident memory of the whole process
+        // instead, so it also sees memory mapped directly, but only on Linux
+        make_test<PrettyTest>("memory footprint", [](auto& test){
+            test.max_peak_bytes(1024, [] {
+                std::vector<char> buffer(512);
+                testing::do_not_optimize(buffer);
+            });
+            test.no_leaks([] {
+                auto numbers = std::make_unique<int[]>(100);
+                testing::do_not_optimize(numbers);
+            });
+            test.max_peak_rss(64 << 20, [] {
+                std::vector<char> buffer(1 << 20, 'x');
+                testing::do_not_optimize(buffer);
+            });
+        }),
+
+        // `check_leaks` does the same for the whole test
+        testing::check_leaks(make_test<PrettyTest>("leak", [](auto& test){
+            // this will fail: the string is never freed
+            auto* leaked = new std::string(100, 'x');
+            test.check(leaked->size() == 100);
+        }))
+    ),
+    TestGroup("data-driven tests",
+        // Parameterized tests call the functor for every case of a source: any
+        // container, `testing::BinarySource<Record>("cases.bin")` for files of
+        // trivially copyable records or `testing::CsvSource("cases.csv")` for text.
+        // Files are memory mapped and cases are used in place, so datasets do not
+        // have to fit in memory. Failures are reported by case index
+        make_param_test<PrettyTest>("squares", std::vector<int>{1, 2, 3, 4}, [](auto& test, int x, size_t index){
+            test.check(x * x > int(index));
+        }),
+
+        // Property tests call the functor with random inputs made by generators
+        // from `testing::gen`. Failing input is shrunk to a minimal counterexample,
+        // printed with the seed that reproduces it (see --seed)
+        make_property_test<PrettyTest>("palindromes", [](auto& test, const std::string& str){
+            // this will fail: most strings are not palindromes, shortest counterexample is printed
+            test.check(std::equal(str.begin(), str.end(), str.rbegin()));
+        }, testing::gen::strings())
+    ),
+    TestGroup("async tests",
+        // Async tests are coroutines returning `testing::Task<>`. While one of them
+        // waits for a timer (or, on POSIX, a file descriptor with `testing::readable`),
+        // others run on the same thread: these two take 50ms together, not 100ms
+        make_async_test("first timer", [](auto& test) -> testing::Task<> {
+            const auto started = std::chrono::steady_clock::now();
+            co_await testing::sleep_for(50ms);
+            test.check(std::chrono::steady_clock::now() - started >= 50ms);
+        }),
+        make_async_test("second timer", [](auto& test) -> testing::Task<> {
+            co_await testing::sleep_for(50ms);
+            test.check(true);
+        }),
+
+        // Tests still waiting when their deadline passes are failed and their
+        // coroutines destroyed. Without a deadline `RunOptions::timeout` is used
+        make_async_test(10ms, "deadline", [](auto& test) -> testing::Task<> {
+            // this will fail: the timer is never reached
+            co_await testing::sleep_for(1s);
+            test.fail();
         })
     ),
     TestGroup("third group",
@@ -121,16 +307,113 @@ TestGroup all_tests[] = {
             // .float equals(a, b, delta) is equivalent to .check(std::abs(a - b) < delta)
             test.float_equals(1.0, 1.1, 0.11);
             test.float_equals(1.0, 1.1, 0.01);
+            // absolute epsilon is meaningless for large numbers, compare them by
+            // distance in ulps (representable numbers between them) or relative error
+            test.float_equals_ulps(1e10, 1e10 + 1e-6, 4);
+            test.float_equals_rel(1e10, 1e10 + 1.0, 1e-9);
+        }),
+
+        // Bulk checks compare whole ranges at once and report a short summary
+        // on failure: number of mismatches, first of them and the largest error
+        make_test<PrettyTest>("bulk checks", [](auto& test){
+            std::vector<double> xs(1000, 1.0);
+            std::vector<double> ys = xs;
+            test.equals_range(xs, ys);
+            test.all_of(xs, [](double x) { return x > 0; });
+            // this will fail and print indices 10, 20 and the max absolute/relative error
+            ys[10] = 1.5;
+            ys[20] = 0.0;
+            test.float_equals_span(xs, ys, 0.01);
+            // the same with other tolerances
+            test.float_equals_span(xs, xs, testing::Ulps{4});
+            test.float_equals_span(xs, xs, testing::Relative{1e-9});
+        }),
+
+        // .expect_death(body, SIGABRT) checks that `body` ends the process with the signal,
+        // e.g. on a failed assert, .expect_death(body, "regex") that it dies after writing
+        // a match to stderr. Each check runs `body` in a fork of the test process
+        make_test<PrettyTest>("death", [](auto& test){
+            test.expect_death([] { std::abort(); }, SIGABRT);
+            test.expect_death([] {
+                std::fputs("index 7 is out of range\n", stderr);
+                std::exit(1);
+            }, "index [0-9]+ is out of range");
+        }),
+
+        // .matches_snapshot(name, bytes) compares output with the file "snapshots/<name>",
+        // which is memory mapped and compared in chunks. A mismatch prints a diff of the
+        // changed lines only (a hex dump for binary data). `--update-snapshots` rewrites
+        // snapshots instead, `--snapshots=DIR` sets their directory
+        make_test<PrettyTest>("snapshot", [](auto& test){
+            std::string report;
+            for (int i = 0; i < 100; ++i) {
+                report += "row " + std::to_string(i) + '\n';
+            }
+            // this will fail until the snapshot is written with --update-snapshots
+            test.matches_snapshot("example/report.txt", report);
         })
     )
 };
 
-int main() {
-    bool success = true;
-    for (auto& group : all_tests) {
-        success &= group.run();
-        std::cout << '\n';
-    }
-    return success ? 0 : 1;
+// Tests can also register themselves, then there is no need to list them
+// in an array. Test objects are created right before they are run
+TINY_TEST(PrettyTest, "registered tests", "string append", [](auto& test) {
+    std::string str = "tiny";
+    str += "test";
+    test.equals(str, "tinytest");
+});
+
+TINY_TIMED_TEST(PrettyTest, 10ms, "registered tests", "string reserve", [](auto& test) {
+    std::string str;
+    str.reserve(100);
+    test.check(str.capacity() >= 100);
+});
+
+// Light tests are PrettyTests with a plain function as the body, `test` is the name
+// of the testing::LightTest& passed to it. They share one class instead of instantiating
+// templates for every lambda, which keeps binaries with thousands of tests small.
+// Such suites can also compile the runner only once: define TINY_TEST__SEPARATE_IMPLEMENTATION
+// for all files and TINY_TEST__IMPLEMENTATION in addition in the one with `main`
+TINY_LIGHT_TEST("registered tests", "light test") {
+    std::string str = "light";
+    test.equals(str.size(), 5u);
 }
 
+int main(int argc, char** argv) {
+    // tiny_test_main runs given groups and then all registered tests. Defaults passed
+    // here may be overridden from the command line, see `example --help`:
+    // --filter, --list and --shard-index/--shard-count select tests to run,
+    // --save-baseline and --baseline compare timed tests with a previous run,
+    // --durations=FILE records test times to balance shards and start long tests first,
+    // --no-cache runs tests that passed last time with the same binary,
+    // --progress prints tests/s, ETA and the longest running tests while a long run goes on,
+    // --profile=DIR samples timed tests and writes flamegraph-ready stacks of slow ones,
+    // --pin-cpus=2,3 runs timed tests and benchmarks on CPUs 2 and 3 with raised priority, etc.
+    // Runs with timed tests start with a description of the machine and warnings about
+    // settings that make timings unstable, e.g. frequency scaling, ASLR or a debug build.
+    // Tests reading data files declare them with `testing::depends_on(test, {"file"})`,
+    // so their cached results are dropped once the files change.
+    // `example --drive=./unit_tests,./integration_tests --jobs=8 --remote="ssh ci2"` runs
+    // tests of several TinyTest binaries in parallel shards (here also on host ci2, where
+    // the binaries must have the same paths) and prints a single report of all of them.
+    // Each binary is asked for `--list=jsonl` and then runs `--run-shard=I/N`;
+    // a shard that crashes fails the tests it hasn't reported.
+    //
+    // `jobs` spreads tests over several threads (0 means "use all cores").
+    // Reports are still printed in declaration order.
+    // Output goes to `testing::default_reporter()` unless `.reporter` is set,
+    // e.g. to a `testing::ConsoleReporter` writing into a file. `--reporter=console,junit:report.xml`
+    // writes the console report and JUnit XML at once, JSON Lines and TAP are also available.
+    // `perf_counters` makes timed tests and benchmarks print IPC, cache and
+    // branch misses (Linux only, nothing is printed if counters are not available).
+    // `.isolation = testing::Isolation::Fork` runs tests in worker processes, so
+    // that a segfault or an endless loop fails only one test; `.timeout` sets
+    // a wall-clock limit after which such test is killed.
+    //
+    // Groups can also be run directly with `group.run()`, `testing::run_all(groups)`
+    // or `testing::run_registered(groups)`, all of them accept the same options
+    return testing::tiny_test_main(argc, argv, all_tests, {
+        .jobs = 4,
+        .perf_counters = true
+    });
+}
@@ -1,20 +1,128 @@
 #pragma once
 
+// Huge suites can compile the runner (reporters, scheduling, process isolation,
+// command line and <iostream>) once instead of in every file with tests: define
+// TINY_TEST__SEPARATE_IMPLEMENTATION for all files, and TINY_TEST__IMPLEMENTATION
+// in addition to it in exactly one of them. Other files get only declarations
+#if defined(TINY_TEST__SEPARATE_IMPLEMENTATION) && !defined(TINY_TEST__IMPLEMENTATION)
+#define TINY_TEST__RUNNER 0
+#else
+#define TINY_TEST__RUNNER 1
+#endif
+#if defined(TINY_TEST__SEPARATE_IMPLEMENTATION)
+#define TINY_TEST__RUNNER_API
+#else
+#define TINY_TEST__RUNNER_API inline
+#endif
+
 #include <exception>
+#include <stdexcept>
+#include <utility>
+#include <tuple>
 #include <vector>
 #include <string>
 #include <memory>
+#if TINY_TEST__RUNNER
 #include <iostream>
+#endif
 #include <iomanip>
-#include <ctime>
+#include <cmath>
+#include <type_traits>
+#include <cstdint>
 #include <limits>
 #include <chrono>
 #include <string_view>
+#include <span>
+#include <ranges>
+#include <bit>
+#include <sstream>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <map>
+#include <fstream>
+#include <optional>
+#include <functional>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <charconv>
+#include <coroutine>
+#include <stop_token>
+#include <filesystem>
+#include <new>
 
 #ifndef TINY_TEST__NO_SOURCE_LOCATION
 #include <source_location>
 #endif
 
+#if defined(__unix__) || defined(__APPLE__)
+#define TINY_TEST__HAS_FORK 1
+#define TINY_TEST__HAS_MMAP 1
+#define TINY_TEST__HAS_POLL 1
+#include <cerrno>
+#include <csignal>
+#if TINY_TEST__RUNNER
+#include <regex>
+#endif
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#else
+#define TINY_TEST__HAS_FORK 0
+#define TINY_TEST__HAS_MMAP 0
+#define TINY_TEST__HAS_POLL 0
+#endif
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Stack samples of tests which exceed their time limits, see `detail::Watchdog`
+#if TINY_TEST__HAS_FORK && __has_include(<execinfo.h>)
+#define TINY_TEST__HAS_BACKTRACE 1
+#include <execinfo.h>
+#include <pthread.h>
+#else
+#define TINY_TEST__HAS_BACKTRACE 0
+#endif
+// Sampling profiler of timed tests, see `RunOptions::profile`
+#if TINY_TEST__HAS_BACKTRACE && defined(__linux__)
+#define TINY_TEST__HAS_PROFILER 1
+#include <ctime>
+// glibc before 2.26 has the thread id of `sigevent` only under its internal name
+#if !defined(sigev_notify_thread_id) && defined(__GLIBC__)
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+#else
+#define TINY_TEST__HAS_PROFILER 0
+#endif
+#if __has_include(<cxxabi.h>)
+#include <cxxabi.h>
+#endif
+
+// Keeps rarely executed code such as failure reporting out of hot loops
+#if defined(__GNUC__) || defined(__clang__)
+#define TINY_TEST__COLD [[gnu::cold, gnu::noinline]]
+#elif defined(_MSC_VER)
+#define TINY_TEST__COLD __declspec(noinline)
+#else
+#define TINY_TEST__COLD
+#endif
+
 
 namespace testing {
     template <typename T>
@@ -45,241 +153,9013 @@ namespace testing {
         { ostr << item };
     };
 
-    // Base Test class. All other tests should inherit from it
-    // and override `doTest` method
-    class Test {
-    public:
-        Test(std::string name): name_(std::move(name)) {}
+    // Hardware counter readings, see `PerfCounters`. Reads hold raw counts,
+    // a difference of two reads is extrapolated to the whole measured time
+    struct CounterValues {
+        // false if counters are not available
+        bool valid = false;
+        uint64_t cycles = 0;
+        uint64_t instructions = 0;
+        uint64_t cache_misses = 0;
+        uint64_t branch_misses = 0;
+        // nanoseconds the counters were enabled and actually counting,
+        // these differ when counters are multiplexed with other events
+        uint64_t time_enabled = 0;
+        uint64_t time_running = 0;
 
-        virtual ~Test() = default;
+        double ipc() const {
+            return cycles != 0 ? double(instructions) / double(cycles) : 0;
+        }
 
-        bool operator()() {
-            std::cout << "test \"" << name_ << "\"\n" << std::flush;
-            bool res = false;
-            try {
-                res = doTest();
-            } catch(std::exception& exception) {
-                std::cout << "caught exception: " << exception.what() << '\n';
-            } catch (...) {
-                std::cout << "caught unknown exception\n";
+        // Invalid if the counters did not run between the reads
+        CounterValues operator-(const CounterValues& other) const {
+            if (!valid || !other.valid || time_running <= other.time_running || time_enabled < other.time_enabled) {
+                return {};
             }
-            std::cout << "[\x1B[" << (res ? "32mOK" : "31mFAIL") << "\033[0m]\n";
-            return res;
+            const uint64_t enabled = time_enabled - other.time_enabled;
+            const uint64_t running = time_running - other.time_running;
+            const double scale = double(enabled) / double(running);
+            auto scaled = [&](uint64_t current, uint64_t previous) {
+                return current >= previous ? uint64_t(double(current - previous) * scale) : 0;
+            };
+            return {true,
+                scaled(cycles, other.cycles),
+                scaled(instructions, other.instructions),
+                scaled(cache_misses, other.cache_misses),
+                scaled(branch_misses, other.branch_misses),
+                enabled,
+                running};
         }
-
-    protected:
-        std::string name_;
-
-        virtual bool doTest() = 0;
     };
 
-    // Wrapper around any Functor that takes nothing and returns bool
-    template<typename Functor>
-    class SimpleTest: public Test {
+    // Per-thread hardware performance counters (Linux perf_event_open).
+    // Counters are opened on first use and never stopped, measurement is
+    // a difference of two reads, so measured regions may be nested.
+    // Where counters are not available reads just return invalid values
+    class PerfCounters {
     public:
-        SimpleTest(std::string name, Functor f)
-        : Test(std::move(name))
-        , f_(std::move(f)) {}
+        PerfCounters(const PerfCounters&) = delete;
 
-        bool doTest() override {
-            return f_();
+        // Counters of the calling thread
+        static PerfCounters& thread() {
+            thread_local PerfCounters counters;
+            return counters;
+        }
+
+        bool available() const {
+            return available_;
+        }
+
+        CounterValues read() const {
+            CounterValues values;
+#if defined(__linux__)
+            if (!available_) {
+                return values;
+            }
+            struct {
+                uint64_t count;
+                uint64_t time_enabled;
+                uint64_t time_running;
+                uint64_t values[event_count];
+            } data{};
+            if (::read(fds_[0], &data, sizeof(data)) != ssize_t(sizeof(data))) {
+                return values;
+            }
+            // raw counts, scaling for multiplexing is done on differences, see `CounterValues`
+            values.valid = true;
+            values.cycles = data.values[0];
+            values.instructions = data.values[1];
+            values.cache_misses = data.values[2];
+            values.branch_misses = data.values[3];
+            values.time_enabled = data.time_enabled;
+            values.time_running = data.time_running;
+#endif
+            return values;
         }
 
     private:
-        Functor f_;
-    };
+        static constexpr size_t event_count = 4;
 
-    // Main test class, provides lots of helper methods and automatic output
-    // Functor is called with PrettyTest instance as an argument
-    template<typename Functor>
-    class PrettyTest: public Test {
-    public:
-        PrettyTest(const PrettyTest&) = delete;
-        PrettyTest(PrettyTest&&) = delete;
+#if defined(__linux__)
+        PerfCounters() {
+            const uint64_t events[event_count] = {
+                PERF_COUNT_HW_CPU_CYCLES,
+                PERF_COUNT_HW_INSTRUCTIONS,
+                PERF_COUNT_HW_CACHE_MISSES,
+                PERF_COUNT_HW_BRANCH_MISSES
+            };
+            for (size_t i = 0; i < event_count; ++i) {
+                perf_event_attr attr{};
+                attr.size = sizeof(attr);
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = events[i];
+                attr.disabled = i == 0 ? 1 : 0;
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+                const int group = i == 0 ? -1 : fds_[0];
+                fds_[i] = int(syscall(SYS_perf_event_open, &attr, 0, -1, group, 0));
+                if (fds_[i] < 0) {
+                    close();
+                    return;
+                }
+            }
+            available_ = ioctl(fds_[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP) == 0;
+            if (!available_) {
+                close();
+            }
+        }
 
-        PrettyTest(std::string name, Functor f)
-        : Test(std::move(name))
-        , f_(std::move(f)) {}
+        ~PerfCounters() {
+            close();
+        }
 
-        bool doTest() override {
-            f_(*this);
-            return result_;
+        void close() {
+            for (int& fd : fds_) {
+                if (fd >= 0) {
+                    ::close(fd);
+                }
+                fd = -1;
+            }
         }
 
-#ifndef TINY_TEST__NO_SOURCE_LOCATION
-        bool check(bool condition, const std::source_location location = std::source_location::current()) {
-            result_ &= condition;
-            if (condition == false) {
-                std::cout
-                    << "condition at " << location.file_name()
-                    << ", line " << location.line()
-                    << ':' << location.column()
-                    << " evaluated to false\n";
+        int fds_[event_count] = {-1, -1, -1, -1};
+#else
+        PerfCounters() = default;
+#endif
+        bool available_ = false;
+    };
+
+    namespace detail {
+        // Formats nanoseconds with a suitable unit
+        inline std::string format_duration(double ns) {
+            const char* unit = "ns";
+            if (ns >= 1e9) {
+                ns /= 1e9;
+                unit = "s";
+            } else if (ns >= 1e6) {
+                ns /= 1e6;
+                unit = "ms";
+            } else if (ns >= 1e3) {
+                ns /= 1e3;
+                unit = "us";
             }
-            return condition;
+            std::ostringstream stream;
+            stream << std::setprecision(3) << ns << unit;
+            return std::move(stream).str();
         }
 
-        template<typename First, typename Second>
-        requires Printable<First> && Printable<Second>
-        bool equals(
-                First& first,
-                Second&& second,
-                const std::source_location location = std::source_location::current()) {
-            const bool result = check(first == second, location);
-            if (!result) {
-                std::cout << first << " (" << type_name<First>() << ") != "
-                    << second << " (" <<  type_name<Second>() << ")\n";
+        // ", IPC 1.2, 0.3 cache misses, 2 branch misses per iteration" or nothing if counters are invalid
+        inline std::string format_counters(const CounterValues& counters, double iterations) {
+            if (!counters.valid || iterations <= 0) {
+                return {};
             }
-            return result;
+            std::ostringstream stream;
+            stream << std::setprecision(3)
+                << ", IPC " << counters.ipc()
+                << ", " << double(counters.cache_misses) / iterations << " cache misses"
+                << ", " << double(counters.branch_misses) / iterations << " branch misses per iteration";
+            return std::move(stream).str();
         }
+    }
 
-        bool equals(
-                auto&& first,
-                auto&& second,
-                const std::source_location location = std::source_location::current()) {
-            return check(first == second, location);
+    // Heap usage of a measured region, see `AllocationScope`
+    struct AllocationStats {
+        // false if allocation tracking is not compiled in
+        bool valid = false;
+        uint64_t allocations = 0;
+        uint64_t deallocations = 0;
+        uint64_t bytes = 0;
+        // maximum of live bytes above the level at the start of the region
+        int64_t peak_bytes = 0;
+        // live bytes at the end of the region minus live bytes at its start
+        int64_t live_bytes = 0;
+    };
+
+    namespace detail {
+        // Heap counters of a thread, updated by the operator new/delete hooks
+        struct AllocationCounters {
+            uint64_t allocations;
+            uint64_t deallocations;
+            uint64_t bytes;
+            int64_t live_bytes;
+            int64_t peak_bytes;
+            // allocations are not counted while positive, see `AllocationPause`
+            int paused;
+        };
+
+        inline thread_local AllocationCounters allocation_counters{};
+
+        // Set by the translation unit which defines TINY_TEST__TRACK_ALLOCATIONS
+        inline bool& allocation_tracking() {
+            static bool enabled = false;
+            return enabled;
         }
 
-        template<typename Float>
-        requires std::floating_point<Float>
-        bool float_equals(Float x, Float y, Float error, const std::source_location location = std::source_location::current()) {
-            const bool result = check(std::abs(x - y) < error, location);
-            if (!result) {
-                std::cout << std::setprecision(4) << x << " != " << y << " with epsilon " << error << '\n';
+        // Allocations made by the framework itself (e.g. failure messages)
+        // while this object is alive are not counted
+        struct AllocationPause {
+            AllocationPause() {
+                ++allocation_counters.paused;
             }
-            return result;
+
+            ~AllocationPause() {
+                --allocation_counters.paused;
+            }
+        };
+    }
+
+    // True if global operator new/delete have been replaced by the counting ones:
+    // define TINY_TEST__TRACK_ALLOCATIONS in exactly one source file before
+    // including tiny_test.hpp to enable tracking
+    inline bool allocation_tracking_enabled() {
+        return detail::allocation_tracking();
+    }
+
+    // Measures heap usage of the calling thread from construction to `stop`.
+    // Scopes may be nested
+    class AllocationScope {
+    public:
+        AllocationScope()
+        : start_(detail::allocation_counters) {
+            detail::allocation_counters.peak_bytes = start_.live_bytes;
         }
 
-        bool fail(const std::source_location location = std::source_location::current()) {
-            return check(false, location);
+        ~AllocationScope() {
+            stop();
         }
-#else
-        bool check(bool condition) {
-            result_ &= condition;
-            return condition;
+
+        AllocationStats stop() {
+            auto& counters = detail::allocation_counters;
+            if (!stopped_) {
+                stopped_ = true;
+                stats_.valid = allocation_tracking_enabled();
+                stats_.allocations = counters.allocations - start_.allocations;
+                stats_.deallocations = counters.deallocations - start_.deallocations;
+                stats_.bytes = counters.bytes - start_.bytes;
+                stats_.peak_bytes = counters.peak_bytes - start_.live_bytes;
+                stats_.live_bytes = counters.live_bytes - start_.live_bytes;
+                // outer scope's peak
+                counters.peak_bytes = std::max(counters.peak_bytes, start_.peak_bytes);
+            }
+            return stats_;
         }
 
-        bool fail() {
-            return check(false);
+    private:
+        detail::AllocationCounters start_;
+        AllocationStats stats_;
+        bool stopped_ = false;
+    };
+
+    namespace detail {
+        // ", 3 allocations (120 bytes, peak 64 bytes) per iteration" or nothing if tracking is disabled
+        inline std::string format_allocations(const AllocationStats& stats, double iterations) {
+            if (!stats.valid || iterations <= 0) {
+                return {};
+            }
+            std::ostringstream stream;
+            stream << std::fixed << std::setprecision(iterations == 1 ? 0 : 1)
+                << ", " << double(stats.allocations) / iterations << " allocations ("
+                << double(stats.bytes) / iterations << " bytes, peak "
+                << stats.peak_bytes << " bytes)";
+            if (iterations != 1) {
+                stream << " per iteration";
+            }
+            return std::move(stream).str();
         }
+    }
 
-        bool equals(auto&& first, auto&& second) {
-            return check(first == second);
+    // Resident set size of the process during a measured region, see `RssSampler` and `RssRegion`
+    struct RssStats {
+        // false where RSS can't be read, only Linux is supported
+        bool valid = false;
+        int64_t start_bytes = 0;
+        // largest RSS seen during the region
+        int64_t peak_bytes = 0;
+        int64_t end_bytes = 0;
+    };
+
+    namespace detail {
+        // "512B", "12.3KiB", "1.5MiB", ...
+        inline std::string format_bytes(int64_t bytes) {
+            static constexpr const char* units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+            double value = double(bytes);
+            size_t unit = 0;
+            while (std::abs(value) >= 1024 && unit + 1 < std::size(units)) {
+                value /= 1024;
+                ++unit;
+            }
+            std::ostringstream stream;
+            stream << std::setprecision(3) << value << units[unit];
+            return std::move(stream).str();
         }
 
-        template<typename Float>
-        bool float_equals(Float x, Float y, Float error) {
-            const bool result = check(std::abs(x - y) < error);
-            if (!result) {
-                std::cout << std::setprecision(4) << first << " != " second << " with epsilon " << error << '\n';
+        // Resident set size from an open /proc/self/statm, -1 on errors
+        inline int64_t read_rss(int statm) {
+#if defined(__linux__)
+            char text[128];
+            const ssize_t size = ::pread(statm, text, sizeof(text) - 1, 0);
+            if (size <= 0) {
+                return -1;
             }
-            return result;
+            // "size resident shared ...", in pages
+            const char* resident = std::find(text, text + size, ' ');
+            uint64_t pages = 0;
+            if (resident == text + size || std::from_chars(resident + 1, text + size, pages).ec != std::errc{}) {
+                return -1;
+            }
+            return int64_t(pages) * int64_t(::sysconf(_SC_PAGESIZE));
+#else
+            (void)statm;
+            return -1;
+#endif
         }
+
+        // Samples RSS of the whole process on a background thread from construction
+        // to `stop`, so that memory mapped directly (e.g. by mmap-based allocators)
+        // is seen as well. Tests running concurrently add to it, and spikes shorter
+        // than `interval` can be missed
+        class RssSampler {
+        public:
+            explicit RssSampler(std::chrono::microseconds interval = std::chrono::milliseconds(1)) {
+#if defined(__linux__)
+                statm_ = ::open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+                stats_.start_bytes = read_rss(statm_);
+                if (stats_.start_bytes < 0) {
+                    return;
+                }
+                stats_.valid = true;
+                peak_.store(stats_.start_bytes, std::memory_order_relaxed);
+                AllocationPause pause;
+                thread_ = std::thread([this, interval] {
+                    std::unique_lock lock(mutex_);
+                    while (!wake_.wait_for(lock, interval, [this] { return stopping_; })) {
+                        sample();
+                    }
+                });
+#else
+                (void)interval;
 #endif
+            }
 
-    private:
-        Functor f_;
-        bool result_ = true;
-    };
+            RssSampler(const RssSampler&) = delete;
 
-    // Helper function for unique_ptr creation of SimpleTest and PrettyTest
-    template<template<typename> typename ActualTest, typename Functor>
-    std::unique_ptr<ActualTest<Functor>> make_test(
-            std::string name,
-            Functor f) {
-        return std::make_unique<ActualTest<Functor>>(std::move(name), std::move(f));
-    }
+            ~RssSampler() {
+                stop();
+            }
 
-    // Wrapper around another test. Will time execution and check that it
-    // did not exceed a given time limit
-    template<template<typename> typename ActualTest, typename Functor>
-    struct TimedTest : ActualTest<Functor> {
-        using Parent = ActualTest<Functor>;
-        using Parent::Parent;
+            RssStats stop() {
+                if (thread_.joinable()) {
+                    {
+                        std::lock_guard lock(mutex_);
+                        stopping_ = true;
+                    }
+                    wake_.notify_one();
+                    thread_.join();
+                    sample();
+                    stats_.end_bytes = std::max<int64_t>(read_rss(statm_), 0);
+                    stats_.peak_bytes = peak_.load(std::memory_order_relaxed);
+                }
+#if defined(__linux__)
+                if (statm_ >= 0) {
+                    ::close(statm_);
+                    statm_ = -1;
+                }
+#endif
+                return stats_;
+            }
 
-        template<typename... Args>
-        TimedTest(double milliseconds, Args&&... args)
-            : Parent(std::forward<Args>(args)...)
-            , max_runtime_(milliseconds) {}
+        private:
+            void sample() {
+                const int64_t rss = read_rss(statm_);
+                int64_t peak = peak_.load(std::memory_order_relaxed);
+                while (rss > peak && !peak_.compare_exchange_weak(peak, rss, std::memory_order_relaxed)) {}
+            }
 
-        bool doTest() override {
-            auto start = std::clock();
-            auto result = Parent::doTest();
-            auto finish = std::clock();
-            double execution_ms = double(finish - start) * 1000.0 / CLOCKS_PER_SEC;
-            std::cout << "finished in " << std::setprecision(2) << execution_ms << "ms\n";
-            if (max_runtime_ < execution_ms) {
-                std::cout << "SLOWER than given limit: " << std::setprecision(2) << max_runtime_ << "ms\n";
-                return false;
+            RssStats stats_;
+            int statm_ = -1;
+            std::atomic<int64_t> peak_ = 0;
+            std::mutex mutex_;
+            std::condition_variable wake_;
+            bool stopping_ = false;
+            std::thread thread_;
+        };
+
+        // RSS at both ends of a region and its peak from the high-water mark the kernel keeps
+        // (`ru_maxrss`), so nothing runs during the region. The peak is exact if the region
+        // raises the high-water mark of the process, otherwise it is the larger of both ends
+        class RssRegion {
+        public:
+            RssRegion() {
+#if defined(__linux__)
+                statm_ = ::open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+                stats_.start_bytes = read_rss(statm_);
+                high_water_ = highWater();
+                stats_.valid = stats_.start_bytes >= 0 && high_water_ >= 0;
+#endif
             }
-            return result;
+
+            RssRegion(const RssRegion&) = delete;
+
+            ~RssRegion() {
+#if defined(__linux__)
+                if (statm_ >= 0) {
+                    ::close(statm_);
+                }
+#endif
+            }
+
+            RssStats stop() {
+                if (stats_.valid) {
+                    stats_.end_bytes = std::max<int64_t>(read_rss(statm_), 0);
+                    const int64_t high_water = highWater();
+                    stats_.peak_bytes = high_water > high_water_ ? high_water
+                        : std::max(stats_.start_bytes, stats_.end_bytes);
+                }
+                return stats_;
+            }
+
+        private:
+            static int64_t highWater() {
+#if defined(__linux__)
+                struct rusage usage{};
+                if (::getrusage(RUSAGE_SELF, &usage) != 0) {
+                    return -1;
+                }
+                // kilobytes on Linux
+                return int64_t(usage.ru_maxrss) * 1024;
+#else
+                return -1;
+#endif
+            }
+
+            RssStats stats_;
+            int statm_ = -1;
+            int64_t high_water_ = -1;
+        };
+
+        // ", peak RSS 12.3MiB (+1.5MiB)" or nothing if RSS is not available
+        inline std::string format_rss(const RssStats& stats) {
+            if (!stats.valid) {
+                return {};
+            }
+            return ", peak RSS " + format_bytes(stats.peak_bytes) + " (+" + format_bytes(stats.peak_bytes - stats.start_bytes) + ")";
         }
+    }
 
-    private:
-        double max_runtime_ = std::numeric_limits<double>::infinity();
+    // Outcome of a single test run
+    struct TestResult {
+        std::string_view group;
+        std::string_view name;
+        bool passed = false;
+        // not run because it passed last time with the same inputs, see `ResultCache`
+        bool skipped = false;
+        // false if the outcome depends on something `ResultCache` doesn't hash, e.g. a snapshot
+        bool cacheable = true;
+        // wall-clock time of the whole run
+        std::chrono::nanoseconds duration{};
+        // hardware counters of the whole run, if `RunOptions::perf_counters` is set
+        CounterValues counters;
+        // heap usage of the whole run, if allocation tracking is enabled
+        AllocationStats allocations;
+        // everything the test has written to its output stream
+        std::string output;
     };
 
-    // Helper function for unique_ptr creation of TimedTest from Simple and Pretty tests
-    template<template<typename> typename ActualTest, typename Functor>
-    auto make_timed_test(
-        std::string name,
-        Functor f
-    ) {
-        return std::make_unique<TimedTest<ActualTest, Functor>>(std::move(name), std::move(f));
-    }
+    // Machine and build the tests run on, see `detect_environment`. Reported
+    // before runs with timing-sensitive tests, so that timings can be compared
+    struct Environment {
+        // e.g. {"cpu", "Intel(R) Xeon(R) ..."}, {"governor", "powersave"}
+        std::vector<std::pair<std::string, std::string>> properties;
+        // things that make timings unstable, e.g. frequency scaling
+        std::vector<std::string> warnings;
+    };
 
-    template<template<typename> typename ActualTest, typename Functor>
-    auto make_timed_test(
-        std::chrono::microseconds time_limit,
-        std::string name,
-        Functor f
-    ) {
-        const double to_milliseconds = 1e-3;
-        return std::make_unique<TimedTest<ActualTest, Functor>>(
-                double(time_limit.count()) * to_milliseconds, std::move(name), std::move(f)
-        );
-    }
+    // Receives results of a run. Calls are never concurrent, and tests
+    // are always reported in declaration order, even when run in parallel
+    class Reporter {
+    public:
+        virtual ~Reporter() = default;
 
-    // Owning container for a group of tests
-    class TestGroup {
+        virtual void runStarted() {}
+        // Called after `runStarted` if the run has timing-sensitive tests
+        virtual void environment(const Environment& /*environment*/) {}
+        virtual void groupStarted(std::string_view /*group*/) {}
+        // Called when a test starts running if it is the next one to be reported, so that
+        // a test which crashes or hangs the process can be named. Not called for every test
+        virtual void testStarted(std::string_view /*group*/, std::string_view /*name*/) {}
+        virtual void testFinished(const TestResult& result) = 0;
+        virtual void groupFinished(std::string_view /*group*/, size_t /*failed*/, size_t /*total*/) {}
+        virtual void runFinished(size_t /*failed*/, size_t /*total*/) {}
+    };
+
+#if TINY_TEST__RUNNER
+    // Default reporter, prints human-readable colored text.
+    // Text is collected in a buffer and written to the stream
+    // with a single call once per test or once per group
+    class ConsoleReporter : public Reporter {
     public:
-        TestGroup(const TestGroup&) = delete;
-        TestGroup(TestGroup&&) = default;
-        TestGroup(std::string name): name_(std::move(name)) {}
+        enum class Flush {
+            PerTest,
+            PerGroup
+        };
 
-        template<typename FirstTest, typename... OtherTests>
-        TestGroup(std::string name, FirstTest first, OtherTests... other)
-        : TestGroup(std::move(name)
-        , std::move(other)...)
-        {
-            add(std::move(first));
+        explicit ConsoleReporter(std::ostream& stream = std::cout, Flush flush = Flush::PerTest)
+        : stream_(stream)
+        , flush_(flush) {}
+
+        void runStarted() override {
+            first_group_ = true;
         }
 
-        void add(std::unique_ptr<Test> test) {
-            tests_.push_back(std::move(test));
+        void environment(const Environment& environment) override {
+            buffer_ += "environment: ";
+            for (size_t i = 0; i < environment.properties.size(); ++i) {
+                buffer_ += i == 0 ? "" : ", ";
+                buffer_ += environment.properties[i].first;
+                buffer_ += ' ';
+                buffer_ += environment.properties[i].second;
+            }
+            buffer_ += '\n';
+            for (const auto& warning : environment.warnings) {
+                buffer_ += "\x1B[33mWARNING\033[0m: ";
+                buffer_ += warning;
+                buffer_ += '\n';
+            }
+            first_group_ = false;
+            write();
         }
 
-        bool run() {
-            std::cout << "Running group \"" << name_ << '\"' << std::endl;
-            size_t errors = 0;
-            for (auto& test : tests_) {
-                bool result = (*test)();
-                if (!result) {
-                    ++errors;
-                }
+        void groupStarted(std::string_view group) override {
+            if (!first_group_) {
+                buffer_ += '\n';
+            }
+            first_group_ = false;
+            buffer_ += "Running group \"";
+            buffer_ += group;
+            buffer_ += "\"\n";
+            if (flush_ == Flush::PerTest) {
+                write();
             }
+        }
 
-            bool result = (errors == 0);
-            if (!result) {
-                std::cout << "Group failed!\n";
-                std::cout << "Failed " << errors << '/' << tests_.size() << " tests\n";
+        void testStarted(std::string_view /*group*/, std::string_view name) override {
+            writeHeader(name);
+            header_written_ = true;
+            if (flush_ == Flush::PerTest) {
+                write();
             }
-            return result;
+        }
+
+        void testFinished(const TestResult& result) override {
+            if (!header_written_) {
+                writeHeader(result.name);
+            }
+            header_written_ = false;
+            buffer_ += result.output;
+            if (result.skipped) {
+                buffer_ += "[\x1B[32mCACHED\033[0m]\n";
+            } else {
+                buffer_ += result.passed ? "[\x1B[32mOK\033[0m]\n" : "[\x1B[31mFAIL\033[0m]\n";
+            }
+            if (flush_ == Flush::PerTest) {
+                write();
+            }
+        }
+
+        void groupFinished(std::string_view /*group*/, size_t failed, size_t total) override {
+            if (failed != 0) {
+                buffer_ += "Group failed!\nFailed ";
+                buffer_ += std::to_string(failed);
+                buffer_ += '/';
+                buffer_ += std::to_string(total);
+                buffer_ += " tests\n";
+            }
+            write();
         }
 
     private:
-        std::string name_;
-        std::vector<std::unique_ptr<Test>> tests_;
+        void writeHeader(std::string_view name) {
+            buffer_ += "test \"";
+            buffer_ += name;
+            buffer_ += "\"\n";
+        }
+
+        void write() {
+            stream_.write(buffer_.data(), std::streamsize(buffer_.size()));
+            stream_.flush();
+            buffer_.clear();
+        }
+
+        std::ostream& stream_;
+        Flush flush_;
+        std::string buffer_;
+        bool first_group_ = true;
+        // `testStarted` has written the header of the next reported test
+        bool header_written_ = false;
     };
-}
 
+    // Reporter used when no other reporter is given
+    TINY_TEST__RUNNER_API Reporter& default_reporter() {
+        static ConsoleReporter reporter;
+        return reporter;
+    }
+
+    namespace detail {
+        template<typename Number>
+        void append_number(std::string& buffer, Number number) {
+            char digits[32];
+            const auto [end, error] = std::to_chars(digits, digits + sizeof(digits), number);
+            buffer.append(digits, error == std::errc{} ? size_t(end - digits) : 0);
+        }
+
+        inline void append_json_string(std::string& buffer, std::string_view text) {
+            static constexpr char hex[] = "0123456789abcdef";
+            buffer += '"';
+            for (char c : text) {
+                switch (c) {
+                case '"': buffer += "\\\""; break;
+                case '\\': buffer += "\\\\"; break;
+                case '\n': buffer += "\\n"; break;
+                case '\t': buffer += "\\t"; break;
+                case '\r': buffer += "\\r"; break;
+                default:
+                    if (uint8_t(c) < 0x20) {
+                        buffer += "\\u00";
+                        buffer += hex[uint8_t(c) >> 4];
+                        buffer += hex[uint8_t(c) & 15];
+                    } else {
+                        buffer += c;
+                    }
+                }
+            }
+            buffer += '"';
+        }
+
+        // Text of XML attributes and elements, control characters are not allowed in XML 1.0
+        inline void append_xml_text(std::string& buffer, std::string_view text) {
+            for (char c : text) {
+                switch (c) {
+                case '&': buffer += "&amp;"; break;
+                case '<': buffer += "&lt;"; break;
+                case '>': buffer += "&gt;"; break;
+                case '"': buffer += "&quot;"; break;
+                case '\'': buffer += "&apos;"; break;
+                default:
+                    if (uint8_t(c) >= 0x20 || c == '\n' || c == '\t' || c == '\r') {
+                        buffer += c;
+                    }
+                }
+            }
+        }
+
+        inline void append_seconds(std::string& buffer, std::chrono::nanoseconds duration) {
+            char digits[32];
+            const auto [end, error] = std::to_chars(digits, digits + sizeof(digits), double(duration.count()) * 1e-9, std::chars_format::fixed, 6);
+            buffer.append(digits, error == std::errc{} ? size_t(end - digits) : 0);
+        }
+    }
+
+    // One JSON object per line: {"type":"test",...} for every test, {"type":"group",...}
+    // after every group and {"type":"run",...} at the end. Each line is written with
+    // a single call as soon as it is known, memory use does not grow with the number of tests
+    class JsonLinesReporter : public Reporter {
+    public:
+        explicit JsonLinesReporter(std::ostream& stream)
+        : stream_(stream) {}
+
+        void environment(const Environment& environment) override {
+            buffer_ += "{\"type\":\"environment\",\"properties\":{";
+            for (size_t i = 0; i < environment.properties.size(); ++i) {
+                buffer_ += i == 0 ? "" : ",";
+                detail::append_json_string(buffer_, environment.properties[i].first);
+                buffer_ += ':';
+                detail::append_json_string(buffer_, environment.properties[i].second);
+            }
+            buffer_ += "},\"warnings\":[";
+            for (size_t i = 0; i < environment.warnings.size(); ++i) {
+                buffer_ += i == 0 ? "" : ",";
+                detail::append_json_string(buffer_, environment.warnings[i]);
+            }
+            buffer_ += "]}\n";
+            write();
+        }
+
+        void testFinished(const TestResult& result) override {
+            buffer_ += "{\"type\":\"test\",\"group\":";
+            detail::append_json_string(buffer_, result.group);
+            buffer_ += ",\"name\":";
+            detail::append_json_string(buffer_, result.name);
+            buffer_ += result.passed ? ",\"passed\":true" : ",\"passed\":false";
+            buffer_ += result.skipped ? ",\"skipped\":true" : ",\"skipped\":false";
+            buffer_ += ",\"duration_ns\":";
+            detail::append_number(buffer_, result.duration.count());
+            if (result.allocations.valid) {
+                buffer_ += ",\"allocations\":{\"count\":";
+                detail::append_number(buffer_, result.allocations.allocations);
+                buffer_ += ",\"bytes\":";
+                detail::append_number(buffer_, result.allocations.bytes);
+                buffer_ += ",\"peak_bytes\":";
+                detail::append_number(buffer_, result.allocations.peak_bytes);
+                buffer_ += '}';
+            }
+            if (result.counters.valid) {
+                buffer_ += ",\"counters\":{\"cycles\":";
+                detail::append_number(buffer_, result.counters.cycles);
+                buffer_ += ",\"instructions\":";
+                detail::append_number(buffer_, result.counters.instructions);
+                buffer_ += ",\"cache_misses\":";
+                detail::append_number(buffer_, result.counters.cache_misses);
+                buffer_ += ",\"branch_misses\":";
+                detail::append_number(buffer_, result.counters.branch_misses);
+                buffer_ += '}';
+            }
+            buffer_ += ",\"output\":";
+            detail::append_json_string(buffer_, result.output);
+            buffer_ += "}\n";
+            write();
+        }
+
+        void groupFinished(std::string_view group, size_t failed, size_t total) override {
+            buffer_ += "{\"type\":\"group\",\"group\":";
+            detail::append_json_string(buffer_, group);
+            appendTotals(failed, total);
+            write();
+        }
+
+        void runFinished(size_t failed, size_t total) override {
+            buffer_ += "{\"type\":\"run\"";
+            appendTotals(failed, total);
+            write();
+            stream_.flush();
+        }
+
+    private:
+        void appendTotals(size_t failed, size_t total) {
+            buffer_ += ",\"failed\":";
+            detail::append_number(buffer_, failed);
+            buffer_ += ",\"total\":";
+            detail::append_number(buffer_, total);
+            buffer_ += "}\n";
+        }
+
+        void write() {
+            stream_.write(buffer_.data(), std::streamsize(buffer_.size()));
+            buffer_.clear();
+        }
+
+        std::ostream& stream_;
+        std::string buffer_;
+    };
+
+    // Test Anything Protocol, version 13. The plan line "1..N" is written at the end,
+    // test output becomes "#" diagnostics
+    class TapReporter : public Reporter {
+    public:
+        explicit TapReporter(std::ostream& stream)
+        : stream_(stream) {}
+
+        void runStarted() override {
+            number_ = 0;
+            buffer_ += "TAP version 13\n";
+            write();
+        }
+
+        void environment(const Environment& environment) override {
+            for (const auto& [key, value] : environment.properties) {
+                buffer_ += "# ";
+                buffer_ += key;
+                buffer_ += ": ";
+                buffer_ += value;
+                buffer_ += '\n';
+            }
+            for (const auto& warning : environment.warnings) {
+                buffer_ += "# WARNING: ";
+                buffer_ += warning;
+                buffer_ += '\n';
+            }
+            write();
+        }
+
+        void testFinished(const TestResult& result) override {
+            buffer_ += result.passed ? "ok " : "not ok ";
+            detail::append_number(buffer_, ++number_);
+            buffer_ += " - ";
+            buffer_ += result.group;
+            buffer_ += '/';
+            buffer_ += result.name;
+            if (result.skipped) {
+                buffer_ += " # SKIP cached";
+            }
+            buffer_ += '\n';
+            std::string_view output = result.output;
+            while (!output.empty()) {
+                const size_t end = output.find('\n');
+                buffer_ += "# ";
+                buffer_ += output.substr(0, end);
+                buffer_ += '\n';
+                output.remove_prefix(end == std::string_view::npos ? output.size() : end + 1);
+            }
+            write();
+        }
+
+        void runFinished(size_t /*failed*/, size_t total) override {
+            buffer_ += "1..";
+            detail::append_number(buffer_, total);
+            buffer_ += '\n';
+            write();
+            stream_.flush();
+        }
+
+    private:
+        void write() {
+            stream_.write(buffer_.data(), std::streamsize(buffer_.size()));
+            buffer_.clear();
+        }
+
+        std::ostream& stream_;
+        std::string buffer_;
+        size_t number_ = 0;
+    };
+
+    // JUnit XML, one <testsuite> per group. Written as tests finish, so suites
+    // carry no counts of tests and failures, consumers compute them from test cases
+    class JUnitReporter : public Reporter {
+    public:
+        explicit JUnitReporter(std::ostream& stream)
+        : stream_(stream) {}
+
+        void runStarted() override {
+            buffer_ += "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<testsuites>\n";
+            write();
+            environment_ = {};
+        }
+
+        // Properties of every suite, JUnit has no place for them at the top level
+        void environment(const Environment& environment) override {
+            environment_ = environment;
+        }
+
+        void groupStarted(std::string_view group) override {
+            buffer_ += "  <testsuite name=\"";
+            detail::append_xml_text(buffer_, group);
+            buffer_ += "\">\n";
+            if (!environment_.properties.empty() || !environment_.warnings.empty()) {
+                buffer_ += "    <properties>\n";
+                for (const auto& [key, value] : environment_.properties) {
+                    textProperty(key, value);
+                }
+                for (const auto& warning : environment_.warnings) {
+                    textProperty("warning", warning);
+                }
+                buffer_ += "    </properties>\n";
+            }
+        }
+
+        void testFinished(const TestResult& result) override {
+            buffer_ += "    <testcase classname=\"";
+            detail::append_xml_text(buffer_, result.group);
+            buffer_ += "\" name=\"";
+            detail::append_xml_text(buffer_, result.name);
+            buffer_ += "\" time=\"";
+            detail::append_seconds(buffer_, result.duration);
+            buffer_ += "\">\n";
+            if (result.skipped) {
+                buffer_ += "      <skipped message=\"cached\"/>\n";
+            } else if (!result.passed) {
+                buffer_ += "      <failure message=\"test failed\">";
+                detail::append_xml_text(buffer_, result.output);
+                buffer_ += "</failure>\n";
+            } else if (!result.output.empty()) {
+                buffer_ += "      <system-out>";
+                detail::append_xml_text(buffer_, result.output);
+                buffer_ += "</system-out>\n";
+            }
+            if (result.allocations.valid || result.counters.valid) {
+                buffer_ += "      <properties>\n";
+                if (result.allocations.valid) {
+                    property("allocations", result.allocations.allocations);
+                    property("allocated_bytes", result.allocations.bytes);
+                    property("peak_bytes", result.allocations.peak_bytes);
+                }
+                if (result.counters.valid) {
+                    property("cycles", result.counters.cycles);
+                    property("instructions", result.counters.instructions);
+                    property("cache_misses", result.counters.cache_misses);
+                    property("branch_misses", result.counters.branch_misses);
+                }
+                buffer_ += "      </properties>\n";
+            }
+            buffer_ += "    </testcase>\n";
+            write();
+        }
+
+        void groupFinished(std::string_view /*group*/, size_t /*failed*/, size_t /*total*/) override {
+            buffer_ += "  </testsuite>\n";
+            write();
+        }
+
+        void runFinished(size_t /*failed*/, size_t /*total*/) override {
+            buffer_ += "</testsuites>\n";
+            write();
+            stream_.flush();
+        }
+
+    private:
+        template<typename Number>
+        void property(std::string_view name, Number value) {
+            buffer_ += "        <property name=\"";
+            buffer_ += name;
+            buffer_ += "\" value=\"";
+            detail::append_number(buffer_, value);
+            buffer_ += "\"/>\n";
+        }
+
+        void textProperty(std::string_view name, std::string_view value) {
+            buffer_ += "      <property name=\"";
+            detail::append_xml_text(buffer_, name);
+            buffer_ += "\" value=\"";
+            detail::append_xml_text(buffer_, value);
+            buffer_ += "\"/>\n";
+        }
+
+        void write() {
+            stream_.write(buffer_.data(), std::streamsize(buffer_.size()));
+            buffer_.clear();
+        }
+
+        std::ostream& stream_;
+        std::string buffer_;
+        Environment environment_;
+    };
+
+    // Passes every call to all given reporters, e.g. console and a file
+    class MultiReporter : public Reporter {
+    public:
+        explicit MultiReporter(std::vector<Reporter*> reporters)
+        : reporters_(std::move(reporters)) {}
+
+        void runStarted() override {
+            for (auto* reporter : reporters_) {
+                reporter->runStarted();
+            }
+        }
+
+        void environment(const Environment& environment) override {
+            for (auto* reporter : reporters_) {
+                reporter->environment(environment);
+            }
+        }
+
+        void groupStarted(std::string_view group) override {
+            for (auto* reporter : reporters_) {
+                reporter->groupStarted(group);
+            }
+        }
+
+        void testStarted(std::string_view group, std::string_view name) override {
+            for (auto* reporter : reporters_) {
+                reporter->testStarted(group, name);
+            }
+        }
+
+        void testFinished(const TestResult& result) override {
+            for (auto* reporter : reporters_) {
+                reporter->testFinished(result);
+            }
+        }
+
+        void groupFinished(std::string_view group, size_t failed, size_t total) override {
+            for (auto* reporter : reporters_) {
+                reporter->groupFinished(group, failed, total);
+            }
+        }
+
+        void runFinished(size_t failed, size_t total) override {
+            for (auto* reporter : reporters_) {
+                reporter->runFinished(failed, total);
+            }
+        }
+
+    private:
+        std::vector<Reporter*> reporters_;
+    };
+
+    // Reporter by name: "console", "junit", "jsonl" or "tap", nullptr for other names
+    inline std::unique_ptr<Reporter> make_reporter(std::string_view kind, std::ostream& stream) {
+        if (kind == "console") {
+            return std::make_unique<ConsoleReporter>(stream);
+        } else if (kind == "junit") {
+            return std::make_unique<JUnitReporter>(stream);
+        } else if (kind == "jsonl") {
+            return std::make_unique<JsonLinesReporter>(stream);
+        } else if (kind == "tap") {
+            return std::make_unique<TapReporter>(stream);
+        }
+        return nullptr;
+    }
+#else
+    Reporter& default_reporter();
+#endif
+
+    namespace detail {
+        // Stream buffer that appends everything written to the target string
+        class StringAppendBuffer : public std::streambuf {
+        public:
+            void setTarget(std::string* target) {
+                target_ = target;
+            }
+
+        protected:
+            int_type overflow(int_type ch) override {
+                if (target_ == nullptr || traits_type::eq_int_type(ch, traits_type::eof())) {
+                    return traits_type::eof();
+                }
+                AllocationPause pause;
+                target_->push_back(traits_type::to_char_type(ch));
+                return ch;
+            }
+
+            std::streamsize xsputn(const char* data, std::streamsize size) override {
+                if (target_ == nullptr) {
+                    return 0;
+                }
+                AllocationPause pause;
+                target_->append(data, size_t(size));
+                return size;
+            }
+
+        private:
+            std::string* target_ = nullptr;
+        };
+    }
+
+    class Baseline;
+    class DurationHistory;
+    class ResultCache;
+    class EventLoop;
+
+    // Where tests are executed
+    enum class Isolation {
+        // in the runner's process
+        None,
+        // in pre-forked worker processes, one test at a time per worker. A crash
+        // or a hang fails only the test that caused it. Falls back to `None`
+        // on platforms without fork()
+        Fork
+    };
+
+    // Options for `TestGroup::run` and `run_all`
+    struct RunOptions {
+        // Number of worker threads. 1 runs tests one by one on the calling
+        // thread, 0 uses std::thread::hardware_concurrency()
+        size_t jobs = 1;
+        // Receives results, `default_reporter()` is used if not set
+        Reporter* reporter = nullptr;
+        // Initial capacity of every test's output buffer. Buffers are reused
+        // between tests, so output doesn't cause allocations after warm-up
+        size_t output_capacity = 1024;
+        // Timed tests are compared against (or saved to) this baseline if set
+        Baseline* baseline = nullptr;
+        // Read hardware performance counters around every test, timed tests
+        // and benchmarks also print them. Silently ignored where unavailable
+        bool perf_counters = false;
+        Isolation isolation = Isolation::None;
+        // Tests running longer than this get a stop request (see `Test::stopToken`) and are
+        // reported with a stack sample. With `Isolation::Fork` they are killed if they are still
+        // running `timeout_grace` later. Zero means no limit
+        std::chrono::milliseconds timeout{0};
+        // Tests with their own time limit (see `Test::timeLimit`) get a stop request
+        // when they exceed it by this much, if isolated they are killed at the same time
+        std::chrono::milliseconds timeout_grace = 100ms;
+        // Only tests with "group/name" matching the filter are run, see `detail::filter_match`
+        std::string filter{};
+        // Selected tests are split into `shard_count` parts by hash of "group/name",
+        // only part number `shard_index` is run
+        size_t shard_index = 0;
+        size_t shard_count = 1;
+        // Number of times selected tests are run
+        size_t repeat = 1;
+        // If set, durations of all tests are recorded here. Known durations are used
+        // to balance shards and to start longest tests first when running in parallel
+        DurationHistory* durations = nullptr;
+        // Seed of property tests and of comparison order, zero means a seed derived from the test name
+        uint64_t seed = 0;
+        // If set, tests that passed last time with the same inputs are skipped
+        // and results of the others are recorded here
+        ResultCache* cache = nullptr;
+        // If not zero, progress of the run is printed to stderr this often, see `detail::ProgressMonitor`
+        std::chrono::milliseconds progress{0};
+        // If not empty, bodies of timed tests are profiled (Linux only) and folded stacks of
+        // those slower than their limit or baseline are written to this directory
+        std::string profile{};
+        // If not empty, timed tests, benchmarks, comparisons and scaling tests are pinned to these
+        // CPUs (one test per CPU, the rest run unpinned) and their priority is raised as far as allowed (Linux only).
+        // The environment is reported with warnings about unstable timings, see `detect_environment`
+        std::vector<int> timing_cpus{};
+        // Directory of snapshots compared by `Checker::matches_snapshot`
+        std::string snapshots = "snapshots";
+        // If set, `matches_snapshot` rewrites snapshots that differ instead of failing
+        bool update_snapshots = false;
+    };
+
+    namespace detail {
+#if defined(__linux__)
+        // Pins the calling thread to one CPU, restores its affinity when destroyed
+        class CpuPin {
+        public:
+            // CPU the thread is running on
+            CpuPin()
+            : CpuPin(::sched_getcpu()) {}
+
+            explicit CpuPin(int cpu)
+            : cpu_(cpu) {
+                if (cpu_ < 0 || cpu_ >= CPU_SETSIZE || ::pthread_getaffinity_np(::pthread_self(), sizeof(previous_), &previous_) != 0) {
+                    cpu_ = -1;
+                    return;
+                }
+                cpu_set_t only;
+                CPU_ZERO(&only);
+                CPU_SET(cpu_, &only);
+                if (::pthread_setaffinity_np(::pthread_self(), sizeof(only), &only) != 0) {
+                    cpu_ = -1;
+                }
+            }
+
+            CpuPin(const CpuPin&) = delete;
+
+            ~CpuPin() {
+                if (cpu_ >= 0) {
+                    ::pthread_setaffinity_np(::pthread_self(), sizeof(previous_), &previous_);
+                }
+            }
+
+            // -1 if the thread could not be pinned
+            int cpu() const {
+                return cpu_;
+            }
+
+        private:
+            int cpu_ = -1;
+            cpu_set_t previous_;
+        };
+
+        // Raises scheduling priority of the calling thread as far as it is allowed,
+        // restores it when destroyed. Needs CAP_SYS_NICE or a RLIMIT_NICE above 20
+        class ThreadPriority {
+        public:
+            ThreadPriority() {
+                errno = 0;
+                const int previous = ::getpriority(PRIO_PROCESS, id_);
+                if (errno != 0) {
+                    return;
+                }
+                int lowest = -20;
+                if (::setpriority(PRIO_PROCESS, id_, lowest) != 0) {
+                    // without the capability the soft limit of RLIMIT_NICE is the lowest allowed value
+                    struct rlimit limit;
+                    if (::getrlimit(RLIMIT_NICE, &limit) != 0 || limit.rlim_cur == RLIM_INFINITY) {
+                        return;
+                    }
+                    lowest = 20 - int(limit.rlim_cur);
+                    if (lowest >= previous || ::setpriority(PRIO_PROCESS, id_, lowest) != 0) {
+                        return;
+                    }
+                }
+                previous_ = previous;
+                nice_ = lowest;
+            }
+
+            ThreadPriority(const ThreadPriority&) = delete;
+
+            ~ThreadPriority() {
+                if (previous_) {
+                    ::setpriority(PRIO_PROCESS, id_, *previous_);
+                }
+            }
+
+            // Nice value of the thread if it was raised
+            std::optional<int> nice() const {
+                return previous_ ? std::optional<int>(nice_) : std::nullopt;
+            }
+
+        private:
+            id_t id_ = id_t(::syscall(SYS_gettid));
+            std::optional<int> previous_;
+            int nice_ = 0;
+        };
+#else
+        class CpuPin {
+        public:
+            CpuPin() = default;
+
+            explicit CpuPin(int /*cpu*/) {}
+
+            int cpu() const {
+                return -1;
+            }
+        };
+
+        class ThreadPriority {
+        public:
+            std::optional<int> nice() const {
+                return std::nullopt;
+            }
+        };
+#endif
+
+        // Parses lists like "2,3,8-11" into `cpus`
+        inline bool parse_cpu_list(std::string_view list, std::vector<int>& cpus) {
+            cpus.clear();
+            while (!list.empty()) {
+                const std::string_view range = list.substr(0, list.find(','));
+                list.remove_prefix(std::min(list.size(), range.size() + 1));
+                int first = 0;
+                int last = 0;
+                const char* end = range.data() + range.size();
+                auto [middle, error] = std::from_chars(range.data(), end, first);
+                if (error != std::errc{}) {
+                    return false;
+                }
+                last = first;
+                if (middle != end) {
+                    if (*middle != '-') {
+                        return false;
+                    }
+                    auto [last_end, last_error] = std::from_chars(middle + 1, end, last);
+                    if (last_error != std::errc{} || last_end != end || last < first) {
+                        return false;
+                    }
+                }
+                for (int cpu = first; cpu <= last; ++cpu) {
+                    cpus.push_back(cpu);
+                }
+            }
+            return !cpus.empty();
+        }
+
+        // First line of a (usually /proc or /sys) file, empty if it can't be read
+        inline std::string read_first_line(const char* path) {
+            std::ifstream file(path);
+            std::string line;
+            std::getline(file, line);
+            return line;
+        }
+
+        // CPUs isolated from the scheduler with the isolcpus kernel parameter
+        inline std::vector<int> isolated_cpus() {
+            std::vector<int> cpus;
+            parse_cpu_list(read_first_line("/sys/devices/system/cpu/isolated"), cpus);
+            return cpus;
+        }
+
+        // Isolated CPUs if there are any, the last CPU otherwise
+        inline std::vector<int> default_timing_cpus() {
+            std::vector<int> cpus = isolated_cpus();
+            if (cpus.empty()) {
+                cpus.push_back(int(std::max(std::thread::hardware_concurrency(), 1u)) - 1);
+            }
+            return cpus;
+        }
+
+        // Gives every timing-sensitive test a CPU of `RunOptions::timing_cpus` of its own.
+        // Tests don't wait for a CPU, since waiting would count against their time limits
+        class TimingCpus {
+        public:
+            // A CPU no other test is pinned to, -1 if all of `cpus` are taken
+            static int acquire(std::span<const int> cpus) {
+                std::lock_guard lock(mutex());
+                auto& taken = busy();
+                for (int cpu : cpus) {
+                    if (std::find(taken.begin(), taken.end(), cpu) == taken.end()) {
+                        taken.push_back(cpu);
+                        return cpu;
+                    }
+                }
+                return -1;
+            }
+
+            static void release(int cpu) {
+                std::lock_guard lock(mutex());
+                std::erase(busy(), cpu);
+            }
+
+        private:
+            static std::mutex& mutex() {
+                static std::mutex mutex;
+                return mutex;
+            }
+
+            static std::vector<int>& busy() {
+                static std::vector<int> busy;
+                return busy;
+            }
+        };
+
+        // Stabilizes a run of a timing-sensitive test: pins it to one of
+        // `RunOptions::timing_cpus` and raises its priority. The test runs
+        // unpinned if other tests take all of these CPUs, rather than sharing one
+        class TimingScope {
+        public:
+            explicit TimingScope(std::span<const int> cpus) {
+                if (cpus.empty()) {
+                    return;
+                }
+                cpu_ = TimingCpus::acquire(cpus);
+                if (cpu_ < 0) {
+                    return;
+                }
+                pin_.emplace(cpu_);
+                priority_.emplace();
+            }
+
+            TimingScope(const TimingScope&) = delete;
+
+            ~TimingScope() {
+                priority_.reset();
+                pin_.reset();
+                if (cpu_ >= 0) {
+                    TimingCpus::release(cpu_);
+                }
+            }
+
+        private:
+            int cpu_ = -1;
+            std::optional<CpuPin> pin_;
+            std::optional<ThreadPriority> priority_;
+        };
+    }
+
+    // Describes the machine and the build, with warnings about settings
+    // that make timings unstable: frequency scaling, turbo boost, ASLR,
+    // unoptimized builds and timing CPUs that are shared with other processes
+    inline Environment detect_environment(const RunOptions& options) {
+        Environment environment;
+        auto add = [&](std::string key, std::string value) {
+            environment.properties.emplace_back(std::move(key), std::move(value));
+        };
+#if defined(__clang__)
+        add("compiler", "clang " __clang_version__);
+#elif defined(__GNUC__)
+        add("compiler", "gcc " __VERSION__);
+#elif defined(_MSC_VER)
+        add("compiler", "msvc " + std::to_string(_MSC_FULL_VER));
+#endif
+#if defined(__OPTIMIZE__) || (defined(_MSC_VER) && !defined(_DEBUG))
+        add("build", "optimized");
+#else
+        add("build", "debug");
+        environment.warnings.push_back("built without optimizations, timings are not representative");
+#endif
+#if TINY_TEST__HAS_FORK
+        struct utsname name;
+        if (::uname(&name) == 0) {
+            add("host", name.nodename);
+            add("os", std::string(name.sysname) + ' ' + name.release + ' ' + name.machine);
+        }
+#endif
+        add("cpus", std::to_string(std::thread::hardware_concurrency()));
+#if defined(__linux__)
+        std::ifstream cpuinfo("/proc/cpuinfo");
+        for (std::string line; std::getline(cpuinfo, line);) {
+            if (line.starts_with("model name")) {
+                add("cpu", line.substr(std::min(line.size(), line.find(':') + 2)));
+                break;
+            }
+        }
+        const std::string governor = detail::read_first_line("/sys/devices/system/cpu/cpu0/cpufreq/scaling_governor");
+        if (!governor.empty()) {
+            add("governor", governor);
+            if (governor != "performance") {
+                environment.warnings.push_back("CPU frequency scaling is enabled (governor " + governor + "), set the \"performance\" governor for stable timings");
+            }
+        }
+        const std::string no_turbo = detail::read_first_line("/sys/devices/system/cpu/intel_pstate/no_turbo");
+        const std::string boost = detail::read_first_line("/sys/devices/system/cpu/cpufreq/boost");
+        if (!no_turbo.empty() || !boost.empty()) {
+            const bool turbo = no_turbo == "0" || boost == "1";
+            add("turbo", turbo ? "on" : "off");
+            if (turbo) {
+                environment.warnings.push_back("turbo boost is on, frequency depends on temperature and load of other cores");
+            }
+        }
+        const std::string aslr = detail::read_first_line("/proc/sys/kernel/randomize_va_space");
+        if (!aslr.empty()) {
+            add("aslr", aslr == "0" ? "off" : "on");
+            if (aslr != "0") {
+                environment.warnings.push_back("ASLR is on, code and data alignment changes between runs (run under `setarch -R` to disable it)");
+            }
+        }
+#endif
+        if (!options.timing_cpus.empty()) {
+            std::string cpus;
+            for (int cpu : options.timing_cpus) {
+                cpus += cpus.empty() ? "" : ",";
+                cpus += std::to_string(cpu);
+            }
+            add("timing_cpus", cpus);
+            const std::vector<int> isolated = detail::isolated_cpus();
+            if (std::any_of(options.timing_cpus.begin(), options.timing_cpus.end(), [&](int cpu) {
+                return std::find(isolated.begin(), isolated.end(), cpu) == isolated.end();
+            })) {
+                environment.warnings.push_back("timing cpus " + cpus + " are not isolated (see isolcpus), other threads may run on them");
+            }
+            const detail::ThreadPriority probe;
+            if (const auto nice = probe.nice()) {
+                add("timing_priority", "nice " + std::to_string(*nice));
+            } else {
+                environment.warnings.push_back("priority of timing tests can't be raised, it needs CAP_SYS_NICE or RLIMIT_NICE");
+            }
+        }
+        return environment;
+    }
+
+    // Base Test class. All other tests should inherit from it
+    // and override `doTest` method
+    class Test {
+    public:
+        Test(std::string name): name_(std::move(name)) {}
+
+        virtual ~Test() = default;
+
+        // Runs the test and reports it with the default reporter
+        bool operator()() {
+            TestResult result;
+            run(result);
+            default_reporter().testFinished(result);
+            return result.passed;
+        }
+
+        // Runs the test, its output is appended to `result.output`.
+        // `result.group` should be set by the caller
+        void run(TestResult& result, const RunOptions* options = nullptr, std::stop_token stop = {}) {
+            beginRun(result, options, std::move(stop));
+            const bool count = options != nullptr && options->perf_counters;
+            const CounterValues counters_before = count ? PerfCounters::thread().read() : CounterValues{};
+            const detail::TimingScope timing(options != nullptr && timingSensitive() ? std::span<const int>(options->timing_cpus) : std::span<const int>{});
+            AllocationScope allocations;
+            const auto started = std::chrono::steady_clock::now();
+            bool res = false;
+            try {
+                res = doTest();
+            } catch (...) {
+                reportException(std::current_exception());
+            }
+            result.duration = std::chrono::steady_clock::now() - started;
+            result.counters = count ? PerfCounters::thread().read() - counters_before : CounterValues{};
+            result.allocations = allocations.stop();
+            if (check_leaks_ && !result.allocations.valid) {
+                out_ << "leaks are not checked: allocation tracking is disabled, define TINY_TEST__TRACK_ALLOCATIONS in one source file\n";
+                res = false;
+            } else if (check_leaks_ && result.allocations.live_bytes > 0) {
+                out_ << "LEAKED " << result.allocations.live_bytes << " bytes, "
+                    << result.allocations.allocations - result.allocations.deallocations << " blocks not freed\n";
+                res = false;
+            }
+            endRun(result, res);
+        }
+
+        // Output the test has produced but not written to `out()` yet, e.g. buffered failures of
+        // `Checker`. Read from a signal handler when an isolated worker dies or times out
+        virtual std::string_view pendingOutput() const {
+            return {};
+        }
+
+        // True for tests which can be run interleaved with other such tests
+        // on one thread, see `AsyncTest`
+        virtual bool isAsync() const {
+            return false;
+        }
+
+        // True for tests which measure time, they are pinned to `RunOptions::timing_cpus`
+        virtual bool timingSensitive() const {
+            return false;
+        }
+
+        // Starts the test on `loop` instead of running it with `run`, `done` is called
+        // from the loop once the test finishes. Called only if `isAsync()` is true
+        virtual void startAsync(EventLoop& /*loop*/, TestResult& /*result*/, const RunOptions* /*options*/, std::function<void()> done) {
+            done();
+        }
+
+        const std::string& name() const {
+            return name_;
+        }
+
+        // Serial-only tests are never run concurrently with other tests
+        bool serialOnly() const {
+            return serial_only_;
+        }
+
+        void setSerialOnly(bool serial_only = true) {
+            serial_only_ = serial_only;
+        }
+
+        // Tests checking leaks fail if heap memory they allocate is not freed by the
+        // end of the run. Requires allocation tracking, see `allocation_tracking_enabled`
+        bool checksLeaks() const {
+            return check_leaks_;
+        }
+
+        void setCheckLeaks(bool check_leaks = true) {
+            check_leaks_ = check_leaks;
+        }
+
+        // Files the test reads, their contents are a part of the test inputs for `ResultCache`
+        const std::vector<std::string>& dependencies() const {
+            return dependencies_;
+        }
+
+        void addDependency(std::string path) {
+            dependencies_.push_back(std::move(path));
+        }
+
+        // Stop is requested once the test runs past its time limit or `RunOptions::timeout`,
+        // long running bodies should check it and return early
+        const std::stop_token& stopToken() const {
+            return stop_token_;
+        }
+
+        // Wall-clock time after which the test is known to fail,
+        // zero if there is no such limit
+        virtual std::chrono::nanoseconds timeLimit(const RunOptions& /*options*/) const {
+            return std::chrono::nanoseconds::zero();
+        }
+
+    protected:
+        std::string name_;
+
+        virtual bool doTest() = 0;
+
+        // Tests should write their output here instead of std::cout,
+        // it is buffered and passed to the reporter when the test ends
+        std::ostream& out() {
+            return out_;
+        }
+
+        // Options of the current run, null if the test is run on its own
+        const RunOptions* options() const {
+            return options_;
+        }
+
+        // "group/name", unique key of the test used for stored data
+        std::string key() const {
+            std::string key;
+            if (current_ != nullptr) {
+                key += current_->group;
+            }
+            key += '/';
+            key += name_;
+            return key;
+        }
+
+        // True if run options ask for hardware counters
+        bool countersEnabled() const {
+            return options_ != nullptr && options_->perf_counters;
+        }
+
+        // Parts of `run` before and after the test body, output goes to `result` in between
+        void beginRun(TestResult& result, const RunOptions* options, std::stop_token stop = {}) {
+            result.name = name_;
+            current_ = &result;
+            options_ = options;
+            stop_token_ = std::move(stop);
+            cacheable_ = true;
+            buffer_.setTarget(&result.output);
+            out_.clear();
+        }
+
+        void endRun(TestResult& result, bool passed) {
+            buffer_.setTarget(nullptr);
+            current_ = nullptr;
+            options_ = nullptr;
+            stop_token_ = {};
+            result.passed = passed;
+            result.cacheable = cacheable_;
+        }
+
+        // The current run reads something its inputs for `ResultCache` don't cover,
+        // so its result is never reused
+        void markUncacheable() {
+            cacheable_ = false;
+        }
+
+        void reportException(std::exception_ptr error) {
+            try {
+                std::rethrow_exception(error);
+            } catch (std::exception& exception) {
+                out_ << "caught exception: " << exception.what() << '\n';
+            } catch (...) {
+                out_ << "caught unknown exception\n";
+            }
+        }
+
+    private:
+        const TestResult* current_ = nullptr;
+        const RunOptions* options_ = nullptr;
+        std::stop_token stop_token_;
+        detail::StringAppendBuffer buffer_;
+        std::ostream out_{&buffer_};
+        bool serial_only_ = false;
+        bool check_leaks_ = false;
+        bool cacheable_ = true;
+        std::vector<std::string> dependencies_;
+    };
+
+    // Wrapper around any Functor that takes nothing (or std::stop_token,
+    // see `Test::stopToken`) and returns bool
+    template<typename Functor>
+    class SimpleTest: public Test {
+    public:
+        SimpleTest(std::string name, Functor f)
+        : Test(std::move(name))
+        , f_(std::move(f)) {}
+
+        bool doTest() override {
+            if constexpr (std::is_invocable_v<Functor&, std::stop_token>) {
+                return f_(stopToken());
+            } else {
+                return f_();
+            }
+        }
+
+    private:
+        Functor f_;
+    };
+
+    // Tolerance of float comparison: numbers are equal if there are
+    // at most `count` representable numbers between them
+    struct Ulps {
+        uint64_t count;
+    };
+
+    // Tolerance of float comparison: numbers are equal if their difference
+    // is at most `ratio` of the larger magnitude
+    struct Relative {
+        double ratio;
+    };
+
+    namespace detail {
+        // Distance between two numbers in units in the last place, computed with integer
+        // bit arithmetic and no branches. NaN is infinitely far from anything, +0 and -0 are equal
+        template<std::floating_point Float>
+        requires std::numeric_limits<Float>::is_iec559 && (sizeof(Float) == 4 || sizeof(Float) == 8)
+        inline uint64_t ulp_distance(Float x, Float y) {
+            using Bits = std::conditional_t<sizeof(Float) == 4, uint32_t, uint64_t>;
+            using Signed = std::make_signed_t<Bits>;
+            constexpr Bits magnitude_mask = std::numeric_limits<Signed>::max();
+            // sign-magnitude representation to two's complement, so that order of
+            // integers matches order of numbers
+            auto ordered = [](Float value) {
+                const Bits bits = std::bit_cast<Bits>(value);
+                const Bits sign = Bits(0) - (bits >> (sizeof(Bits) * 8 - 1));
+                return ((bits & magnitude_mask) ^ sign) - sign;
+            };
+            const Bits a = ordered(x), b = ordered(y);
+            const Bits difference = Signed(a) > Signed(b) ? a - b : b - a;
+            const uint64_t nan = uint64_t(0) - uint64_t((x != x) | (y != y));
+            return uint64_t(difference) | nan;
+        }
+
+        // Comparisons of float checks: `operator()` is the fast branch-free test,
+        // the rest only describes failures. Compared numbers are printed with
+        // `precision` digits, tolerances and errors with 4
+
+        template<std::floating_point Float>
+        struct AbsoluteCompare {
+            static constexpr int precision = 4;
+
+            Float error;
+
+            bool operator()(Float x, Float y) const {
+                return std::abs(x - y) < error;
+            }
+
+            void describe(std::ostream& stream) const {
+                stream << "with epsilon " << error;
+            }
+
+            void describe(std::ostream& stream, Float /*x*/, Float /*y*/) const {
+                describe(stream);
+            }
+        };
+
+        template<std::floating_point Float>
+        struct UlpsCompare {
+            static constexpr int precision = std::numeric_limits<Float>::max_digits10;
+
+            uint64_t count;
+
+            bool operator()(Float x, Float y) const {
+                return ulp_distance(x, y) <= count;
+            }
+
+            void describe(std::ostream& stream) const {
+                stream << "by more than " << count << " ulps";
+            }
+
+            void describe(std::ostream& stream, Float x, Float y) const {
+                describe(stream);
+                const uint64_t distance = ulp_distance(x, y);
+                if (distance == std::numeric_limits<uint64_t>::max()) {
+                    stream << " (NaN)";
+                } else {
+                    stream << " (" << distance << " ulps apart)";
+                }
+            }
+        };
+
+        template<std::floating_point Float>
+        struct RelativeCompare {
+            static constexpr int precision = std::numeric_limits<Float>::max_digits10;
+
+            Float ratio;
+
+            bool operator()(Float x, Float y) const {
+                return (x == y) | (std::abs(x - y) <= ratio * std::max(std::abs(x), std::abs(y)));
+            }
+
+            void describe(std::ostream& stream) const {
+                stream << "with relative tolerance " << ratio;
+            }
+
+            void describe(std::ostream& stream, Float /*x*/, Float /*y*/) const {
+                describe(stream);
+            }
+        };
+
+        template<typename Range>
+        using range_float_t = std::remove_cv_t<std::ranges::range_value_t<Range>>;
+
+        // Both ranges are contiguous ranges of `Float`
+        template<typename First, typename Second, typename Float>
+        concept FloatRanges = std::floating_point<Float>
+            && std::same_as<std::remove_cv_t<std::ranges::range_value_t<First>>, Float>
+            && std::same_as<std::remove_cv_t<std::ranges::range_value_t<Second>>, Float>;
+
+        template<typename T>
+        TINY_TEST__COLD void print_value(std::ostream& stream, const void* value) {
+            stream << *static_cast<const T*>(value);
+        }
+
+        // Type-erased printable value, so that failure reporting is compiled once
+        struct ValueRef {
+            template<typename T>
+            ValueRef(const T& value, std::string_view type)
+            : value(&value)
+            , print(&print_value<T>)
+            , type(type) {}
+
+            const void* value;
+            void (*print)(std::ostream&, const void*);
+            std::string_view type;
+        };
+
+        inline std::ostream& operator<<(std::ostream& stream, const ValueRef& value) {
+            value.print(stream, value.value);
+            return stream << " (" << value.type << ')';
+        }
+
+#if TINY_TEST__HAS_FORK
+        // "exited with code 3", "killed by signal 11 (Segmentation fault)"
+        inline std::string describe_exit(int status) {
+            if (WIFSIGNALED(status)) {
+                return "killed by signal " + std::to_string(WTERMSIG(status)) + " (" + ::strsignal(WTERMSIG(status)) + ")";
+            }
+            return "exited with code " + std::to_string(WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+        }
+
+        // Test running in an isolated worker and the pipe its results go to, so that
+        // a dying worker can still send its output, see `flush_pending_output`
+        struct PendingOutput {
+            std::atomic<int> fd{-1};
+            const std::string* output = nullptr;
+            const Test* test = nullptr;
+        };
+
+        inline PendingOutput& pending_output() {
+            static PendingOutput pending;
+            return pending;
+        }
+
+        // Outcome of a body run by `run_forked`
+        struct ForkedResult {
+            // false if the process could not be started, `output` then says why
+            bool forked = false;
+            // the body returned or threw instead of ending the process
+            bool returned = false;
+            bool threw = false;
+            // killed because stop was requested
+            bool stopped = false;
+            // as returned by waitpid
+            int status = 0;
+            // everything the process has written to stderr
+            std::string output;
+        };
+
+        // Runs `body(context)` in a forked copy of the calling process with stderr captured and
+        // core dumps disabled. Only the calling thread exists there, so the body must not wait
+        // for other threads. The process is killed once `stop` is requested
+        inline ForkedResult run_forked(void (*body)(void*), void* context, const std::stop_token& stop) {
+            AllocationPause pause;
+            ForkedResult result;
+            int output[2];
+            int outcome[2];
+            if (::pipe(output) != 0) {
+                result.output = std::string("pipe failed: ") + std::strerror(errno);
+                return result;
+            }
+            if (::pipe(outcome) != 0) {
+                result.output = std::string("pipe failed: ") + std::strerror(errno);
+                ::close(output[0]);
+                ::close(output[1]);
+                return result;
+            }
+            const pid_t pid = ::fork();
+            if (pid == 0) {
+                // a crash here is expected, it must not be reported as a crash of the worker
+                pending_output().fd.store(-1, std::memory_order_relaxed);
+                ::dup2(output[1], STDERR_FILENO);
+                ::close(output[0]);
+                ::close(output[1]);
+                ::close(outcome[0]);
+                const struct rlimit no_core = {0, 0};
+                ::setrlimit(RLIMIT_CORE, &no_core);
+                char code = 'r';
+                try {
+                    body(context);
+                } catch (...) {
+                    code = 't';
+                }
+                while (::write(outcome[1], &code, 1) < 0 && errno == EINTR) {}
+                ::_exit(0);
+            }
+            ::close(output[1]);
+            ::close(outcome[1]);
+            if (pid < 0) {
+                result.output = std::string("fork failed: ") + std::strerror(errno);
+                ::close(output[0]);
+                ::close(outcome[0]);
+                return result;
+            }
+            result.forked = true;
+
+            // stderr is read while the body runs, so that it never blocks on a full pipe
+            pollfd fd = {output[0], POLLIN, 0};
+            bool killed = false;
+            char chunk[4096];
+            while (true) {
+                if (!killed && stop.stop_requested()) {
+                    killed = ::kill(pid, SIGKILL) == 0;
+                }
+                const int ready = ::poll(&fd, 1, killed || !stop.stop_possible() ? -1 : 10);
+                if (ready < 0 && errno != EINTR) {
+                    break;
+                }
+                if (ready <= 0) {
+                    continue;
+                }
+                const ssize_t received = ::read(output[0], chunk, sizeof(chunk));
+                if (received < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (received <= 0) {
+                    break;
+                }
+                result.output.append(chunk, size_t(received));
+            }
+            char code = 0;
+            ssize_t received = 0;
+            while ((received = ::read(outcome[0], &code, 1)) < 0 && errno == EINTR) {}
+            result.returned = received == 1 && code == 'r';
+            result.threw = received == 1 && code == 't';
+            while (::waitpid(pid, &result.status, 0) < 0 && errno == EINTR) {}
+            result.stopped = killed;
+            ::close(output[0]);
+            ::close(outcome[0]);
+            return result;
+        }
+
+        template<typename Body>
+        void call_body(void* body) {
+            (*static_cast<std::remove_reference_t<Body>*>(body))();
+        }
+
+        // Empty if the process ended before the body returned, by `signal` (if not zero) and with
+        // stderr containing a match of `pattern` (if not empty), otherwise describes the difference.
+        // Compiled with the runner, so that files with tests don't pay for <regex>
+#if TINY_TEST__RUNNER
+        TINY_TEST__RUNNER_API std::string death_mismatch(const ForkedResult& result, int signal, std::string_view pattern) {
+            AllocationPause pause;
+            if (!result.forked) {
+                return result.output;
+            } else if (result.returned) {
+                return "body returned instead of ending the process";
+            } else if (result.threw) {
+                return "body threw an exception instead of ending the process";
+            } else if (result.stopped) {
+                return "process was killed because the test was stopped";
+            } else if (signal != 0 && !(WIFSIGNALED(result.status) && WTERMSIG(result.status) == signal)) {
+                return "process " + describe_exit(result.status) + ", expected signal "
+                    + std::to_string(signal) + " (" + ::strsignal(signal) + ")";
+            } else if (pattern.empty()) {
+                return {};
+            }
+            try {
+                if (std::regex_search(result.output, std::regex(pattern.begin(), pattern.end()))) {
+                    return {};
+                }
+            } catch (const std::regex_error& error) {
+                return "invalid regex \"" + std::string(pattern) + "\": " + error.what();
+            }
+            return "process " + describe_exit(result.status) + ", stderr doesn't match \"" + std::string(pattern) + '"';
+        }
+#else
+        std::string death_mismatch(const ForkedResult& result, int signal, std::string_view pattern);
+#endif
+#endif
+
+        // Outcome of `check_snapshot`
+        struct SnapshotResult {
+            bool matched = false;
+            // the stored snapshot was missing or different and was rewritten
+            bool updated = false;
+            // if not matched, the difference or the error
+            std::string description;
+        };
+
+        // Compares `bytes` with the snapshot `directory/name`, or writes them there if `update`
+        // is set, see `Checker::matches_snapshot`. Defined after `MappedFile`
+        inline SnapshotResult check_snapshot(const std::string& directory, std::string_view name, std::string_view bytes, bool update);
+    }
+
+    // Checks of PrettyTest, not a template so they are compiled once.
+    // Passing check is a single branch, failures are described by cold functions into
+    // a preallocated buffer which is written to `out()` after the test body returns
+    class Checker: public Test {
+    public:
+        // Failures after this many are counted but not described
+        static constexpr size_t max_described_failures = 32;
+
+        explicit Checker(std::string name)
+        : Test(std::move(name)) {
+            failures_.reserve(1024);
+            failures_buffer_.setTarget(&failures_);
+        }
+
+#ifndef TINY_TEST__NO_SOURCE_LOCATION
+        bool check(bool condition, const std::source_location location = std::source_location::current()) {
+            if (condition) [[likely]] {
+                return true;
+            }
+            return checkFailed(location);
+        }
+
+        template<typename First, typename Second>
+        requires Printable<First> && Printable<Second>
+        bool equals(
+                First& first,
+                Second&& second,
+                const std::source_location location = std::source_location::current()) {
+            if (first == second) [[likely]] {
+                return true;
+            }
+            return equalsFailed(location, {first, type_name<First>()}, {second, type_name<Second>()});
+        }
+
+        bool equals(
+                auto&& first,
+                auto&& second,
+                const std::source_location location = std::source_location::current()) {
+            return check(first == second, location);
+        }
+
+        template<typename Float>
+        requires std::floating_point<Float>
+        bool float_equals(Float x, Float y, Float error, const std::source_location location = std::source_location::current()) {
+            return compareFloats(x, y, detail::AbsoluteCompare<Float>{error}, location);
+        }
+
+        // Equal if at most `ulps` representable numbers lie between `x` and `y`
+        template<typename Float>
+        requires std::floating_point<Float>
+        bool float_equals_ulps(Float x, Float y, uint64_t ulps, const std::source_location location = std::source_location::current()) {
+            return compareFloats(x, y, detail::UlpsCompare<Float>{ulps}, location);
+        }
+
+        // Equal if |x - y| <= ratio * max(|x|, |y|)
+        template<typename Float>
+        requires std::floating_point<Float>
+        bool float_equals_rel(Float x, Float y, Float ratio, const std::source_location location = std::source_location::current()) {
+            return compareFloats(x, y, detail::RelativeCompare<Float>{ratio}, location);
+        }
+
+        bool fail(const std::source_location location = std::source_location::current()) {
+            return checkFailed(location);
+        }
+
+        // Element-wise comparison of two ranges of the same size.
+        // Failure is reported as a summary: number of mismatches and the first of them
+        template<std::ranges::sized_range First, std::ranges::sized_range Second>
+        bool equals_range(const First& first, const Second& second, const std::source_location location = std::source_location::current()) {
+            if (std::ranges::size(first) == std::ranges::size(second) && countMismatches(first, second) == 0) [[likely]] {
+                return true;
+            }
+            return rangesFailed(location, first, second);
+        }
+
+        // Checks that `predicate` holds for every element of `range`
+        template<std::ranges::sized_range Range, typename Predicate>
+        bool all_of(const Range& range, Predicate&& predicate, const std::source_location location = std::source_location::current()) {
+            if (countRejected(range, predicate) == 0) [[likely]] {
+                return true;
+            }
+            return allOfFailed(location, range, predicate);
+        }
+
+        // `float_equals` for every pair of elements of two contiguous ranges
+        template<std::ranges::contiguous_range First, std::ranges::contiguous_range Second, typename Float>
+        requires detail::FloatRanges<First, Second, Float>
+        bool float_equals_span(const First& xs, const Second& ys, Float error, const std::source_location location = std::source_location::current()) {
+            return compareSpans<Float>(xs, ys, detail::AbsoluteCompare<Float>{error}, location);
+        }
+
+        // `float_equals_ulps` for every pair of elements
+        template<std::ranges::contiguous_range First, std::ranges::contiguous_range Second, typename Float = detail::range_float_t<First>>
+        requires detail::FloatRanges<First, Second, Float>
+        bool float_equals_span(const First& xs, const Second& ys, Ulps ulps, const std::source_location location = std::source_location::current()) {
+            return compareSpans<Float>(xs, ys, detail::UlpsCompare<Float>{ulps.count}, location);
+        }
+
+        // `float_equals_rel` for every pair of elements
+        template<std::ranges::contiguous_range First, std::ranges::contiguous_range Second, typename Float = detail::range_float_t<First>>
+        requires detail::FloatRanges<First, Second, Float>
+        bool float_equals_span(const First& xs, const Second& ys, Relative relative, const std::source_location location = std::source_location::current()) {
+            return compareSpans<Float>(xs, ys, detail::RelativeCompare<Float>{Float(relative.ratio)}, location);
+        }
+
+        // Checks that `body` makes at most `count` heap allocations.
+        // Requires allocation tracking, see `allocation_tracking_enabled`
+        template<typename Body>
+        bool max_allocations(size_t count, Body&& body, const std::source_location location = std::source_location::current()) {
+            AllocationScope scope;
+            body();
+            const AllocationStats stats = scope.stop();
+            if (stats.valid && stats.allocations <= count) [[likely]] {
+                return true;
+            }
+            return allocationsFailed(location, stats, count);
+        }
+
+        template<typename Body>
+        bool no_allocations(Body&& body, const std::source_location location = std::source_location::current()) {
+            return max_allocations(0, std::forward<Body>(body), location);
+        }
+
+        // Checks that heap usage of `body` never exceeds its starting level by more than
+        // `bytes`. Requires allocation tracking, see `allocation_tracking_enabled`
+        template<typename Body>
+        bool max_peak_bytes(int64_t bytes, Body&& body, const std::source_location location = std::source_location::current()) {
+            AllocationScope scope;
+            body();
+            const AllocationStats stats = scope.stop();
+            if (stats.valid && stats.peak_bytes <= bytes) [[likely]] {
+                return true;
+            }
+            return memoryFailed(location, [&](std::ostream& stream) { describePeakBytes(stream, stats, bytes); });
+        }
+
+        // Checks that everything `body` allocates on the heap is freed by the end of it.
+        // Requires allocation tracking, see `allocation_tracking_enabled`
+        template<typename Body>
+        bool no_leaks(Body&& body, const std::source_location location = std::source_location::current()) {
+            AllocationScope scope;
+            body();
+            const AllocationStats stats = scope.stop();
+            if (stats.valid && stats.live_bytes <= 0) [[likely]] {
+                return true;
+            }
+            return memoryFailed(location, [&](std::ostream& stream) { describeLeak(stream, stats); });
+        }
+
+        // Checks that RSS of the process grows by at most `bytes` while `body` runs,
+        // which also covers memory mapped directly. RSS is sampled, see `detail::RssSampler`,
+        // so run such tests with `serial`. Linux only
+        template<typename Body>
+        bool max_peak_rss(int64_t bytes, Body&& body, const std::source_location location = std::source_location::current()) {
+            detail::RssSampler sampler;
+            body();
+            const RssStats stats = sampler.stop();
+            if (stats.valid && stats.peak_bytes - stats.start_bytes <= bytes) [[likely]] {
+                return true;
+            }
+            return memoryFailed(location, [&](std::ostream& stream) { describeRss(stream, stats, bytes); });
+        }
+
+#if TINY_TEST__HAS_FORK
+        // Checks that `body` ends the process with `signal`, e.g. SIGABRT of a failed assert
+        // or of `std::terminate`. The body runs in a forked copy of the test process (with
+        // `Isolation::Fork` it is the worker), so a check costs one fork, see `detail::run_forked`
+        template<typename Body>
+        bool expect_death(Body&& body, int signal, const std::source_location location = std::source_location::current()) {
+            const auto result = detail::run_forked(&detail::call_body<Body>, &body, stopToken());
+            const std::string mismatch = detail::death_mismatch(result, signal, {});
+            if (mismatch.empty()) [[likely]] {
+                return true;
+            }
+            return deathFailed(location, mismatch, result.output);
+        }
+
+        // Checks that `body` ends the process, by a signal or by exiting, and writes
+        // something matching `pattern` (ECMAScript regex) to stderr before that
+        template<typename Body>
+        bool expect_death(Body&& body, std::string_view pattern, const std::source_location location = std::source_location::current()) {
+            const auto result = detail::run_forked(&detail::call_body<Body>, &body, stopToken());
+            const std::string mismatch = detail::death_mismatch(result, 0, pattern);
+            if (mismatch.empty()) [[likely]] {
+                return true;
+            }
+            return deathFailed(location, mismatch, result.output);
+        }
+#endif
+
+        // Checks that `bytes` equal the snapshot file `name` in `RunOptions::snapshots`. The file is
+        // memory mapped and compared in chunks, a difference is described by a diff of the changed
+        // lines (a hex dump for binary data). With `RunOptions::update_snapshots` it is rewritten instead.
+        // Tests using it are never skipped by `ResultCache`
+        bool matches_snapshot(std::string_view name, std::string_view bytes, const std::source_location location = std::source_location::current()) {
+            const auto result = snapshot(name, bytes);
+            if (result.matched) [[likely]] {
+                return true;
+            }
+            return snapshotFailed(location, result.description);
+        }
+
+        bool matches_snapshot(std::string_view name, std::span<const std::byte> bytes, const std::source_location location = std::source_location::current()) {
+            return matches_snapshot(name, std::string_view(reinterpret_cast<const char*>(bytes.data()), bytes.size()), location);
+        }
+#else
+        bool check(bool condition) {
+            if (condition) [[likely]] {
+                return true;
+            }
+            return checkFailed();
+        }
+
+        bool fail() {
+            return checkFailed();
+        }
+
+        template<std::ranges::sized_range First, std::ranges::sized_range Second>
+        bool equals_range(const First& first, const Second& second) {
+            if (std::ranges::size(first) == std::ranges::size(second) && countMismatches(first, second) == 0) [[likely]] {
+                return true;
+            }
+            return rangesFailed(first, second);
+        }
+
+        template<std::ranges::sized_range Range, typename Predicate>
+        bool all_of(const Range& range, Predicate&& predicate) {
+            if (countRejected(range, predicate) == 0) [[likely]] {
+                return true;
+            }
+            return allOfFailed(range, predicate);
+        }
+
+        template<std::ranges::contiguous_range First, std::ranges::contiguous_range Second, typename Float>
+        requires detail::FloatRanges<First, Second, Float>
+        bool float_equals_span(const First& xs, const Second& ys, Float error) {
+            return compareSpans<Float>(xs, ys, detail::AbsoluteCompare<Float>{error});
+        }
+
+        template<std::ranges::contiguous_range First, std::ranges::contiguous_range Second, typename Float = detail::range_float_t<First>>
+        requires detail::FloatRanges<First, Second, Float>
+        bool float_equals_span(const First& xs, const Second& ys, Ulps ulps) {
+            return compareSpans<Float>(xs, ys, detail::UlpsCompare<Float>{ulps.count});
+        }
+
+        template<std::ranges::contiguous_range First, std::ranges::contiguous_range Second, typename Float = detail::range_float_t<First>>
+        requires detail::FloatRanges<First, Second, Float>
+        bool float_equals_span(const First& xs, const Second& ys, Relative relative) {
+            return compareSpans<Float>(xs, ys, detail::RelativeCompare<Float>{Float(relative.ratio)});
+        }
+
+        bool equals(auto&& first, auto&& second) {
+            return check(first == second);
+        }
+
+        template<typename Float>
+        requires std::floating_point<Float>
+        bool float_equals(Float x, Float y, Float error) {
+            return compareFloats(x, y, detail::AbsoluteCompare<Float>{error});
+        }
+
+        template<typename Float>
+        requires std::floating_point<Float>
+        bool float_equals_ulps(Float x, Float y, uint64_t ulps) {
+            return compareFloats(x, y, detail::UlpsCompare<Float>{ulps});
+        }
+
+        template<typename Float>
+        requires std::floating_point<Float>
+        bool float_equals_rel(Float x, Float y, Float ratio) {
+            return compareFloats(x, y, detail::RelativeCompare<Float>{ratio});
+        }
+
+        template<typename Body>
+        bool max_allocations(size_t count, Body&& body) {
+            AllocationScope scope;
+            body();
+            const AllocationStats stats = scope.stop();
+            if (stats.valid && stats.allocations <= count) [[likely]] {
+                return true;
+            }
+            return allocationsFailed(stats, count);
+        }
+
+        template<typename Body>
+        bool no_allocations(Body&& body) {
+            return max_allocations(0, std::forward<Body>(body));
+        }
+
+        template<typename Body>
+        bool max_peak_bytes(int64_t bytes, Body&& body) {
+            AllocationScope scope;
+            body();
+            const AllocationStats stats = scope.stop();
+            if (stats.valid && stats.peak_bytes <= bytes) [[likely]] {
+                return true;
+            }
+            return memoryFailed([&](std::ostream& stream) { describePeakBytes(stream, stats, bytes); });
+        }
+
+        template<typename Body>
+        bool no_leaks(Body&& body) {
+            AllocationScope scope;
+            body();
+            const AllocationStats stats = scope.stop();
+            if (stats.valid && stats.live_bytes <= 0) [[likely]] {
+                return true;
+            }
+            return memoryFailed([&](std::ostream& stream) { describeLeak(stream, stats); });
+        }
+
+        template<typename Body>
+        bool max_peak_rss(int64_t bytes, Body&& body) {
+            detail::RssSampler sampler;
+            body();
+            const RssStats stats = sampler.stop();
+            if (stats.valid && stats.peak_bytes - stats.start_bytes <= bytes) [[likely]] {
+                return true;
+            }
+            return memoryFailed([&](std::ostream& stream) { describeRss(stream, stats, bytes); });
+        }
+
+#if TINY_TEST__HAS_FORK
+        template<typename Body>
+        bool expect_death(Body&& body, int signal) {
+            const auto result = detail::run_forked(&detail::call_body<Body>, &body, stopToken());
+            const std::string mismatch = detail::death_mismatch(result, signal, {});
+            if (mismatch.empty()) [[likely]] {
+                return true;
+            }
+            return deathFailed(mismatch, result.output);
+        }
+
+        template<typename Body>
+        bool expect_death(Body&& body, std::string_view pattern) {
+            const auto result = detail::run_forked(&detail::call_body<Body>, &body, stopToken());
+            const std::string mismatch = detail::death_mismatch(result, 0, pattern);
+            if (mismatch.empty()) [[likely]] {
+                return true;
+            }
+            return deathFailed(mismatch, result.output);
+        }
+#endif
+
+        bool matches_snapshot(std::string_view name, std::string_view bytes) {
+            const auto result = snapshot(name, bytes);
+            if (result.matched) [[likely]] {
+                return true;
+            }
+            return snapshotFailed(result.description);
+        }
+
+        bool matches_snapshot(std::string_view name, std::span<const std::byte> bytes) {
+            return matches_snapshot(name, std::string_view(reinterpret_cast<const char*>(bytes.data()), bytes.size()));
+        }
+#endif
+
+        // Failures after this call are described under "case <index>:",
+        // used by parameterized tests
+        void begin_case(size_t index) {
+            case_ = index;
+            case_failed_ = false;
+        }
+
+        // Number of cases with at least one failure
+        size_t failed_cases() const {
+            return failed_cases_;
+        }
+
+        std::string_view pendingOutput() const override {
+            return failures_;
+        }
+
+    protected:
+        // Called before the test body
+        void startChecks() {
+            passed_ = true;
+            failure_count_ = 0;
+            failed_cases_ = 0;
+            case_ = no_case;
+            failures_.clear();
+        }
+
+        // Called after the test body, writes described failures to `out()`.
+        // Returns true if all checks passed
+        bool finishChecks() {
+            if (failure_count_ != 0) {
+                reportFailures();
+            }
+            return passed_;
+        }
+
+        // Called if the test body throws, so that failures before
+        // the exception are not lost
+        TINY_TEST__COLD void abortChecks() {
+            if (case_ != no_case && !case_failed_) {
+                failure();
+            }
+            finishChecks();
+        }
+
+    private:
+        static constexpr size_t no_case = std::numeric_limits<size_t>::max();
+
+        // Marks the test failed, returns stream for the failure description
+        // or null if enough failures are described already
+        std::ostream* failure() {
+            passed_ = false;
+            const bool new_case = case_ != no_case && !case_failed_;
+            if (new_case) {
+                case_failed_ = true;
+                ++failed_cases_;
+            }
+            if (++failure_count_ > max_described_failures) {
+                return nullptr;
+            }
+            if (new_case) {
+                failures_out_ << "case " << case_ << ":\n";
+            }
+            return &failures_out_;
+        }
+
+#ifndef TINY_TEST__NO_SOURCE_LOCATION
+        std::ostream* failure(const std::source_location& location) {
+            auto* stream = failure();
+            if (stream != nullptr) {
+                *stream << "condition at " << location.file_name()
+                    << ", line " << location.line()
+                    << ':' << location.column()
+                    << " evaluated to false\n";
+            }
+            return stream;
+        }
+
+        TINY_TEST__COLD bool checkFailed(const std::source_location& location) {
+            detail::AllocationPause pause;
+            failure(location);
+            return false;
+        }
+
+        TINY_TEST__COLD bool equalsFailed(const std::source_location& location, detail::ValueRef first, detail::ValueRef second) {
+            detail::AllocationPause pause;
+            if (auto* stream = failure(location)) {
+                *stream << first << " != " << second << '\n';
+            }
+            return false;
+        }
+
+        template<typename Float, typename Compare>
+        bool compareFloats(Float x, Float y, const Compare& compare, const std::source_location& location) {
+            if (compare(x, y)) [[likely]] {
+                return true;
+            }
+            return floatsFailed(location, x, y, compare);
+        }
+
+        template<typename Float, typename Compare>
+        bool compareSpans(std::span<const Float> x, std::span<const Float> y, const Compare& compare, const std::source_location& location) {
+            if (x.size() == y.size() && countFloatMismatches(x, y, compare) == 0) [[likely]] {
+                return true;
+            }
+            return floatSpansFailed(location, x, y, compare);
+        }
+
+        template<typename Float, typename Compare>
+        TINY_TEST__COLD bool floatsFailed(const std::source_location& location, Float x, Float y, const Compare& compare) {
+            detail::AllocationPause pause;
+            if (auto* stream = failure(location)) {
+                describeFloats(*stream, x, y, compare);
+            }
+            return false;
+        }
+
+        TINY_TEST__COLD bool allocationsFailed(const std::source_location& location, const AllocationStats& stats, size_t count) {
+            detail::AllocationPause pause;
+            if (auto* stream = failure(location)) {
+                describeAllocations(*stream, stats, count);
+            }
+            return false;
+        }
+
+        template<typename Describe>
+        TINY_TEST__COLD bool memoryFailed(const std::source_location& location, Describe&& describe) {
+            detail::AllocationPause pause;
+            if (auto* stream = failure(location)) {
+                describe(*stream);
+            }
+            return false;
+        }
+
+        TINY_TEST__COLD bool deathFailed(const std::source_location& location, std::string_view mismatch, std::string_view output) {
+            detail::AllocationPause pause;
+            if (auto* stream = failure(location)) {
+                describeDeath(*stream, mismatch, output);
+            }
+            return false;
+        }
+
+        TINY_TEST__COLD bool snapshotFailed(const std::source_location& location, std::string_view description) {
+            detail::AllocationPause pause;
+            if (auto* stream = failure(location)) {
+                *stream << description;
+            }
+            return false;
+        }
+
+        template<typename First, typename Second>
+        TINY_TEST__COLD bool rangesFailed(const std::source_location& location, const First& first, const Second& second) {
+            detail::AllocationPause pause;
+            if (auto* stream = failure(location)) {
+                describeRanges(*stream, first, second);
+            }
+            return false;
+        }
+
+        template<typename Range, typename Predicate>
+        TINY_TEST__COLD bool allOfFailed(const std::source_location& location, const Range& range, Predicate& predicate) {
+            detail::AllocationPause pause;
+            if (auto* stream = failure(location)) {
+                describeRejected(*stream, range, predicate);
+            }
+            return false;
+        }
+
+        template<typename Float, typename Compare>
+        TINY_TEST__COLD bool floatSpansFailed(const std::source_location& location, std::span<const Float> x, std::span<const Float> y, const Compare& compare) {
+            detail::AllocationPause pause;
+            if (auto* stream = failure(location)) {
+                describeFloatSpans(*stream, x, y, compare);
+            }
+            return false;
+        }
+#else
+        TINY_TEST__COLD bool checkFailed() {
+            detail::AllocationPause pause;
+            failure();
+            return false;
+        }
+
+        template<typename Float, typename Compare>
+        bool compareFloats(Float x, Float y, const Compare& compare) {
+            if (compare(x, y)) [[likely]] {
+                return true;
+            }
+            return floatsFailed(x, y, compare);
+        }
+
+        template<typename Float, typename Compare>
+        bool compareSpans(std::span<const Float> x, std::span<const Float> y, const Compare& compare) {
+            if (x.size() == y.size() && countFloatMismatches(x, y, compare) == 0) [[likely]] {
+                return true;
+            }
+            return floatSpansFailed(x, y, compare);
+        }
+
+        template<typename Float, typename Compare>
+        TINY_TEST__COLD bool floatsFailed(Float x, Float y, const Compare& compare) {
+            detail::AllocationPause pause;
+            if (auto* stream = failure()) {
+                describeFloats(*stream, x, y, compare);
+            }
+            return false;
+        }
+
+        TINY_TEST__COLD bool allocationsFailed(const AllocationStats& stats, size_t count) {
+            detail::AllocationPause pause;
+            if (auto* stream = failure()) {
+                describeAllocations(*stream, stats, count);
+            }
+            return false;
+        }
+
+        template<typename Describe>
+        TINY_TEST__COLD bool memoryFailed(Describe&& describe) {
+            detail::AllocationPause pause;
+            if (auto* stream = failure()) {
+                describe(*stream);
+            }
+            return false;
+        }
+
+        TINY_TEST__COLD bool deathFailed(std::string_view mismatch, std::string_view output) {
+            detail::AllocationPause pause;
+            if (auto* stream = failure()) {
+                describeDeath(*stream, mismatch, output);
+            }
+            return false;
+        }
+
+        TINY_TEST__COLD bool snapshotFailed(std::string_view description) {
+            detail::AllocationPause pause;
+            if (auto* stream = failure()) {
+                *stream << description;
+            }
+            return false;
+        }
+
+        template<typename First, typename Second>
+        TINY_TEST__COLD bool rangesFailed(const First& first, const Second& second) {
+            detail::AllocationPause pause;
+            if (auto* stream = failure()) {
+                describeRanges(*stream, first, second);
+            }
+            return false;
+        }
+
+        template<typename Range, typename Predicate>
+        TINY_TEST__COLD bool allOfFailed(const Range& range, Predicate& predicate) {
+            detail::AllocationPause pause;
+            if (auto* stream = failure()) {
+                describeRejected(*stream, range, predicate);
+            }
+            return false;
+        }
+
+        template<typename Float, typename Compare>
+        TINY_TEST__COLD bool floatSpansFailed(std::span<const Float> x, std::span<const Float> y, const Compare& compare) {
+            detail::AllocationPause pause;
+            if (auto* stream = failure()) {
+                describeFloatSpans(*stream, x, y, compare);
+            }
+            return false;
+        }
+#endif
+
+        // Counting kernels have no early exit and no branches in the loop body,
+        // so that compilers can vectorize them. Failures are described in a second pass
+
+        template<typename First, typename Second>
+        static size_t countMismatches(const First& first, const Second& second) {
+            size_t mismatches = 0;
+            if constexpr (std::ranges::random_access_range<const First> && std::ranges::random_access_range<const Second>) {
+                const auto a = std::ranges::begin(first);
+                const auto b = std::ranges::begin(second);
+                const auto size = std::ranges::distance(first);
+                for (std::ranges::range_difference_t<const First> i = 0; i < size; ++i) {
+                    mismatches += !(a[i] == b[i]);
+                }
+            } else {
+                auto b = std::ranges::begin(second);
+                for (const auto& a : first) {
+                    mismatches += !(a == *b);
+                    ++b;
+                }
+            }
+            return mismatches;
+        }
+
+        template<typename Range, typename Predicate>
+        static size_t countRejected(const Range& range, Predicate& predicate) {
+            size_t rejected = 0;
+            for (const auto& value : range) {
+                rejected += !bool(predicate(value));
+            }
+            return rejected;
+        }
+
+        template<typename Float, typename Compare>
+        static size_t countFloatMismatches(std::span<const Float> x, std::span<const Float> y, const Compare& compare) {
+            size_t mismatches = 0;
+            for (size_t i = 0; i < x.size(); ++i) {
+                mismatches += !compare(x[i], y[i]);
+            }
+            return mismatches;
+        }
+
+        // Bulk failures describe at most this many elements
+        static constexpr size_t max_described_elements = 8;
+
+        template<typename Value>
+        static void describeElement(std::ostream& stream, const Value& value) {
+            if constexpr (Printable<Value>) {
+                stream << value;
+            } else {
+                stream << '?';
+            }
+        }
+
+        template<typename First, typename Second>
+        static void describeRanges(std::ostream& stream, const First& first, const Second& second) {
+            const size_t first_size = std::ranges::size(first);
+            const size_t second_size = std::ranges::size(second);
+            if (first_size != second_size) {
+                stream << "ranges have different sizes: " << first_size << " != " << second_size << '\n';
+                return;
+            }
+            stream << countMismatches(first, second) << " of " << first_size << " elements differ:";
+            size_t index = 0, described = 0;
+            auto b = std::ranges::begin(second);
+            for (const auto& a : first) {
+                if (!(a == *b) && described++ < max_described_elements) {
+                    stream << "\n  [" << index << "] ";
+                    describeElement(stream, a);
+                    stream << " != ";
+                    describeElement(stream, *b);
+                }
+                ++b;
+                ++index;
+            }
+            stream << (described > max_described_elements ? "\n  ...\n" : "\n");
+        }
+
+        template<typename Range, typename Predicate>
+        static void describeRejected(std::ostream& stream, const Range& range, Predicate& predicate) {
+            stream << countRejected(range, predicate) << " of " << std::ranges::size(range) << " elements do not satisfy the predicate:";
+            size_t index = 0, described = 0;
+            for (const auto& value : range) {
+                if (!bool(predicate(value)) && described++ < max_described_elements) {
+                    stream << "\n  [" << index << "] ";
+                    describeElement(stream, value);
+                }
+                ++index;
+            }
+            stream << (described > max_described_elements ? "\n  ...\n" : "\n");
+        }
+
+        template<typename Float, typename Compare>
+        static void describeFloatSpans(std::ostream& stream, std::span<const Float> x, std::span<const Float> y, const Compare& compare) {
+            if (x.size() != y.size()) {
+                stream << "spans have different sizes: " << x.size() << " != " << y.size() << '\n';
+                return;
+            }
+            size_t described = 0, max_absolute_index = 0, max_relative_index = 0;
+            double max_absolute = 0, max_relative = 0;
+            std::ostringstream indices;
+            for (size_t i = 0; i < x.size(); ++i) {
+                if (compare(x[i], y[i])) {
+                    continue;
+                }
+                const double absolute = std::abs(double(x[i]) - double(y[i]));
+                const double scale = std::max(std::abs(double(x[i])), std::abs(double(y[i])));
+                const double relative = scale != 0 ? absolute / scale : 0;
+                // NaN compares false, keep the first one as the worst
+                if (!(absolute <= max_absolute) && !std::isnan(max_absolute)) {
+                    max_absolute = absolute;
+                    max_absolute_index = i;
+                }
+                if (!(relative <= max_relative) && !std::isnan(max_relative)) {
+                    max_relative = relative;
+                    max_relative_index = i;
+                }
+                if (described++ < max_described_elements) {
+                    indices << (described == 1 ? "" : ", ") << i;
+                }
+            }
+            const auto precision = stream.precision(4);
+            const auto value = std::setprecision(Compare::precision);
+            const auto error = std::setprecision(4);
+            stream << described << " of " << x.size() << " elements differ ";
+            compare.describe(stream);
+            stream << ", first at " << indices.str() << (described > max_described_elements ? ", ...\n" : "\n")
+                << "  max absolute error " << max_absolute << " at [" << max_absolute_index << "]: "
+                << value << x[max_absolute_index] << " != " << y[max_absolute_index] << error << '\n'
+                << "  max relative error " << max_relative << " at [" << max_relative_index << "]: "
+                << value << x[max_relative_index] << " != " << y[max_relative_index] << error << '\n';
+            stream.precision(precision);
+        }
+
+        template<typename Float, typename Compare>
+        static void describeFloats(std::ostream& stream, Float x, Float y, const Compare& compare) {
+            const auto precision = stream.precision(Compare::precision);
+            stream << x << " != " << y << ' ' << std::setprecision(4);
+            compare.describe(stream, x, y);
+            stream << '\n';
+            stream.precision(precision);
+        }
+
+        static void describeAllocations(std::ostream& stream, const AllocationStats& stats, size_t count) {
+            if (!stats.valid) {
+                stream << "allocation tracking is disabled, define TINY_TEST__TRACK_ALLOCATIONS in one source file\n";
+                return;
+            }
+            stream << stats.allocations << " allocations (" << stats.bytes
+                << " bytes) made, expected at most " << count << '\n';
+        }
+
+        static void describePeakBytes(std::ostream& stream, const AllocationStats& stats, int64_t bytes) {
+            if (!stats.valid) {
+                describeAllocations(stream, stats, 0);
+                return;
+            }
+            stream << "peak heap usage " << stats.peak_bytes << " bytes, expected at most " << bytes << '\n';
+        }
+
+        static void describeLeak(std::ostream& stream, const AllocationStats& stats) {
+            if (!stats.valid) {
+                describeAllocations(stream, stats, 0);
+                return;
+            }
+            stream << stats.live_bytes << " bytes leaked, " << stats.allocations << " allocations and "
+                << stats.deallocations << " deallocations made\n";
+        }
+
+        static void describeRss(std::ostream& stream, const RssStats& stats, int64_t bytes) {
+            if (!stats.valid) {
+                stream << "RSS can't be measured on this platform\n";
+                return;
+            }
+            stream << "peak RSS grew by " << stats.peak_bytes - stats.start_bytes << " bytes (from "
+                << detail::format_bytes(stats.start_bytes) << " to " << detail::format_bytes(stats.peak_bytes)
+                << "), expected at most " << bytes << '\n';
+        }
+
+        // Compares with or updates the snapshot as the run options say
+        detail::SnapshotResult snapshot(std::string_view name, std::string_view bytes) {
+            // the snapshot can change without the test's inputs changing
+            markUncacheable();
+            const RunOptions* run = options();
+            auto result = detail::check_snapshot(run != nullptr ? run->snapshots : RunOptions().snapshots, name, bytes,
+                run != nullptr && run->update_snapshots);
+            if (result.updated) {
+                detail::AllocationPause pause;
+                out() << "updated snapshot " << name << '\n';
+            }
+            return result;
+        }
+
+        // Mismatch followed by the end of stderr of the process
+        static void describeDeath(std::ostream& stream, std::string_view mismatch, std::string_view output) {
+            constexpr size_t max_described_output = 1024;
+            stream << mismatch << '\n';
+            if (output.empty()) {
+                return;
+            }
+            stream << "stderr" << (output.size() > max_described_output ? " (end of it):\n" : ":\n");
+            output = output.substr(output.size() - std::min(output.size(), max_described_output));
+            stream << output << (output.ends_with('\n') ? "" : "\n");
+        }
+
+        TINY_TEST__COLD void reportFailures() {
+            detail::AllocationPause pause;
+            out() << failures_;
+            if (failure_count_ > max_described_failures) {
+                out() << "... and " << failure_count_ - max_described_failures << " more failed checks\n";
+            }
+            failures_.clear();
+        }
+
+        bool passed_ = true;
+        size_t failure_count_ = 0;
+        size_t case_ = no_case;
+        bool case_failed_ = false;
+        size_t failed_cases_ = 0;
+        std::string failures_;
+        detail::StringAppendBuffer failures_buffer_;
+        std::ostream failures_out_{&failures_buffer_};
+    };
+
+    // Main test class, provides lots of helper methods and automatic output
+    // Functor is called with PrettyTest instance as an argument
+    template<typename Functor>
+    class PrettyTest: public Checker {
+    public:
+        PrettyTest(const PrettyTest&) = delete;
+        PrettyTest(PrettyTest&&) = delete;
+
+        PrettyTest(std::string name, Functor f)
+        : Checker(std::move(name))
+        , f_(std::move(f)) {}
+
+        bool doTest() override {
+            startChecks();
+            try {
+                f_(*this);
+            } catch (...) {
+                abortChecks();
+                throw;
+            }
+            return finishChecks();
+        }
+
+    private:
+        Functor f_;
+    };
+
+    // Helper function for unique_ptr creation of SimpleTest and PrettyTest
+    template<template<typename> typename ActualTest, typename Functor>
+    std::unique_ptr<ActualTest<Functor>> make_test(
+            std::string name,
+            Functor f) {
+        return std::make_unique<ActualTest<Functor>>(std::move(name), std::move(f));
+    }
+
+    // PrettyTest with a function pointer instead of a functor. All light tests share
+    // one class and one vtable, so thousands of them cost much less code and compile
+    // time than templates instantiated for every lambda. Captureless lambdas convert
+    // to the body, data the test needs can be passed as an untyped `context`
+    class LightTest final : public Checker {
+    public:
+        using Body = void (*)(LightTest& test);
+        using BodyWithContext = void (*)(LightTest& test, const void* context);
+
+        LightTest(std::string name, Body body)
+        : Checker(std::move(name))
+        , body_(body) {}
+
+        LightTest(std::string name, BodyWithContext body, const void* context)
+        : Checker(std::move(name))
+        , body_with_context_(body)
+        , context_(context) {}
+
+        bool doTest() override {
+            startChecks();
+            try {
+                if (body_ != nullptr) {
+                    body_(*this);
+                } else {
+                    body_with_context_(*this, context_);
+                }
+            } catch (...) {
+                abortChecks();
+                throw;
+            }
+            return finishChecks();
+        }
+
+    private:
+        Body body_ = nullptr;
+        BodyWithContext body_with_context_ = nullptr;
+        const void* context_ = nullptr;
+    };
+
+    inline std::unique_ptr<LightTest> make_light_test(std::string name, LightTest::Body body) {
+        return std::make_unique<LightTest>(std::move(name), body);
+    }
+
+    // `context` is not owned, it must outlive the test
+    inline std::unique_ptr<LightTest> make_light_test(std::string name, LightTest::BodyWithContext body, const void* context) {
+        return std::make_unique<LightTest>(std::move(name), body, context);
+    }
+
+    namespace detail {
+        // One-sided Mann-Whitney U test with normal approximation and tie correction.
+        // Returns p-value for "values in `current` are not greater than in `baseline`",
+        // small values mean `current` is significantly greater
+        inline double mann_whitney_greater(const std::vector<double>& baseline, const std::vector<double>& current) {
+            const double n1 = double(current.size());
+            const double n2 = double(baseline.size());
+            if (current.empty() || baseline.empty()) {
+                return 1.0;
+            }
+            std::vector<std::pair<double, bool>> values;
+            values.reserve(current.size() + baseline.size());
+            for (double value : current) {
+                values.emplace_back(value, true);
+            }
+            for (double value : baseline) {
+                values.emplace_back(value, false);
+            }
+            std::sort(values.begin(), values.end());
+
+            double current_ranks = 0;
+            double ties = 0;
+            for (size_t begin = 0; begin < values.size();) {
+                size_t end = begin;
+                while (end < values.size() && values[end].first == values[begin].first) {
+                    ++end;
+                }
+                const double rank = double(begin + end + 1) / 2;
+                for (size_t i = begin; i < end; ++i) {
+                    if (values[i].second) {
+                        current_ranks += rank;
+                    }
+                }
+                const double t = double(end - begin);
+                ties += t * t * t - t;
+                begin = end;
+            }
+
+            const double n = n1 + n2;
+            const double u = current_ranks - n1 * (n1 + 1) / 2;
+            const double mean = n1 * n2 / 2;
+            const double variance = n1 * n2 / 12 * ((n + 1) - ties / (n * (n - 1)));
+            if (variance <= 0) {
+                return 1.0;
+            }
+            const double z = (u - mean - 0.5) / std::sqrt(variance);
+            return 0.5 * std::erfc(z / std::sqrt(2.0));
+        }
+
+        inline double median(std::vector<double> values) {
+            if (values.empty()) {
+                return 0;
+            }
+            const size_t middle = values.size() / 2;
+            std::nth_element(values.begin(), values.begin() + long(middle), values.end());
+            if (values.size() % 2 == 1) {
+                return values[middle];
+            }
+            return (values[middle] + *std::max_element(values.begin(), values.begin() + long(middle))) / 2;
+        }
+    }
+
+    // Timing distributions of timed tests, stored in a file between runs.
+    // In `Save` mode timed tests record their samples, in `Compare` mode
+    // they fail on a statistically significant slowdown against the stored samples
+    class Baseline {
+    public:
+        enum class Mode {
+            Compare,
+            Save
+        };
+
+        // Result of comparison of new samples against the stored ones
+        struct Verdict {
+            bool found = false;
+            bool slower = false;
+            double baseline_median = 0;
+            double current_median = 0;
+            double p_value = 1;
+        };
+
+        Baseline(const Baseline&) = delete;
+
+        explicit Baseline(std::string path, Mode mode = Mode::Compare)
+        : path_(std::move(path))
+        , mode_(mode) {
+            load();
+        }
+
+        Mode mode() const {
+            return mode_;
+        }
+
+        // Number of times every timed test is run to collect its distribution
+        size_t samples = 15;
+        // Slowdown of the median smaller than this fraction is never reported
+        double threshold = 0.1;
+        // Significance level of the Mann-Whitney test
+        double alpha = 0.01;
+
+        // Samples are in nanoseconds
+        void record(const std::string& key, std::vector<double> samples) {
+            std::lock_guard lock(mutex_);
+            samples_[key] = std::move(samples);
+        }
+
+        Verdict compare(const std::string& key, const std::vector<double>& current) const {
+            Verdict verdict;
+            auto it = samples_.find(key);
+            if (it == samples_.end() || it->second.empty()) {
+                return verdict;
+            }
+            verdict.found = true;
+            verdict.baseline_median = detail::median(it->second);
+            verdict.current_median = detail::median(current);
+            verdict.p_value = detail::mann_whitney_greater(it->second, current);
+            verdict.slower = verdict.p_value < alpha
+                && verdict.current_median > verdict.baseline_median * (1 + threshold);
+            return verdict;
+        }
+
+        // Reads stored samples, missing file is treated as empty baseline
+        bool load() {
+            std::ifstream file(path_);
+            if (!file) {
+                return false;
+            }
+            // line format: <count> <sample ns>... <key>
+            size_t count = 0;
+            while (file >> count) {
+                std::vector<double> samples(count);
+                for (auto& sample : samples) {
+                    file >> sample;
+                }
+                file.get();
+                std::string key;
+                std::getline(file, key);
+                if (!file) {
+                    return false;
+                }
+                samples_[std::move(key)] = std::move(samples);
+            }
+            return true;
+        }
+
+        // Writes all samples (including ones loaded from file) back
+        bool save() const {
+            std::lock_guard lock(mutex_);
+            std::ofstream file(path_, std::ios::trunc);
+            for (const auto& [key, samples] : samples_) {
+                file << samples.size();
+                for (double sample : samples) {
+                    file << ' ' << std::llround(sample);
+                }
+                file << ' ' << key << '\n';
+            }
+            return bool(file);
+        }
+
+    private:
+        std::string path_;
+        Mode mode_;
+        mutable std::mutex mutex_;
+        std::map<std::string, std::vector<double>, std::less<>> samples_;
+    };
+
+
+#if TINY_TEST__HAS_BACKTRACE
+    namespace detail {
+        // Demangled function names of return addresses, raw backtrace_symbols() lines
+        // for addresses without symbols
+        inline std::vector<std::string> symbolize(void* const* frames, int count) {
+            std::vector<std::string> names;
+            char** symbols = count > 0 ? ::backtrace_symbols(frames, count) : nullptr;
+            for (int i = 0; symbols != nullptr && i < count; ++i) {
+                std::string_view symbol = symbols[i];
+#if __has_include(<cxxabi.h>)
+                // "binary(mangled+0x1f) [0x...]"
+                const size_t open = symbol.find('(');
+                const size_t plus = symbol.find('+', open);
+                if (open != std::string_view::npos && plus != std::string_view::npos && plus > open + 1) {
+                    int status = -1;
+                    const std::string mangled(symbol.substr(open + 1, plus - open - 1));
+                    char* demangled = abi::__cxa_demangle(mangled.c_str(), nullptr, nullptr, &status);
+                    if (status == 0 && demangled != nullptr) {
+                        names.emplace_back(demangled);
+                        std::free(demangled);
+                        continue;
+                    }
+                    std::free(demangled);
+                }
+#endif
+                names.emplace_back(symbol);
+            }
+            std::free(symbols);
+            return names;
+        }
+    }
+#endif
+
+#if TINY_TEST__HAS_PROFILER
+    namespace detail {
+        // Samples the calling thread's stack every `interval` of its CPU time with SIGPROF
+        // from a per-thread POSIX timer. Samples go to a buffer allocated up front, so the
+        // handler neither allocates nor locks. Only one profiler may run on a thread at a time
+        class SamplingProfiler {
+        public:
+            static constexpr size_t max_samples = 4096;
+            static constexpr int max_depth = 48;
+
+            explicit SamplingProfiler(std::chrono::microseconds interval = 1000us)
+            : interval_(interval)
+            , frames_(max_samples * size_t(max_depth))
+            , depths_(max_samples)
+            , base_(size_t(max_depth)) {
+                install();
+            }
+
+            SamplingProfiler(const SamplingProfiler&) = delete;
+
+            ~SamplingProfiler() {
+                stop();
+            }
+
+            bool start() {
+                // frames of the callers, they are cut from the samples
+                base_depth_ = ::backtrace(base_.data(), max_depth);
+                active() = this;
+                sigevent event = {};
+                event.sigev_notify = SIGEV_THREAD_ID;
+                event.sigev_signo = SIGPROF;
+                event.sigev_notify_thread_id = pid_t(::syscall(SYS_gettid));
+                if (::timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &timer_) != 0) {
+                    active() = nullptr;
+                    return false;
+                }
+                const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(interval_);
+                itimerspec period = {};
+                period.it_interval.tv_sec = time_t(seconds.count());
+                period.it_interval.tv_nsec = long(std::chrono::nanoseconds(interval_ - seconds).count());
+                period.it_value = period.it_interval;
+                running_ = ::timer_settime(timer_, 0, &period, nullptr) == 0;
+                if (!running_) {
+                    ::timer_delete(timer_);
+                    active() = nullptr;
+                }
+                return running_;
+            }
+
+            void stop() {
+                if (!running_) {
+                    return;
+                }
+                ::timer_delete(timer_);
+                running_ = false;
+                active() = nullptr;
+            }
+
+            size_t samples() const {
+                return std::min(count_.load(std::memory_order_relaxed), max_samples);
+            }
+
+            // One line per distinct stack: "outer;...;inner count", as consumed by flamegraph.pl
+            std::string folded() const {
+                // the handler and the signal trampoline come first
+                constexpr int skipped = 2;
+                std::map<void*, std::string> names;
+                std::map<std::string, size_t> stacks;
+                std::vector<void*> unknown;
+                std::vector<int> ends(samples());
+                for (size_t sample = 0; sample < samples(); ++sample) {
+                    int& end = ends[sample];
+                    end = depths_[sample];
+                    const void* const* frames = &frames_[sample * max_depth];
+                    for (int base = base_depth_ - 1; end > skipped && base >= 0 && frames[end - 1] == base_[size_t(base)]; --base) {
+                        --end;
+                    }
+                    for (int i = skipped; i < end; ++i) {
+                        void* frame = frames_[sample * max_depth + size_t(i)];
+                        if (names.try_emplace(frame).second) {
+                            unknown.push_back(frame);
+                        }
+                    }
+                }
+                const auto symbols = symbolize(unknown.data(), int(unknown.size()));
+                for (size_t i = 0; i < symbols.size(); ++i) {
+                    auto& name = names[unknown[i]];
+                    name = symbols[i];
+                    // raw "path/module(function+0x1f) [0x...]" becomes "function" or, without
+                    // a symbol, "module", so that samples at different addresses are merged
+                    const size_t open = name.find('(');
+                    if (open != std::string::npos && name.find(" [0x", open) != std::string::npos) {
+                        const size_t plus = name.find('+', open);
+                        if (plus != std::string::npos && plus > open + 1) {
+                            name = name.substr(open + 1, plus - open - 1);
+                        } else {
+                            const size_t slash = name.rfind('/', open);
+                            name = name.substr(slash == std::string::npos ? 0 : slash + 1, open - (slash == std::string::npos ? 0 : slash + 1));
+                        }
+                    }
+                    // ';' separates frames and a space separates the count
+                    std::replace(name.begin(), name.end(), ';', ',');
+                }
+                for (size_t sample = 0; sample < samples(); ++sample) {
+                    std::string stack;
+                    for (int i = ends[sample] - 1; i >= skipped; --i) {
+                        if (!stack.empty()) {
+                            stack += ';';
+                        }
+                        stack += names[frames_[sample * max_depth + size_t(i)]];
+                    }
+                    ++stacks[stack];
+                }
+                std::string text;
+                for (const auto& [stack, count] : stacks) {
+                    text += stack;
+                    text += ' ';
+                    text += std::to_string(count);
+                    text += '\n';
+                }
+                return text;
+            }
+
+        private:
+            static SamplingProfiler*& active() {
+                static thread_local SamplingProfiler* profiler = nullptr;
+                return profiler;
+            }
+
+            static void handler(int) {
+                SamplingProfiler* const profiler = active();
+                if (profiler == nullptr) {
+                    return;
+                }
+                const size_t sample = profiler->count_.fetch_add(1, std::memory_order_relaxed);
+                if (sample >= max_samples) {
+                    return;
+                }
+                const int saved_errno = errno;
+                profiler->depths_[sample] = ::backtrace(&profiler->frames_[sample * max_depth], max_depth);
+                errno = saved_errno;
+            }
+
+            static void install() {
+                static const bool installed = [] {
+                    // the first call of backtrace() may allocate, it must not happen in the handler
+                    void* frame = nullptr;
+                    ::backtrace(&frame, 1);
+                    struct sigaction action = {};
+                    action.sa_handler = handler;
+                    action.sa_flags = SA_RESTART;
+                    sigemptyset(&action.sa_mask);
+                    return ::sigaction(SIGPROF, &action, nullptr) == 0;
+                }();
+                (void)installed;
+            }
+
+            std::chrono::microseconds interval_;
+            std::vector<void*> frames_;
+            std::vector<int> depths_;
+            std::vector<void*> base_;
+            int base_depth_ = 0;
+            std::atomic<size_t> count_ = 0;
+            timer_t timer_{};
+            bool running_ = false;
+        };
+    }
+#endif
+
+    // Wrapper around another test. Will time execution and check that it
+    // did not exceed a given time limit. If run with `RunOptions::baseline`,
+    // test is run several times and its timings are compared with the baseline
+    template<template<typename> typename ActualTest, typename Functor>
+    struct TimedTest : ActualTest<Functor> {
+        using Parent = ActualTest<Functor>;
+        using Parent::Parent;
+
+        template<typename... Args>
+        TimedTest(double milliseconds, Args&&... args)
+            : Parent(std::forward<Args>(args)...)
+            , max_runtime_(milliseconds) {}
+
+        bool timingSensitive() const override {
+            return true;
+        }
+
+        bool doTest() override {
+            Baseline* baseline = this->options() != nullptr ? this->options()->baseline : nullptr;
+            const size_t runs = baseline != nullptr ? std::max<size_t>(baseline->samples, 1) : 1;
+            std::vector<double> samples;
+            samples.reserve(runs);
+            bool result = true;
+#if TINY_TEST__HAS_PROFILER
+            // samples are stored in memory allocated here, outside of the measured region
+            std::optional<detail::SamplingProfiler> profiler;
+            if (this->options() != nullptr && !this->options()->profile.empty()) {
+                profiler.emplace();
+            }
+#endif
+            const bool count = this->countersEnabled();
+            detail::RssRegion rss;
+            const CounterValues counters_before = count ? PerfCounters::thread().read() : CounterValues{};
+            AllocationScope allocations;
+#if TINY_TEST__HAS_PROFILER
+            if (profiler && !profiler->start()) {
+                profiler.reset();
+            }
+#endif
+            for (size_t i = 0; i < runs && result; ++i) {
+                auto start = std::chrono::steady_clock::now();
+                result = Parent::doTest();
+                auto finish = std::chrono::steady_clock::now();
+                samples.push_back(std::chrono::duration<double, std::nano>(finish - start).count());
+            }
+#if TINY_TEST__HAS_PROFILER
+            if (profiler) {
+                profiler->stop();
+            }
+            auto write_profile = [&] {
+                if (profiler) {
+                    writeProfile(*profiler);
+                }
+            };
+#else
+            auto write_profile = [] {};
+#endif
+            const CounterValues counters = count ? PerfCounters::thread().read() - counters_before : CounterValues{};
+            const AllocationStats allocation_stats = allocations.stop();
+            const RssStats rss_stats = rss.stop();
+            const double execution_ns = detail::median(samples);
+            this->out() << "finished in " << detail::format_duration(execution_ns)
+                << detail::format_counters(counters, double(samples.size()))
+                << detail::format_allocations(allocation_stats, double(samples.size()))
+                << detail::format_rss(rss_stats) << '\n';
+            if (max_runtime_ < execution_ns * 1e-6) {
+                this->out() << "SLOWER than given limit: " << detail::format_duration(max_runtime_ * 1e6) << '\n';
+                write_profile();
+                return false;
+            }
+            if (baseline == nullptr || !result) {
+                return result;
+            }
+
+            if (baseline->mode() == Baseline::Mode::Save) {
+                baseline->record(this->key(), std::move(samples));
+                return result;
+            }
+            auto verdict = baseline->compare(this->key(), samples);
+            if (!verdict.found) {
+                this->out() << "no baseline recorded\n";
+                return result;
+            }
+            const double change = verdict.current_median / verdict.baseline_median - 1;
+            if (verdict.slower) {
+                this->out() << "SLOWER than baseline: ";
+            } else {
+                this->out() << "baseline: ";
+            }
+            this->out() << detail::format_duration(verdict.baseline_median) << ", change "
+                << std::showpos << std::setprecision(3) << change * 100 << std::noshowpos
+                << "%, p = " << std::setprecision(2) << verdict.p_value << '\n';
+            if (verdict.slower) {
+                write_profile();
+            }
+            return !verdict.slower;
+        }
+
+        std::chrono::nanoseconds timeLimit(const RunOptions& options) const override {
+            if (!std::isfinite(max_runtime_)) {
+                return Parent::timeLimit(options);
+            }
+            const size_t runs = options.baseline != nullptr ? std::max<size_t>(options.baseline->samples, 1) : 1;
+            return std::chrono::nanoseconds(int64_t(max_runtime_ * 1e6)) * int64_t(runs);
+        }
+
+    private:
+#if TINY_TEST__HAS_PROFILER
+        // Writes "<profile directory>/<group>_<name>.folded"
+        void writeProfile(const detail::SamplingProfiler& profiler) {
+            std::string file_name = this->key();
+            for (char& c : file_name) {
+                const bool plain = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '.';
+                if (!plain) {
+                    c = '_';
+                }
+            }
+            const std::filesystem::path path = std::filesystem::path(this->options()->profile) / (file_name + ".folded");
+            std::error_code error;
+            std::filesystem::create_directories(path.parent_path(), error);
+            std::ofstream file(path);
+            file << profiler.folded();
+            if (!file) {
+                this->out() << "failed to write profile to " << path.string() << '\n';
+                return;
+            }
+            this->out() << "profile: " << path.string() << ", " << profiler.samples() << " samples\n";
+        }
+#endif
+
+        double max_runtime_ = std::numeric_limits<double>::infinity();
+    };
+
+    // Helper function for unique_ptr creation of TimedTest from Simple and Pretty tests
+    template<template<typename> typename ActualTest, typename Functor>
+    auto make_timed_test(
+        std::string name,
+        Functor f
+    ) {
+        return std::make_unique<TimedTest<ActualTest, Functor>>(std::move(name), std::move(f));
+    }
+
+    template<template<typename> typename ActualTest, typename Functor>
+    auto make_timed_test(
+        std::chrono::microseconds time_limit,
+        std::string name,
+        Functor f
+    ) {
+        const double to_milliseconds = 1e-3;
+        return std::make_unique<TimedTest<ActualTest, Functor>>(
+                double(time_limit.count()) * to_milliseconds, std::move(name), std::move(f)
+        );
+    }
+
+    // Prevents compiler from optimizing away computation of `value`
+    template<typename T>
+    inline void do_not_optimize(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+        if constexpr (std::is_trivially_copyable_v<T> && sizeof(T) <= sizeof(void*)) {
+            asm volatile("" : : "r,m"(value) : "memory");
+        } else {
+            asm volatile("" : : "m"(value) : "memory");
+        }
+#else
+        static volatile const void* sink;
+        sink = &value;
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+    }
+
+    // Forces compiler to assume any memory may have been read or written
+    inline void clobber_memory() {
+#if defined(__GNUC__) || defined(__clang__)
+        asm volatile("" : : : "memory");
+#else
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+    }
+
+    // Per-iteration timings collected by `BenchmarkTest`, in nanoseconds
+    struct BenchmarkStats {
+        size_t iterations = 0;
+        size_t samples = 0;
+        double min = 0;
+        double median = 0;
+        double p99 = 0;
+        double mean = 0;
+        double stddev = 0;
+    };
+
+    // Settings of the benchmark loop
+    struct BenchmarkOptions {
+        // iterations run before measurement, results are discarded
+        size_t warmup_iterations = 10;
+        // number of measured batches, each gives one per-iteration sample
+        size_t samples = 50;
+        // approximate total measurement time, iterations per batch
+        // are scaled up until all batches take about this long
+        std::chrono::nanoseconds target_time = 200ms;
+    };
+
+    namespace detail {
+        // `samples` gets sorted
+        inline BenchmarkStats compute_stats(std::vector<double>& samples, size_t iterations) {
+            BenchmarkStats stats;
+            stats.iterations = iterations;
+            stats.samples = samples.size();
+            if (samples.empty()) {
+                return stats;
+            }
+            std::sort(samples.begin(), samples.end());
+            const size_t count = samples.size();
+            stats.min = samples.front();
+            stats.median = count % 2 == 1
+                ? samples[count / 2]
+                : (samples[count / 2 - 1] + samples[count / 2]) / 2;
+            stats.p99 = samples[std::min(count - 1, size_t(std::ceil(0.99 * double(count))) - 1)];
+            double sum = 0;
+            for (double sample : samples) {
+                sum += sample;
+            }
+            stats.mean = sum / double(count);
+            double squares = 0;
+            for (double sample : samples) {
+                squares += (sample - stats.mean) * (sample - stats.mean);
+            }
+            stats.stddev = count > 1 ? std::sqrt(squares / double(count - 1)) : 0;
+            return stats;
+        }
+
+        // Doubles iteration count until a single batch is long enough to measure.
+        // `run_batch(iterations)` returns time the batch took and clears `passed` on failure
+        template<typename RunBatch>
+        size_t calibrate_iterations(RunBatch&& run_batch, std::chrono::nanoseconds batch_time, const bool& passed) {
+            size_t iterations = 1;
+            while (passed && run_batch(iterations) < batch_time && iterations < (size_t(1) << 30)) {
+                iterations *= 2;
+            }
+            return iterations;
+        }
+    }
+
+    // Wrapper around another test. Runs it many times, measuring time per iteration
+    // with steady_clock, and fails if median exceeds the limit (if any).
+    // Use `do_not_optimize` and `clobber_memory` to keep measured code alive
+    template<template<typename> typename ActualTest, typename Functor>
+    struct BenchmarkTest : ActualTest<Functor> {
+        using Parent = ActualTest<Functor>;
+        using Parent::Parent;
+
+        template<typename... Args>
+        BenchmarkTest(BenchmarkOptions options, double max_median_ns, Args&&... args)
+            : Parent(std::forward<Args>(args)...)
+            , options_(options)
+            , max_median_ns_(max_median_ns) {}
+
+        bool timingSensitive() const override {
+            return true;
+        }
+
+        bool doTest() override {
+            using Clock = std::chrono::steady_clock;
+            for (size_t i = 0; i < options_.warmup_iterations; ++i) {
+                if (!Parent::doTest()) {
+                    return false;
+                }
+            }
+
+            const size_t sample_count = std::max<size_t>(options_.samples, 1);
+            const auto batch_time = options_.target_time / sample_count;
+            bool passed = true;
+            auto run_batch = [&](size_t iterations) {
+                auto start = Clock::now();
+                for (size_t i = 0; i < iterations; ++i) {
+                    passed &= Parent::doTest();
+                }
+                return Clock::now() - start;
+            };
+
+            const size_t iterations = detail::calibrate_iterations(run_batch, batch_time, passed);
+            if (!passed) {
+                return false;
+            }
+
+            std::vector<double> samples;
+            samples.reserve(sample_count);
+            const bool count = this->countersEnabled();
+            const CounterValues counters_before = count ? PerfCounters::thread().read() : CounterValues{};
+            AllocationScope allocations;
+            for (size_t i = 0; i < sample_count && passed; ++i) {
+                auto elapsed = run_batch(iterations);
+                samples.push_back(std::chrono::duration<double, std::nano>(elapsed).count() / double(iterations));
+            }
+            if (!passed) {
+                return false;
+            }
+            const CounterValues counters = count ? PerfCounters::thread().read() - counters_before : CounterValues{};
+            const AllocationStats allocation_stats = allocations.stop();
+
+            stats_ = detail::compute_stats(samples, iterations);
+            this->out()
+                << "benchmark: " << stats_.samples << " samples x " << stats_.iterations << " iterations\n"
+                << "min " << detail::format_duration(stats_.min)
+                << ", median " << detail::format_duration(stats_.median)
+                << ", p99 " << detail::format_duration(stats_.p99)
+                << ", stddev " << detail::format_duration(stats_.stddev) << " per iteration"
+                << detail::format_counters(counters, double(sample_count * iterations))
+                << detail::format_allocations(allocation_stats, double(sample_count * iterations)) << '\n';
+            if (max_median_ns_ < stats_.median) {
+                this->out() << "SLOWER than given limit: " << detail::format_duration(max_median_ns_) << '\n';
+                return false;
+            }
+            return true;
+        }
+
+        // Timings of the last run
+        const BenchmarkStats& stats() const {
+            return stats_;
+        }
+
+    private:
+        BenchmarkOptions options_;
+        double max_median_ns_ = std::numeric_limits<double>::infinity();
+        BenchmarkStats stats_;
+    };
+
+    // Helper functions for unique_ptr creation of BenchmarkTest from Simple and Pretty tests
+    template<template<typename> typename ActualTest, typename Functor>
+    auto make_benchmark(
+        std::string name,
+        Functor f,
+        BenchmarkOptions options = {}
+    ) {
+        return std::make_unique<BenchmarkTest<ActualTest, Functor>>(
+                options, std::numeric_limits<double>::infinity(), std::move(name), std::move(f)
+        );
+    }
+
+    // Fails if median time of an iteration exceeds `time_limit`
+    template<template<typename> typename ActualTest, typename Functor>
+    auto make_benchmark(
+        std::chrono::nanoseconds time_limit,
+        std::string name,
+        Functor f,
+        BenchmarkOptions options = {}
+    ) {
+        return std::make_unique<BenchmarkTest<ActualTest, Functor>>(
+                options, double(time_limit.count()), std::move(name), std::move(f)
+        );
+    }
+
+    // Complexity classes for `make_scaling_test`
+    enum class Complexity {
+        Constant,
+        Logarithmic,
+        Linear,
+        NLogN,
+        Quadratic,
+        Cubic
+    };
+
+    // Settings of the size sweep of scaling tests
+    struct ScalingOptions {
+        // sizes go from `min_size` to `max_size`, every next one `growth` times larger.
+        // Times of small sizes are dominated by fixed overhead, so the sweep starts above them
+        size_t min_size = 1024;
+        size_t max_size = 1 << 16;
+        double growth = 2;
+        // measurement of every size, the number of iterations is calibrated for each of them
+        BenchmarkOptions benchmark = {.warmup_iterations = 2, .samples = 10, .target_time = 20ms};
+        // how much faster than the declared complexity time may grow with size, as an exponent:
+        // with 0.25 a test declared O(n) passes at n^1.2 and fails at n^1.3 if it also fits
+        // a complexity above O(n)
+        double tolerance = 0.25;
+    };
+
+    namespace detail {
+        inline const char* complexity_name(Complexity complexity) {
+            switch (complexity) {
+            case Complexity::Constant: return "O(1)";
+            case Complexity::Logarithmic: return "O(log n)";
+            case Complexity::Linear: return "O(n)";
+            case Complexity::NLogN: return "O(n log n)";
+            case Complexity::Quadratic: return "O(n^2)";
+            case Complexity::Cubic: return "O(n^3)";
+            }
+            return "?";
+        }
+
+        inline double complexity_value(Complexity complexity, double n) {
+            switch (complexity) {
+            case Complexity::Constant: return 1;
+            case Complexity::Logarithmic: return std::log2(n);
+            case Complexity::Linear: return n;
+            case Complexity::NLogN: return n * std::log2(n);
+            case Complexity::Quadratic: return n * n;
+            case Complexity::Cubic: return n * n * n;
+            }
+            return 1;
+        }
+
+        // Least squares slope of log(y) over log(x)
+        inline double log_log_slope(std::span<const double> xs, std::span<const double> ys) {
+            const size_t count = std::min(xs.size(), ys.size());
+            double mean_x = 0;
+            double mean_y = 0;
+            for (size_t i = 0; i < count; ++i) {
+                mean_x += std::log(xs[i]);
+                mean_y += std::log(ys[i]);
+            }
+            mean_x /= double(count);
+            mean_y /= double(count);
+            double covariance = 0;
+            double variance = 0;
+            for (size_t i = 0; i < count; ++i) {
+                const double dx = std::log(xs[i]) - mean_x;
+                covariance += dx * (std::log(ys[i]) - mean_y);
+                variance += dx * dx;
+            }
+            return variance > 0 ? covariance / variance : 0;
+        }
+
+        // Complexity of the form c * f(n) that fits times best, by relative RMS error
+        inline Complexity best_complexity(std::span<const double> sizes, std::span<const double> times) {
+            Complexity best = Complexity::Constant;
+            double best_error = std::numeric_limits<double>::infinity();
+            for (int i = int(Complexity::Constant); i <= int(Complexity::Cubic); ++i) {
+                const auto complexity = Complexity(i);
+                // minimizes sum of ((c * f(n) - t) / t)^2
+                double numerator = 0;
+                double denominator = 0;
+                for (size_t j = 0; j < sizes.size(); ++j) {
+                    const double ratio = complexity_value(complexity, sizes[j]) / times[j];
+                    numerator += ratio;
+                    denominator += ratio * ratio;
+                }
+                const double c = numerator / denominator;
+                double error = 0;
+                for (size_t j = 0; j < sizes.size(); ++j) {
+                    const double relative = c * complexity_value(complexity, sizes[j]) / times[j] - 1;
+                    error += relative * relative;
+                }
+                if (error < best_error) {
+                    best_error = error;
+                    best = complexity;
+                }
+            }
+            return best;
+        }
+
+        // Functor of the underlying test, passes the selected size as the last argument
+        template<typename Functor>
+        struct SizedBody {
+            Functor functor;
+            const size_t* size;
+
+            template<typename... Args>
+            auto operator()(Args&... args) -> decltype(functor(args..., size_t{})) {
+                return functor(args..., *size);
+            }
+        };
+
+        // Size to run the body with, a base initialized before the underlying test
+        struct SizeSelector {
+            size_t current_size = 0;
+        };
+    }
+
+    // Runs the test over a geometric range of input sizes, the functor receives the size
+    // as its last argument. Median time per iteration is measured for every size like
+    // in benchmarks, then growth of time with size is compared against declared complexity
+    template<template<typename> typename ActualTest, typename Functor>
+    struct ScalingTest : detail::SizeSelector, ActualTest<detail::SizedBody<Functor>> {
+        using Parent = ActualTest<detail::SizedBody<Functor>>;
+
+        ScalingTest(ScalingOptions options, std::optional<Complexity> bound, std::string name, Functor f)
+            : Parent(std::move(name), detail::SizedBody<Functor>{std::move(f), &current_size})
+            , options_(options)
+            , bound_(bound) {}
+
+        bool timingSensitive() const override {
+            return true;
+        }
+
+        bool doTest() override {
+            using Clock = std::chrono::steady_clock;
+            bool passed = true;
+            auto run_batch = [&](size_t iterations) {
+                auto start = Clock::now();
+                for (size_t i = 0; i < iterations; ++i) {
+                    passed &= Parent::doTest();
+                }
+                return Clock::now() - start;
+            };
+
+            std::vector<double> sizes;
+            std::vector<double> times;
+            const size_t sample_count = std::max<size_t>(options_.benchmark.samples, 1);
+            const auto batch_time = options_.benchmark.target_time / sample_count;
+            const double growth = std::max(options_.growth, 1.01);
+            for (double size = double(std::max<size_t>(options_.min_size, 1)); size <= double(options_.max_size) && passed; size *= growth) {
+                // several steps may round to the same size when growth is small
+                current_size = size_t(std::llround(size));
+                if (!sizes.empty() && double(current_size) == sizes.back()) {
+                    continue;
+                }
+                run_batch(options_.benchmark.warmup_iterations);
+                const size_t iterations = detail::calibrate_iterations(run_batch, batch_time, passed);
+                std::vector<double> samples;
+                samples.reserve(sample_count);
+                for (size_t i = 0; i < sample_count && passed; ++i) {
+                    samples.push_back(std::chrono::duration<double, std::nano>(run_batch(iterations)).count() / double(iterations));
+                }
+                sizes.push_back(double(current_size));
+                times.push_back(std::max(detail::compute_stats(samples, iterations).median, 1e-3));
+            }
+            if (!passed) {
+                return false;
+            }
+
+            this->out() << "scaling: " << sizes.size() << " sizes, median time per iteration\n";
+            for (size_t i = 0; i < sizes.size(); ++i) {
+                this->out() << std::setw(12) << size_t(sizes[i]) << "  " << detail::format_duration(times[i]) << '\n';
+            }
+            if (sizes.size() < 2) {
+                this->out() << "scaling needs at least two sizes, check ScalingOptions\n";
+                return false;
+            }
+            const Complexity fitted = detail::best_complexity(sizes, times);
+            this->out() << "fits " << detail::complexity_name(fitted)
+                << ", grows as n^" << std::fixed << std::setprecision(2) << detail::log_log_slope(sizes, times) << std::defaultfloat;
+            if (!bound_) {
+                this->out() << '\n';
+                return true;
+            }
+            this->out() << ", declared " << detail::complexity_name(*bound_) << '\n';
+
+            // exponent of time divided by the declared complexity, zero if they grow alike.
+            // Noise alone may push it over the tolerance, so the fitted complexity must exceed the bound too
+            std::vector<double> normalized;
+            for (size_t i = 0; i < sizes.size(); ++i) {
+                normalized.push_back(times[i] / detail::complexity_value(*bound_, std::max(sizes[i], 2.0)));
+            }
+            const double excess = detail::log_log_slope(sizes, normalized);
+            if (fitted > *bound_ && excess > options_.tolerance) {
+                this->out() << "SLOWER than declared complexity: fits " << detail::complexity_name(fitted)
+                    << ", grows n^" << std::fixed << std::setprecision(2) << excess
+                    << " faster than " << detail::complexity_name(*bound_) << std::defaultfloat << '\n';
+                return false;
+            }
+            return true;
+        }
+
+    private:
+        ScalingOptions options_;
+        std::optional<Complexity> bound_;
+    };
+
+    // Helper functions for unique_ptr creation of ScalingTest from Simple and Pretty tests, e.g.
+    // make_scaling_test<PrettyTest>(Complexity::NLogN, "sort", [](auto& test, size_t n) { ... })
+    template<template<typename> typename ActualTest, typename Functor>
+    auto make_scaling_test(
+        std::string name,
+        Functor f,
+        ScalingOptions options = {}
+    ) {
+        return std::make_unique<ScalingTest<ActualTest, Functor>>(options, std::nullopt, std::move(name), std::move(f));
+    }
+
+    // Fails if time grows with size faster than `bound`
+    template<template<typename> typename ActualTest, typename Functor>
+    auto make_scaling_test(
+        Complexity bound,
+        std::string name,
+        Functor f,
+        ScalingOptions options = {}
+    ) {
+        return std::make_unique<ScalingTest<ActualTest, Functor>>(options, bound, std::move(name), std::move(f));
+    }
+
+    // Marks test as serial-only: parallel runner will not run
+    // anything else while this test is running
+    template<typename ActualTest>
+    std::unique_ptr<ActualTest> serial(std::unique_ptr<ActualTest> test) {
+        test->setSerialOnly();
+        return test;
+    }
+
+    // Fails the test if heap memory it allocates is not freed by the end of
+    // its run. Values built on first use, like fixtures, count as leaked
+    template<typename ActualTest>
+    std::unique_ptr<ActualTest> check_leaks(std::unique_ptr<ActualTest> test) {
+        test->setCheckLeaks();
+        return test;
+    }
+
+    // Declares data files the test reads: cached result
+    // of the test is not used once any of them changes
+    template<typename ActualTest>
+    std::unique_ptr<ActualTest> depends_on(std::unique_ptr<ActualTest> test, std::initializer_list<std::string_view> paths) {
+        for (auto path : paths) {
+            test->addDependency(std::string(path));
+        }
+        return test;
+    }
+
+    namespace detail {
+        // Fixed-size thread pool with a separate task queue for every worker.
+        // Workers take tasks from the front of their own queue and, when it is
+        // empty, steal from the back of other workers' queues
+        class WorkStealingPool {
+        public:
+            WorkStealingPool(const WorkStealingPool&) = delete;
+
+            explicit WorkStealingPool(size_t threads)
+            : queues_(std::max<size_t>(threads, 1)) {
+                for (size_t i = 0; i < queues_.size(); ++i) {
+                    workers_.emplace_back([this, i] { work(i); });
+                }
+            }
+
+            ~WorkStealingPool() {
+                {
+                    std::lock_guard lock(mutex_);
+                    stopping_ = true;
+                }
+                wake_.notify_all();
+                for (auto& worker : workers_) {
+                    worker.join();
+                }
+            }
+
+            size_t size() const {
+                return queues_.size();
+            }
+
+            // Pool running the calling thread, null outside of pool tasks
+            static WorkStealingPool* current() {
+                return current_pool();
+            }
+
+            // How tasks of a `parallelFor` call are initially spread over workers
+            enum class Distribution {
+                // every worker gets a contiguous range of indices
+                Contiguous,
+                // index i goes to worker i % size(), so that tasks sorted by
+                // descending cost are spread evenly
+                RoundRobin
+            };
+
+            // Calls `body(i)` for every i in [0, count) and waits until all calls are finished.
+            // May be called from inside a task: waiting worker keeps executing tasks meanwhile
+            template<typename Body>
+            void parallelFor(size_t count, Body&& body, Distribution distribution = Distribution::Contiguous) {
+                if (count == 0) {
+                    return;
+                }
+                Batch batch;
+                batch.context = &body;
+                batch.call = [](void* context, size_t index) {
+                    (*static_cast<std::remove_reference_t<Body>*>(context))(index);
+                };
+                batch.remaining = count;
+
+                const size_t workers = queues_.size();
+                if (current_pool() == this) {
+                    // nested call: keep tasks local, other workers will steal them
+                    push(current_worker(), &batch, 0, count, 1);
+                } else if (distribution == Distribution::RoundRobin) {
+                    for (size_t i = 0; i < workers; ++i) {
+                        push(i, &batch, i, count, workers);
+                    }
+                } else {
+                    for (size_t i = 0; i < workers; ++i) {
+                        push(i, &batch, count * i / workers, count * (i + 1) / workers, 1);
+                    }
+                }
+                wait(batch);
+            }
+
+        private:
+            struct Batch {
+                void* context = nullptr;
+                void (*call)(void*, size_t) = nullptr;
+                std::atomic<size_t> remaining = 0;
+            };
+
+            struct Task {
+                Batch* batch;
+                size_t index;
+            };
+
+            struct Queue {
+                std::mutex mutex;
+                std::deque<Task> tasks;
+            };
+
+            static WorkStealingPool*& current_pool() {
+                thread_local WorkStealingPool* pool = nullptr;
+                return pool;
+            }
+
+            static size_t& current_worker() {
+                thread_local size_t worker = 0;
+                return worker;
+            }
+
+            // Pushes tasks begin, begin + stride, ... below end
+            void push(size_t queue_index, Batch* batch, size_t begin, size_t end, size_t stride) {
+                if (begin >= end) {
+                    return;
+                }
+                size_t pushed = 0;
+                {
+                    auto& queue = queues_[queue_index];
+                    std::lock_guard lock(queue.mutex);
+                    for (size_t i = begin; i < end; i += stride) {
+                        queue.tasks.push_back({batch, i});
+                        ++pushed;
+                    }
+                }
+                {
+                    std::lock_guard lock(mutex_);
+                    pending_ += pushed;
+                }
+                wake_.notify_all();
+            }
+
+            bool take(size_t self, Task& task) {
+                {
+                    auto& own = queues_[self];
+                    std::lock_guard lock(own.mutex);
+                    if (!own.tasks.empty()) {
+                        task = own.tasks.front();
+                        own.tasks.pop_front();
+                        --pending_;
+                        return true;
+                    }
+                }
+                for (size_t shift = 1; shift < queues_.size(); ++shift) {
+                    auto& victim = queues_[(self + shift) % queues_.size()];
+                    std::lock_guard lock(victim.mutex);
+                    if (!victim.tasks.empty()) {
+                        task = victim.tasks.back();
+                        victim.tasks.pop_back();
+                        --pending_;
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            void execute(const Task& task) {
+                task.batch->call(task.batch->context, task.index);
+                if (task.batch->remaining.fetch_sub(1) == 1) {
+                    std::lock_guard lock(mutex_);
+                    done_.notify_all();
+                }
+            }
+
+            void wait(Batch& batch) {
+                if (current_pool() == this) {
+                    Task task;
+                    while (batch.remaining != 0) {
+                        if (take(current_worker(), task)) {
+                            execute(task);
+                        } else {
+                            std::this_thread::yield();
+                        }
+                    }
+                    return;
+                }
+                std::unique_lock lock(mutex_);
+                done_.wait(lock, [&] { return batch.remaining == 0; });
+            }
+
+            void work(size_t self) {
+                current_pool() = this;
+                current_worker() = self;
+                Task task;
+                while (true) {
+                    if (take(self, task)) {
+                        execute(task);
+                        continue;
+                    }
+                    std::unique_lock lock(mutex_);
+                    wake_.wait(lock, [&] { return stopping_ || pending_ != 0; });
+                    if (stopping_ && pending_ == 0) {
+                        return;
+                    }
+                }
+            }
+
+            std::vector<Queue> queues_;
+            std::vector<std::thread> workers_;
+            std::mutex mutex_;
+            std::condition_variable wake_;
+            std::condition_variable done_;
+            std::atomic<size_t> pending_ = 0;
+            bool stopping_ = false;
+        };
+
+        // Glob match supporting '*' and '?'
+        inline bool glob_match(std::string_view pattern, std::string_view text) {
+            size_t p = 0;
+            size_t t = 0;
+            size_t star = std::string_view::npos;
+            size_t star_text = 0;
+            while (t < text.size()) {
+                if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == text[t])) {
+                    ++p;
+                    ++t;
+                } else if (p < pattern.size() && pattern[p] == '*') {
+                    star = p++;
+                    star_text = t;
+                } else if (star != std::string_view::npos) {
+                    p = star + 1;
+                    t = ++star_text;
+                } else {
+                    return false;
+                }
+            }
+            while (p < pattern.size() && pattern[p] == '*') {
+                ++p;
+            }
+            return p == pattern.size();
+        }
+
+        // Filter is a ':'-separated list of globs, optionally followed by '-' and
+        // a list of globs to exclude, e.g. "strings/*:math/*-*slow*"
+        inline bool filter_match(std::string_view filter, std::string_view key) {
+            if (filter.empty()) {
+                return true;
+            }
+            const size_t minus = filter.find('-');
+            const std::string_view positive = filter.substr(0, minus);
+            const std::string_view negative = minus == std::string_view::npos ? std::string_view{} : filter.substr(minus + 1);
+            auto any_match = [&](std::string_view patterns) {
+                while (!patterns.empty()) {
+                    const size_t colon = patterns.find(':');
+                    if (glob_match(patterns.substr(0, colon), key)) {
+                        return true;
+                    }
+                    if (colon == std::string_view::npos) {
+                        break;
+                    }
+                    patterns.remove_prefix(colon + 1);
+                }
+                return false;
+            };
+            return (positive.empty() || any_match(positive)) && !any_match(negative);
+        }
+
+        // FNV-1a, stable between runs and platforms
+        inline uint64_t stable_hash(std::string_view data, uint64_t hash = 14695981039346656037ull) {
+            for (char c : data) {
+                hash ^= uint8_t(c);
+                hash *= 1099511628211ull;
+            }
+            return hash;
+        }
+
+        inline std::string test_key(std::string_view group, std::string_view name) {
+            std::string key;
+            key.reserve(group.size() + name.size() + 1);
+            key += group;
+            key += '/';
+            key += name;
+            return key;
+        }
+
+        // Same as `stable_hash(test_key(group, name))`
+        inline uint64_t key_hash(std::string_view group, std::string_view name) {
+            return stable_hash(name, stable_hash("/", stable_hash(group)));
+        }
+    }
+
+    // Read-only view of a whole file. Where supported the file is memory mapped,
+    // so pages are loaded on demand and dropped under memory pressure,
+    // elsewhere it is read into memory
+    class MappedFile {
+    public:
+        MappedFile() = default;
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        explicit MappedFile(const std::string& path) {
+            open(path);
+        }
+
+        MappedFile(MappedFile&& other) noexcept {
+            *this = std::move(other);
+        }
+
+        MappedFile& operator=(MappedFile&& other) noexcept {
+            if (this != &other) {
+                close();
+                data_ = std::exchange(other.data_, nullptr);
+                size_ = std::exchange(other.size_, 0);
+                mapped_ = std::exchange(other.mapped_, false);
+                buffer_ = std::move(other.buffer_);
+                error_ = std::move(other.error_);
+            }
+            return *this;
+        }
+
+        ~MappedFile() {
+            close();
+        }
+
+        // On failure `error()` describes the reason
+        bool open(const std::string& path) {
+            close();
+            error_.clear();
+#if TINY_TEST__HAS_MMAP
+            const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            struct stat info{};
+            if (fd < 0 || ::fstat(fd, &info) != 0) {
+                error_ = "cannot open " + path + ": " + std::strerror(errno);
+                if (fd >= 0) {
+                    ::close(fd);
+                }
+                return false;
+            }
+            size_ = size_t(info.st_size);
+            if (size_ != 0) {
+                void* data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (data == MAP_FAILED) {
+                    error_ = "cannot map " + path + ": " + std::strerror(errno);
+                    size_ = 0;
+                    ::close(fd);
+                    return false;
+                }
+                data_ = static_cast<const std::byte*>(data);
+                mapped_ = true;
+            }
+            ::close(fd);
+            return true;
+#else
+            std::ifstream file(path, std::ios::binary | std::ios::ate);
+            if (!file) {
+                error_ = "cannot open " + path;
+                return false;
+            }
+            size_ = size_t(file.tellg());
+            buffer_ = std::make_unique<std::byte[]>(size_);
+            file.seekg(0);
+            file.read(reinterpret_cast<char*>(buffer_.get()), std::streamsize(size_));
+            if (!file) {
+                error_ = "cannot read " + path;
+                close();
+                return false;
+            }
+            data_ = buffer_.get();
+            return true;
+#endif
+        }
+
+        void close() {
+#if TINY_TEST__HAS_MMAP
+            if (mapped_) {
+                ::munmap(const_cast<std::byte*>(data_), size_);
+            }
+#endif
+            buffer_.reset();
+            data_ = nullptr;
+            size_ = 0;
+            mapped_ = false;
+        }
+
+        const std::byte* data() const {
+            return data_;
+        }
+
+        size_t size() const {
+            return size_;
+        }
+
+        std::string_view text() const {
+            return {reinterpret_cast<const char*>(data_), size_};
+        }
+
+        const std::string& error() const {
+            return error_;
+        }
+
+    private:
+        const std::byte* data_ = nullptr;
+        size_t size_ = 0;
+        bool mapped_ = false;
+        std::unique_ptr<std::byte[]> buffer_;
+        std::string error_;
+    };
+
+    namespace detail {
+        // Bytes compared by one memcmp when looking for the first difference
+        inline constexpr size_t compare_chunk = 64 << 10;
+
+        // Length of the common prefix of `x` and `y`, only the chunk with the difference is compared byte by byte
+        inline size_t common_prefix(std::string_view x, std::string_view y) {
+            const size_t size = std::min(x.size(), y.size());
+            size_t length = 0;
+            while (length + compare_chunk <= size && std::memcmp(x.data() + length, y.data() + length, compare_chunk) == 0) {
+                length += compare_chunk;
+            }
+            while (length < size && x[length] == y[length]) {
+                ++length;
+            }
+            return length;
+        }
+
+        // Length of the common suffix of `x` and `y`, at most `limit`
+        inline size_t common_suffix(std::string_view x, std::string_view y, size_t limit) {
+            size_t length = 0;
+            while (length + compare_chunk <= limit
+                    && std::memcmp(x.data() + x.size() - length - compare_chunk, y.data() + y.size() - length - compare_chunk, compare_chunk) == 0) {
+                length += compare_chunk;
+            }
+            while (length < limit && x[x.size() - length - 1] == y[y.size() - length - 1]) {
+                ++length;
+            }
+            return length;
+        }
+
+        // Shortest edit script turning lines `a` into lines `b` (Myers' algorithm), one of ' ' (line
+        // kept), '-' (line of `a` removed) and '+' (line of `b` inserted) per line, nullopt if it needs
+        // more than `max_edits` insertions and removals. Takes O((a.size() + b.size()) * max_edits)
+        inline std::optional<std::string> diff_lines(std::span<const std::string_view> a, std::span<const std::string_view> b, size_t max_edits) {
+            const ptrdiff_t n = ptrdiff_t(a.size());
+            const ptrdiff_t m = ptrdiff_t(b.size());
+            const ptrdiff_t max = ptrdiff_t(std::min(max_edits, a.size() + b.size()));
+            const ptrdiff_t offset = max + 1;
+            // furthest x reached on every diagonal k = x - y, saved before every step for backtracking
+            std::vector<ptrdiff_t> furthest(size_t(2 * max + 3), 0);
+            std::vector<std::vector<ptrdiff_t>> trace;
+            for (ptrdiff_t d = 0; d <= max; ++d) {
+                trace.push_back(furthest);
+                for (ptrdiff_t k = -d; k <= d; k += 2) {
+                    const bool down = k == -d || (k != d && furthest[size_t(offset + k - 1)] < furthest[size_t(offset + k + 1)]);
+                    ptrdiff_t x = down ? furthest[size_t(offset + k + 1)] : furthest[size_t(offset + k - 1)] + 1;
+                    ptrdiff_t y = x - k;
+                    while (x < n && y < m && a[size_t(x)] == b[size_t(y)]) {
+                        ++x;
+                        ++y;
+                    }
+                    furthest[size_t(offset + k)] = x;
+                    if (x < n || y < m) {
+                        continue;
+                    }
+
+                    std::string script;
+                    for (ptrdiff_t step = d; step >= 0; --step) {
+                        const auto& previous = trace[size_t(step)];
+                        const ptrdiff_t diagonal = x - y;
+                        const bool inserted = diagonal == -step
+                            || (diagonal != step && previous[size_t(offset + diagonal - 1)] < previous[size_t(offset + diagonal + 1)]);
+                        const ptrdiff_t previous_diagonal = inserted ? diagonal + 1 : diagonal - 1;
+                        const ptrdiff_t previous_x = step == 0 ? 0 : previous[size_t(offset + previous_diagonal)];
+                        const ptrdiff_t previous_y = step == 0 ? 0 : previous_x - previous_diagonal;
+                        while (x > previous_x && y > previous_y) {
+                            script += ' ';
+                            --x;
+                            --y;
+                        }
+                        if (step != 0) {
+                            script += inserted ? '+' : '-';
+                            x = previous_x;
+                            y = previous_y;
+                        }
+                    }
+                    std::reverse(script.begin(), script.end());
+                    return script;
+                }
+            }
+            return std::nullopt;
+        }
+
+        // Splits `text` into lines without their '\n'
+        inline std::vector<std::string_view> split_lines(std::string_view text) {
+            std::vector<std::string_view> lines;
+            while (!text.empty()) {
+                const size_t end = std::min(text.find('\n'), text.size());
+                lines.push_back(text.substr(0, end));
+                text.remove_prefix(std::min(end + 1, text.size()));
+            }
+            return lines;
+        }
+
+        // Unified diff of `expected` and `actual` as text, with `context` lines around changes.
+        // Common prefix and suffix are skipped without splitting them into lines, so only
+        // the changed part of a large snapshot is diffed. At most `max_lines` lines are printed
+        inline void describe_text_diff(std::ostream& stream, std::string_view expected, std::string_view actual) {
+            constexpr size_t context = 3;
+            constexpr size_t max_lines = 200;
+            constexpr size_t max_edits = 256;
+            constexpr size_t max_diffed_lines = 100000;
+
+            // the changed part starts and ends at line boundaries of both
+            const size_t prefix = common_prefix(expected, actual);
+            const size_t begin = prefix == 0 ? 0 : expected.rfind('\n', prefix - 1) + 1;
+            size_t suffix = common_suffix(expected, actual, std::min(expected.size(), actual.size()) - prefix);
+            auto line_start = [](std::string_view text, size_t position) { return position == 0 || text[position - 1] == '\n'; };
+            if (!line_start(expected, expected.size() - suffix) || !line_start(actual, actual.size() - suffix)) {
+                const size_t newline = expected.find('\n', expected.size() - suffix);
+                suffix = newline == std::string_view::npos ? 0 : expected.size() - newline - 1;
+            }
+            const auto expected_lines = split_lines(expected.substr(begin, expected.size() - suffix - begin));
+            const auto actual_lines = split_lines(actual.substr(begin, actual.size() - suffix - begin));
+            std::optional<std::string> script;
+            if (expected_lines.size() + actual_lines.size() <= max_diffed_lines) {
+                script = diff_lines(expected_lines, actual_lines, max_edits);
+            }
+            if (!script) {
+                script = std::string(expected_lines.size(), '-') + std::string(actual_lines.size(), '+');
+            }
+
+            // lines around the changed part, with context before and after it
+            std::vector<std::string_view> before;
+            for (size_t end = begin; end != 0 && before.size() < context;) {
+                const size_t start = end == 1 ? 0 : expected.rfind('\n', end - 2) + 1;
+                before.insert(before.begin(), expected.substr(start, end - 1 - start));
+                end = start;
+            }
+            auto after = split_lines(expected.substr(expected.size() - suffix));
+            after.resize(std::min(after.size(), context));
+            struct Line {
+                char kind;
+                std::string_view text;
+            };
+            std::vector<Line> lines;
+            for (auto line : before) {
+                lines.push_back({' ', line});
+            }
+            size_t expected_index = 0;
+            size_t actual_index = 0;
+            for (char kind : *script) {
+                lines.push_back({kind, kind == '+' ? actual_lines[actual_index] : expected_lines[expected_index]});
+                expected_index += kind != '+';
+                actual_index += kind != '-';
+            }
+            for (auto line : after) {
+                lines.push_back({' ', line});
+            }
+
+            // hunks are changes with `context` lines around them, close ones are merged
+            size_t expected_line = size_t(std::count(expected.begin(), expected.begin() + ptrdiff_t(begin), '\n')) + 1 - before.size();
+            size_t actual_line = expected_line;
+            size_t printed = 0;
+            bool changed = false;
+            for (size_t i = 0; i < lines.size();) {
+                if (lines[i].kind == ' ') {
+                    ++expected_line;
+                    ++actual_line;
+                    ++i;
+                    continue;
+                }
+                const size_t start = i - std::min(i, context);
+                size_t end = i;
+                for (size_t unchanged = 0; end < lines.size() && unchanged <= 2 * context; ++end) {
+                    unchanged = lines[end].kind == ' ' ? unchanged + 1 : 0;
+                }
+                while (lines[end - 1].kind == ' ') {
+                    --end;
+                }
+                end = std::min(end + context, lines.size());
+                size_t removed = 0;
+                size_t inserted = 0;
+                for (size_t j = start; j < end; ++j) {
+                    removed += lines[j].kind != '+';
+                    inserted += lines[j].kind != '-';
+                }
+                changed = true;
+                const size_t first = expected_line - (i - start);
+                stream << "@@ -" << first << ',' << removed << " +" << actual_line - (i - start) << ',' << inserted << " @@\n";
+                for (size_t j = start; j < end; ++j, ++printed) {
+                    if (printed == max_lines) {
+                        stream << "... " << lines.size() - j << " more lines\n";
+                        return;
+                    }
+                    stream << lines[j].kind << lines[j].text << '\n';
+                }
+                for (; i < end; ++i) {
+                    expected_line += lines[i].kind != '+';
+                    actual_line += lines[i].kind != '-';
+                }
+            }
+            if (!changed) {
+                stream << "only the newline at the end differs\n";
+            }
+        }
+
+        // Hex dump of both around the first difference
+        inline void describe_binary_diff(std::ostream& stream, std::string_view expected, std::string_view actual) {
+            constexpr size_t row = 16;
+            const size_t prefix = common_prefix(expected, actual);
+            stream << "first difference at byte " << prefix << ":\n";
+            const size_t begin = prefix / row * row - std::min<size_t>(prefix / row * row, row);
+            auto dump = [&](char kind, std::string_view bytes) {
+                for (size_t offset = begin; offset < std::min(bytes.size(), begin + 4 * row); offset += row) {
+                    char address[24];
+                    std::snprintf(address, sizeof(address), "%08zx:", offset);
+                    stream << kind << address;
+                    for (size_t i = offset; i < offset + row; ++i) {
+                        char hex[4];
+                        std::snprintf(hex, sizeof(hex), i < bytes.size() ? " %02x" : "   ", i < bytes.size() ? unsigned(uint8_t(bytes[i])) : 0u);
+                        stream << hex;
+                    }
+                    stream << "  |";
+                    for (size_t i = offset; i < std::min(offset + row, bytes.size()); ++i) {
+                        stream << (bytes[i] >= ' ' && bytes[i] <= '~' ? bytes[i] : '.');
+                    }
+                    stream << "|\n";
+                }
+            };
+            dump('-', expected);
+            dump('+', actual);
+        }
+
+        inline SnapshotResult check_snapshot(const std::string& directory, std::string_view name, std::string_view bytes, bool update) {
+            AllocationPause pause;
+            SnapshotResult result;
+            const std::filesystem::path path = std::filesystem::path(directory) / name;
+            MappedFile file;
+            const bool exists = file.open(path.string());
+            if (exists && file.size() == bytes.size() && common_prefix(file.text(), bytes) == bytes.size()) {
+                result.matched = true;
+                return result;
+            }
+            if (update) {
+                // written next to the snapshot and renamed, so that it is never left half-written
+                file.close();
+                std::error_code error;
+                std::filesystem::create_directories(path.parent_path(), error);
+                std::filesystem::path temporary = path;
+                temporary += ".tmp";
+                std::ofstream stream(temporary, std::ios::binary | std::ios::trunc);
+                stream.write(bytes.data(), std::streamsize(bytes.size()));
+                stream.close();
+                if (stream) {
+                    std::filesystem::rename(temporary, path, error);
+                }
+                if (!stream || error) {
+                    result.description = "failed to write snapshot " + path.string();
+                    return result;
+                }
+                result.matched = true;
+                result.updated = true;
+                return result;
+            }
+
+            std::ostringstream stream;
+            if (!exists) {
+                stream << file.error() << ", run with --update-snapshots to create it\n";
+                result.description = std::move(stream).str();
+                return result;
+            }
+            const std::string_view expected = file.text();
+            stream << "snapshot " << path.string() << " differs, expected " << expected.size()
+                << " bytes, got " << bytes.size() << " bytes\n";
+            // text unless there are zero bytes near the start or the end of the common prefix
+            const size_t prefix = common_prefix(expected, bytes);
+            auto text = [&](std::string_view data) {
+                const size_t probe = 4096;
+                const size_t start = prefix - std::min(prefix, probe);
+                return data.substr(0, probe).find('\0') == std::string_view::npos
+                    && data.substr(std::min(start, data.size()), 2 * probe).find('\0') == std::string_view::npos;
+            };
+            if (text(expected) && text(bytes)) {
+                describe_text_diff(stream, expected, bytes);
+            } else {
+                describe_binary_diff(stream, expected, bytes);
+            }
+            stream << "run with --update-snapshots to accept the new output\n";
+            result.description = std::move(stream).str();
+            return result;
+        }
+    }
+
+    // Cases stored in a file as an array of `Case` records, e.g. written with fwrite.
+    // Records are used in place, the file is mapped only while the test runs
+    template<typename Case>
+    requires std::is_trivially_copyable_v<Case> && (alignof(Case) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+    class BinarySource {
+    public:
+        explicit BinarySource(std::string path)
+        : path_(std::move(path)) {}
+
+        bool open() {
+            if (!file_.open(path_)) {
+                error_ = file_.error();
+                return false;
+            }
+            if (file_.size() % sizeof(Case) != 0) {
+                error_ = path_ + ": size " + std::to_string(file_.size())
+                    + " is not a multiple of record size " + std::to_string(sizeof(Case));
+                file_.close();
+                return false;
+            }
+            return true;
+        }
+
+        void close() {
+            file_.close();
+        }
+
+        const std::string& error() const {
+            return error_;
+        }
+
+        size_t size() const {
+            return file_.size() / sizeof(Case);
+        }
+
+        const Case& operator[](size_t index) const {
+            return reinterpret_cast<const Case*>(file_.data())[index];
+        }
+
+    private:
+        std::string path_;
+        MappedFile file_;
+        std::string error_;
+    };
+
+    // Line of a CSV file, fields are views into the mapped file.
+    // Quoted fields are not supported
+    class CsvRow {
+    public:
+        CsvRow(std::string_view line, char separator)
+        : line_(line)
+        , separator_(separator) {}
+
+        std::string_view line() const {
+            return line_;
+        }
+
+        size_t size() const {
+            return size_t(std::count(line_.begin(), line_.end(), separator_)) + 1;
+        }
+
+        // Empty if there is no such field
+        std::string_view operator[](size_t index) const {
+            size_t begin = 0;
+            for (; index != 0; --index) {
+                begin = line_.find(separator_, begin);
+                if (begin == std::string_view::npos) {
+                    return {};
+                }
+                ++begin;
+            }
+            return line_.substr(begin, line_.find(separator_, begin) - begin);
+        }
+
+        // Field converted to a number or a string, throws std::invalid_argument if it is malformed
+        template<typename T>
+        T as(size_t index) const {
+            const std::string_view field = (*this)[index];
+            if constexpr (std::is_same_v<T, std::string_view> || std::is_same_v<T, std::string>) {
+                return T(field);
+            } else {
+                static_assert(std::is_arithmetic_v<T>, "CsvRow::as supports numbers and strings only");
+                T value{};
+                const auto [end, error] = std::from_chars(field.data(), field.data() + field.size(), value);
+                if (error != std::errc{} || end != field.data() + field.size()) {
+                    throw std::invalid_argument("cannot parse field " + std::to_string(index) + " '" + std::string(field) + "'");
+                }
+                return value;
+            }
+        }
+
+    private:
+        std::string_view line_;
+        char separator_;
+    };
+
+    // Cases stored in a text file, one CsvRow per line. Only offsets of lines
+    // are kept in memory, the file is mapped only while the test runs
+    class CsvSource {
+    public:
+        explicit CsvSource(std::string path, char separator = ',', size_t skip_lines = 0)
+        : path_(std::move(path))
+        , separator_(separator)
+        , skip_lines_(skip_lines) {}
+
+        bool open() {
+            if (!file_.open(path_)) {
+                error_ = file_.error();
+                return false;
+            }
+            const std::string_view text = file_.text();
+            lines_.clear();
+            size_t skip = skip_lines_;
+            for (size_t begin = 0; begin < text.size();) {
+                const void* found = std::memchr(text.data() + begin, '\n', text.size() - begin);
+                const size_t end = found != nullptr ? size_t(static_cast<const char*>(found) - text.data()) : text.size();
+                if (skip != 0) {
+                    --skip;
+                } else if (end != begin && !(end == begin + 1 && text[begin] == '\r')) {
+                    lines_.push_back(begin);
+                }
+                begin = end + 1;
+            }
+            return true;
+        }
+
+        void close() {
+            file_.close();
+            lines_.clear();
+            lines_.shrink_to_fit();
+        }
+
+        const std::string& error() const {
+            return error_;
+        }
+
+        size_t size() const {
+            return lines_.size();
+        }
+
+        CsvRow operator[](size_t index) const {
+            std::string_view line = file_.text().substr(lines_[index]);
+            line = line.substr(0, line.find('\n'));
+            if (!line.empty() && line.back() == '\r') {
+                line.remove_suffix(1);
+            }
+            return {line, separator_};
+        }
+
+    private:
+        std::string path_;
+        char separator_;
+        size_t skip_lines_;
+        MappedFile file_;
+        std::vector<size_t> lines_;
+        std::string error_;
+    };
+
+    namespace detail {
+        // Sources backed by files, opened only for the duration of a run
+        template<typename Source>
+        concept OpenableSource = requires(Source& source) {
+            { source.open() } -> std::convertible_to<bool>;
+            source.close();
+            source.error();
+        };
+    }
+
+    // Data-driven test: calls `functor(test, case, index)` for every case of `source`.
+    // Source is anything with `size()` and `operator[]`, e.g. a vector, BinarySource or CsvSource.
+    // Cases are split into chunks of `chunk_size`, each chunk is checked by its own ActualTest
+    // and calls `test.begin_case(index)` before each case, so failures are reported by case index.
+    // When the test runs on the parallel runner chunks are spread over all workers, so
+    // functor may be called concurrently. An exception stops only the chunk it was thrown in
+    template<template<typename> typename ActualTest, typename Source, typename Functor>
+    class ParamTest : public Test {
+    public:
+        ParamTest(std::string name, Source source, Functor f, size_t chunk_size)
+        : Test(std::move(name))
+        , source_(std::move(source))
+        , f_(std::move(f))
+        , chunk_size_(std::max<size_t>(chunk_size, 1)) {}
+
+        bool doTest() override {
+            if constexpr (detail::OpenableSource<Source>) {
+                if (!source_.open()) {
+                    out() << source_.error() << '\n';
+                    return false;
+                }
+                struct Closer {
+                    Source& source;
+                    ~Closer() {
+                        source.close();
+                    }
+                } closer{source_};
+                return runCases();
+            } else {
+                return runCases();
+            }
+        }
+
+    private:
+        bool runCases() {
+            const size_t count = source_.size();
+            const size_t chunks = (count + chunk_size_ - 1) / chunk_size_;
+            std::vector<TestResult> results(chunks);
+            std::vector<size_t> failed_cases(chunks, 0);
+            auto run_chunk = [&](size_t chunk) {
+                const size_t begin = chunk * chunk_size_;
+                const size_t end = std::min(count, begin + chunk_size_);
+                auto body = [this, begin, end](auto& test) {
+                    for (size_t i = begin; i < end; ++i) {
+                        test.begin_case(i);
+                        f_(test, source_[i], i);
+                    }
+                };
+                ActualTest<decltype(body)> test(name_, std::move(body));
+                test.run(results[chunk], options(), stopToken());
+                failed_cases[chunk] = test.failed_cases();
+            };
+
+            auto* pool = detail::WorkStealingPool::current();
+            if (pool != nullptr && chunks > 1) {
+                pool->parallelFor(chunks, run_chunk);
+            } else {
+                for (size_t chunk = 0; chunk < chunks; ++chunk) {
+                    run_chunk(chunk);
+                }
+            }
+
+            bool passed = true;
+            size_t failed = 0;
+            for (size_t chunk = 0; chunk < chunks; ++chunk) {
+                passed &= results[chunk].passed;
+                failed += failed_cases[chunk];
+                out() << results[chunk].output;
+                if (!results[chunk].cacheable) {
+                    markUncacheable();
+                }
+            }
+            if (!passed) {
+                out() << failed << " of " << count << " cases failed\n";
+            }
+            return passed;
+        }
+
+        Source source_;
+        Functor f_;
+        size_t chunk_size_;
+    };
+
+    template<template<typename> typename ActualTest, typename Source, typename Functor>
+    std::unique_ptr<ParamTest<ActualTest, Source, Functor>> make_param_test(
+            std::string name,
+            Source source,
+            Functor f,
+            size_t chunk_size = 1024) {
+        return std::make_unique<ParamTest<ActualTest, Source, Functor>>(std::move(name), std::move(source), std::move(f), chunk_size);
+    }
+
+    // Fast pseudo-random numbers for property tests: xoshiro256** seeded with splitmix64
+    class Random {
+    public:
+        explicit Random(uint64_t seed) {
+            for (auto& word : state_) {
+                seed += 0x9e3779b97f4a7c15ull;
+                uint64_t z = seed;
+                z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+                z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+                word = z ^ (z >> 31);
+            }
+        }
+
+        uint64_t next() {
+            const uint64_t result = rotl(state_[1] * 5, 7) * 9;
+            const uint64_t t = state_[1] << 17;
+            state_[2] ^= state_[0];
+            state_[3] ^= state_[1];
+            state_[1] ^= state_[2];
+            state_[0] ^= state_[3];
+            state_[2] ^= t;
+            state_[3] = rotl(state_[3], 45);
+            return result;
+        }
+
+        // Uniform in [0, bound), zero bound means any 64-bit number.
+        // Multiply-shift instead of modulo, bias is negligible for testing
+        uint64_t below(uint64_t bound) {
+            if (bound == 0) {
+                return next();
+            }
+#if defined(__SIZEOF_INT128__)
+            // __extension__ keeps -pedantic builds of user code quiet
+            __extension__ typedef unsigned __int128 uint128;
+            return uint64_t(uint128(next()) * bound >> 64);
+#else
+            return next() % bound;
+#endif
+        }
+
+        // Uniform in [0, 1)
+        double real() {
+            return double(next() >> 11) * 0x1.0p-53;
+        }
+
+    private:
+        static uint64_t rotl(uint64_t x, int k) {
+            return (x << k) | (x >> (64 - k));
+        }
+
+        uint64_t state_[4];
+    };
+
+    // Generators of property test inputs. Generator has `value_type`, `operator()(Random&)`
+    // that makes a random value and `shrink(value)` that returns simpler candidates,
+    // most promising first
+    namespace gen {
+        template<std::integral T>
+        struct integers {
+            using value_type = T;
+
+            T min = std::numeric_limits<T>::min();
+            T max = std::numeric_limits<T>::max();
+
+            T operator()(Random& random) const {
+                const uint64_t range = uint64_t(max) - uint64_t(min) + 1;
+                return T(uint64_t(min) + random.below(range));
+            }
+
+            // Closer to zero, or to the bound nearest to zero
+            std::vector<T> shrink(T value) const {
+                const T target = min > 0 ? min : (max < 0 ? max : T(0));
+                std::vector<T> result;
+                if (value == target) {
+                    return result;
+                }
+                result.push_back(target);
+                // halfway to target, then closer and closer to value
+                for (T distance = T((value - target) / 2); distance != 0; distance = T(distance / 2)) {
+                    result.push_back(T(value - distance));
+                }
+                return result;
+            }
+        };
+
+        template<std::floating_point T>
+        struct reals {
+            using value_type = T;
+
+            T min = T(-1);
+            T max = T(1);
+
+            T operator()(Random& random) const {
+                return T(min + (max - min) * random.real());
+            }
+
+            std::vector<T> shrink(T value) const {
+                const T target = std::clamp(T(0), min, max);
+                std::vector<T> result;
+                for (T candidate : {target, std::trunc(value), target + (value - target) / 2}) {
+                    if (candidate != value && candidate >= min && candidate <= max
+                            && std::find(result.begin(), result.end(), candidate) == result.end()) {
+                        result.push_back(candidate);
+                    }
+                }
+                return result;
+            }
+        };
+
+        struct booleans {
+            using value_type = bool;
+
+            bool operator()(Random& random) const {
+                return (random.next() >> 63) != 0;
+            }
+
+            std::vector<bool> shrink(bool value) const {
+                return value ? std::vector<bool>{false} : std::vector<bool>{};
+            }
+        };
+
+        // One of given values, shrinks towards the first one
+        template<typename T>
+        struct elements {
+            using value_type = T;
+
+            std::vector<T> values;
+
+            T operator()(Random& random) const {
+                return values[random.below(values.size())];
+            }
+
+            std::vector<T> shrink(const T& value) const {
+                std::vector<T> result;
+                for (const T& candidate : values) {
+                    if (candidate == value) {
+                        break;
+                    }
+                    result.push_back(candidate);
+                }
+                return result;
+            }
+        };
+
+        // Containers of up to `max_size` elements made by `element`, e.g. vectors
+        // or strings. Shrink by removing elements, then by shrinking them
+        template<typename Element, typename Container = std::vector<typename Element::value_type>>
+        struct containers {
+            using value_type = Container;
+
+            Element element;
+            size_t max_size = 32;
+
+            Container operator()(Random& random) const {
+                Container result;
+                const size_t size = random.below(max_size + 1);
+                for (size_t i = 0; i < size; ++i) {
+                    result.push_back(element(random));
+                }
+                return result;
+            }
+
+            std::vector<Container> shrink(const Container& value) const {
+                std::vector<Container> result;
+                const size_t size = value.size();
+                if (size != 0) {
+                    result.emplace_back();
+                }
+                for (size_t removed = size / 2; removed != 0; removed /= 2) {
+                    if (removed != size) {
+                        result.emplace_back(value.begin() + long(removed), value.end());
+                        result.emplace_back(value.begin(), value.end() - long(removed));
+                    }
+                }
+                for (size_t i = 0; i < size && size > 1; ++i) {
+                    Container smaller = value;
+                    smaller.erase(smaller.begin() + long(i));
+                    result.push_back(std::move(smaller));
+                }
+                for (size_t i = 0; i < size; ++i) {
+                    for (const auto& element : element.shrink(value[i])) {
+                        Container simpler = value;
+                        simpler[i] = element;
+                        result.push_back(std::move(simpler));
+                    }
+                }
+                return result;
+            }
+        };
+
+        template<typename Element>
+        containers<Element> vectors(Element element, size_t max_size = 32) {
+            return {std::move(element), max_size};
+        }
+
+        // Printable ASCII strings
+        inline containers<integers<char>, std::string> strings(size_t max_size = 32) {
+            return {{' ', '~'}, max_size};
+        }
+    }
+
+    namespace detail {
+        template<typename T>
+        void describe_value(std::ostream& stream, const T& value);
+
+        template<typename Tuple, size_t... Indices>
+        void describe_tuple(std::ostream& stream, const Tuple& tuple, std::index_sequence<Indices...>) {
+            stream << '(';
+            ((stream << (Indices == 0 ? "" : ", "), describe_value(stream, std::get<Indices>(tuple))), ...);
+            stream << ')';
+        }
+
+        template<typename T>
+        concept TupleLike = requires { std::tuple_size<T>::value; };
+
+        // Prints counterexamples: strings quoted, ranges and tuples element-wise
+        template<typename T>
+        void describe_value(std::ostream& stream, const T& value) {
+            if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+                stream << std::quoted(std::string_view(value));
+            } else if constexpr (std::is_same_v<T, bool>) {
+                stream << (value ? "true" : "false");
+            } else if constexpr (Printable<T>) {
+                stream << value;
+            } else if constexpr (std::ranges::range<T>) {
+                stream << '[';
+                bool first = true;
+                for (const auto& element : value) {
+                    stream << (first ? "" : ", ");
+                    describe_value(stream, element);
+                    first = false;
+                }
+                stream << ']';
+            } else if constexpr (TupleLike<T>) {
+                describe_tuple(stream, value, std::make_index_sequence<std::tuple_size_v<T>>{});
+            } else {
+                stream << '?';
+            }
+        }
+    }
+
+    struct PropertyOptions {
+        // Random inputs tried before the property is considered to hold
+        size_t cases = 10'000;
+        // Zero means `RunOptions::seed` or, if it is zero as well, hash of the test name,
+        // so runs are reproducible
+        uint64_t seed = 0;
+        // Cases of one task of the parallel runner
+        size_t batch_size = 1024;
+        // Upper bound of attempts to simplify a counterexample
+        size_t max_shrink_steps = 1000;
+    };
+
+    // Property test: calls `functor(test, values...)` with values made by `generators`
+    // until a check fails or `options.cases` cases pass. Batches of cases are spread
+    // over workers when the test runs on the parallel runner, each batch has its own
+    // random stream so results do not depend on scheduling. Failing input is shrunk to
+    // a minimal counterexample, which is printed along with its failed checks
+    template<template<typename> typename ActualTest, typename Functor, typename... Generators>
+    class PropertyTest : public Test {
+    public:
+        using Values = std::tuple<typename Generators::value_type...>;
+
+        PropertyTest(std::string name, PropertyOptions options, Functor f, Generators... generators)
+        : Test(std::move(name))
+        , options_(options)
+        , f_(std::move(f))
+        , generators_(std::move(generators)...) {
+            options_.batch_size = std::max<size_t>(options_.batch_size, 1);
+        }
+
+        bool doTest() override {
+            const uint64_t seed = options_.seed != 0 ? options_.seed
+                : (options() != nullptr && options()->seed != 0 ? options()->seed : detail::stable_hash(name_));
+            const size_t batches = (options_.cases + options_.batch_size - 1) / options_.batch_size;
+            // index of the first failed case, `cases` if there is none. Batches
+            // after a failed one are skipped, so the found case is always the first
+            std::atomic<size_t> first_failure = options_.cases;
+            // batches may run on several threads, their results are marked uncacheable after all of them
+            std::atomic<bool> cacheable = true;
+            auto run_batch = [&](size_t batch) {
+                if (batch * options_.batch_size > first_failure.load(std::memory_order_relaxed) || stopToken().stop_requested()) {
+                    return;
+                }
+                const size_t failed = searchBatch(seed, batch, cacheable);
+                size_t known = first_failure.load(std::memory_order_relaxed);
+                while (failed < known && !first_failure.compare_exchange_weak(known, failed, std::memory_order_relaxed)) {}
+            };
+            auto* pool = detail::WorkStealingPool::current();
+            if (pool != nullptr && batches > 1) {
+                pool->parallelFor(batches, run_batch);
+            } else {
+                for (size_t batch = 0; batch < batches; ++batch) {
+                    run_batch(batch);
+                }
+            }
+            if (!cacheable) {
+                markUncacheable();
+            }
+
+            if (first_failure == options_.cases) {
+                return true;
+            }
+            reportCounterexample(seed, first_failure);
+            return false;
+        }
+
+    private:
+        // Random stream of a batch is determined by seed and batch index only
+        static Random caseRandom(uint64_t seed, size_t batch) {
+            return Random(seed ^ (0x632be59bd9b4e019ull * (batch + 1)));
+        }
+
+        Values generate(Random& random) const {
+            return std::apply([&](const auto&... generators) {
+                return Values{generators(random)...};
+            }, generators_);
+        }
+
+        // Runs a batch until the first failure or a stop request, returns its case index.
+        // Clears `cacheable` if the batch's result must not be cached
+        size_t searchBatch(uint64_t seed, size_t batch, std::atomic<bool>& cacheable) {
+            const size_t begin = batch * options_.batch_size;
+            const size_t end = std::min(options_.cases, begin + options_.batch_size);
+            size_t failed = options_.cases;
+            size_t current = begin;
+            auto body = [&](auto& test) {
+                Random random = caseRandom(seed, batch);
+                for (; current < end && !test.stopToken().stop_requested(); ++current) {
+                    test.begin_case(current);
+                    Values values = generate(random);
+                    std::apply([&](auto&... value) { f_(test, value...); }, values);
+                    if (test.failed_cases() != 0) {
+                        failed = current;
+                        return;
+                    }
+                }
+            };
+            ActualTest<decltype(body)> test(name_, std::move(body));
+            TestResult result;
+            test.run(result, options(), stopToken());
+            if (!result.cacheable) {
+                cacheable.store(false, std::memory_order_relaxed);
+            }
+            if (!result.passed && failed == options_.cases) {
+                // exception was thrown
+                failed = current;
+            }
+            return failed;
+        }
+
+        // Recreates inputs of a case from its random stream
+        Values caseValues(uint64_t seed, size_t index) const {
+            const size_t batch = index / options_.batch_size;
+            Random random = caseRandom(seed, batch);
+            for (size_t i = batch * options_.batch_size; i < index; ++i) {
+                generate(random);
+            }
+            return generate(random);
+        }
+
+        // Returns true if the property holds for `values`, output goes to `output`
+        bool holds(const Values& values, std::string* output = nullptr) {
+            auto call = [&](auto& test) {
+                Values copy = values;
+                std::apply([&](auto&... value) { f_(test, value...); }, copy);
+            };
+            ActualTest<decltype(call)> test(name_, std::move(call));
+            TestResult result;
+            test.run(result, options(), stopToken());
+            if (!result.cacheable) {
+                markUncacheable();
+            }
+            if (output != nullptr) {
+                *output = std::move(result.output);
+            }
+            return result.passed;
+        }
+
+        // Shrinks one argument at a time, keeps the first candidate that still fails
+        template<size_t Index>
+        bool shrinkArgument(Values& values) {
+            const auto& generator = std::get<Index>(generators_);
+            for (auto& candidate : generator.shrink(std::get<Index>(values))) {
+                Values simpler = values;
+                std::get<Index>(simpler) = std::move(candidate);
+                if (!holds(simpler)) {
+                    values = std::move(simpler);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        template<size_t... Indices>
+        bool shrinkStep(Values& values, std::index_sequence<Indices...>) {
+            return (shrinkArgument<Indices>(values) || ...);
+        }
+
+        TINY_TEST__COLD void reportCounterexample(uint64_t seed, size_t index) {
+            const Values original = caseValues(seed, index);
+            Values values = original;
+            size_t steps = 0;
+            while (steps < options_.max_shrink_steps && shrinkStep(values, std::index_sequence_for<Generators...>{})) {
+                ++steps;
+            }
+            std::string output;
+            holds(values, &output);
+            out() << "property failed on case " << index << " of " << options_.cases << " (seed " << seed << ")\n"
+                << "counterexample: ";
+            detail::describe_value(out(), values);
+            out() << '\n';
+            if (steps != 0) {
+                out() << "shrunk in " << steps << " steps from: ";
+                detail::describe_value(out(), original);
+                out() << '\n';
+            }
+            out() << output;
+        }
+
+        PropertyOptions options_;
+        Functor f_;
+        std::tuple<Generators...> generators_;
+    };
+
+    template<template<typename> typename ActualTest, typename Functor, typename... Generators>
+    std::unique_ptr<PropertyTest<ActualTest, Functor, Generators...>> make_property_test(
+            std::string name,
+            PropertyOptions options,
+            Functor f,
+            Generators... generators) {
+        return std::make_unique<PropertyTest<ActualTest, Functor, Generators...>>(
+            std::move(name), options, std::move(f), std::move(generators)...);
+    }
+
+    template<template<typename> typename ActualTest, typename Functor, typename... Generators>
+    requires (!std::is_same_v<std::remove_cvref_t<Functor>, PropertyOptions>)
+    std::unique_ptr<PropertyTest<ActualTest, Functor, Generators...>> make_property_test(
+            std::string name,
+            Functor f,
+            Generators... generators) {
+        return make_property_test<ActualTest>(std::move(name), PropertyOptions{}, std::move(f), std::move(generators)...);
+    }
+
+    namespace detail {
+        // Functor of the underlying test, calls the variant selected by `current`
+        template<typename... Variants>
+        struct ComparisonVariants {
+            std::tuple<Variants...> variants;
+            const size_t* current;
+
+            template<typename... Args>
+            auto operator()(Args&... args) {
+                return call(std::index_sequence_for<Variants...>{}, args...);
+            }
+
+        private:
+            template<size_t... Indices, typename... Args>
+            auto call(std::index_sequence<Indices...>, Args&... args) {
+                using Result = decltype(std::get<0>(variants)(args...));
+                if constexpr (std::is_void_v<Result>) {
+                    (void)((*current == Indices ? (std::get<Indices>(variants)(args...), true) : false) || ...);
+                } else {
+                    Result result{};
+                    (void)((*current == Indices ? (result = std::get<Indices>(variants)(args...), true) : false) || ...);
+                    return result;
+                }
+            }
+        };
+
+        // Index of the variant to run, a base initialized before the underlying test
+        struct VariantSelector {
+            size_t current_variant = 0;
+        };
+    }
+
+    // Ratio of median times of two variants with a 95% bootstrap confidence interval
+    struct Speedup {
+        double ratio = 0;
+        double low = 0;
+        double high = 0;
+    };
+
+    // Compares variants of the same code: functors are run as the body of the underlying
+    // test (e.g. PrettyTest) in rounds, every round runs a batch of each variant in random
+    // order with the thread pinned to its CPU, so that drift and noise affect all variants
+    // alike. Reports speedups against the first variant, `require_speedup` turns them into checks.
+    // Wrap it in `serial` to keep other tests from disturbing it
+    template<template<typename> typename ActualTest, typename... Variants>
+    struct ComparisonTest : detail::VariantSelector, ActualTest<detail::ComparisonVariants<Variants...>> {
+        using Parent = ActualTest<detail::ComparisonVariants<Variants...>>;
+        static constexpr size_t variant_count = sizeof...(Variants);
+        static constexpr size_t bootstrap_resamples = 2000;
+
+        ComparisonTest(std::string name, BenchmarkOptions options, Variants... variants)
+            : Parent(std::move(name), detail::ComparisonVariants<Variants...>{{std::move(variants)...}, &current_variant})
+            , options_(options) {}
+
+        // Fails unless variant `faster` is at least `ratio` times faster than variant `than`
+        // with 95% confidence, variants are numbered from zero in the order they are given
+        void requireSpeedup(size_t faster, size_t than, double ratio) {
+            requirements_.push_back({faster, than, ratio});
+        }
+
+        bool timingSensitive() const override {
+            return true;
+        }
+
+        bool doTest() override {
+            using Clock = std::chrono::steady_clock;
+            bool passed = true;
+            auto run_batch = [&](size_t variant, size_t iterations) {
+                current_variant = variant;
+                auto start = Clock::now();
+                for (size_t i = 0; i < iterations; ++i) {
+                    passed &= Parent::doTest();
+                }
+                return Clock::now() - start;
+            };
+
+            // variants are compared on one CPU. With `RunOptions::timing_cpus` the test is already
+            // pinned by `Test::run`, or left unpinned when all timing CPUs are taken by other tests
+            std::optional<detail::CpuPin> pin;
+            if (this->options() == nullptr || this->options()->timing_cpus.empty()) {
+                pin.emplace();
+            }
+            const size_t rounds = std::max<size_t>(options_.samples, 1);
+            const auto batch_time = options_.target_time / (rounds * variant_count);
+            size_t iterations[variant_count];
+            for (size_t variant = 0; variant < variant_count && passed; ++variant) {
+                run_batch(variant, options_.warmup_iterations);
+                iterations[variant] = detail::calibrate_iterations([&](size_t count) {
+                    return run_batch(variant, count);
+                }, batch_time, passed);
+            }
+            if (!passed) {
+                return false;
+            }
+
+            const uint64_t seed = this->options() != nullptr && this->options()->seed != 0
+                ? this->options()->seed
+                : detail::stable_hash(this->name_);
+            Random random(seed);
+            // samples[variant][round] is time per iteration
+            std::vector<std::vector<double>> samples(variant_count);
+            size_t order[variant_count];
+            for (size_t variant = 0; variant < variant_count; ++variant) {
+                order[variant] = variant;
+                samples[variant].reserve(rounds);
+            }
+            for (size_t round = 0; round < rounds && passed; ++round) {
+                for (size_t i = variant_count; i > 1; --i) {
+                    std::swap(order[i - 1], order[random.below(i)]);
+                }
+                for (size_t variant : order) {
+                    const auto elapsed = run_batch(variant, iterations[variant]);
+                    samples[variant].push_back(std::chrono::duration<double, std::nano>(elapsed).count() / double(iterations[variant]));
+                }
+            }
+            if (!passed) {
+                return false;
+            }
+
+            this->out() << "comparison: " << rounds << " rounds in random order";
+            if (pin && pin->cpu() >= 0) {
+                this->out() << ", pinned to cpu " << pin->cpu();
+            }
+            this->out() << '\n';
+            for (size_t variant = 0; variant < variant_count; ++variant) {
+                std::vector<double> sorted = samples[variant];
+                const BenchmarkStats stats = detail::compute_stats(sorted, iterations[variant]);
+                this->out() << variantName(variant) << ": median " << detail::format_duration(stats.median)
+                    << ", min " << detail::format_duration(stats.min)
+                    << ", stddev " << detail::format_duration(stats.stddev) << " per iteration";
+                if (variant != 0) {
+                    this->out() << ", ";
+                    printSpeedup(speedup(samples, variant, 0, random), "A");
+                }
+                this->out() << '\n';
+            }
+
+            for (const auto& requirement : requirements_) {
+                if (requirement.faster >= variant_count || requirement.than >= variant_count) {
+                    this->out() << "speedup is required for a variant that does not exist\n";
+                    passed = false;
+                    continue;
+                }
+                const Speedup result = speedup(samples, requirement.faster, requirement.than, random);
+                if (result.low < requirement.ratio) {
+                    this->out() << "SLOWER than required: " << variantName(requirement.faster) << " is ";
+                    printSpeedup(result, variantName(requirement.than));
+                    this->out() << ", required at least " << std::setprecision(3) << requirement.ratio << "x\n";
+                    passed = false;
+                }
+            }
+            return passed;
+        }
+
+    private:
+        struct Requirement {
+            size_t faster;
+            size_t than;
+            double ratio;
+        };
+
+        static std::string variantName(size_t variant) {
+            return std::string(1, char('A' + variant % 26)) + (variant >= 26 ? std::to_string(variant / 26) : "");
+        }
+
+        void printSpeedup(const Speedup& result, std::string_view than) {
+            this->out() << std::fixed << std::setprecision(2) << result.ratio << "x faster than " << than
+                << " (95% CI " << result.low << "x - " << result.high << "x)" << std::defaultfloat;
+        }
+
+        // Bootstrap over rounds: pairs of samples from the same round stay together
+        static Speedup speedup(const std::vector<std::vector<double>>& samples, size_t faster, size_t than, Random& random) {
+            const size_t rounds = samples[faster].size();
+            auto ratio = [&](auto&& pick) {
+                std::vector<double> fast;
+                std::vector<double> slow;
+                for (size_t i = 0; i < rounds; ++i) {
+                    const size_t round = pick(i);
+                    fast.push_back(samples[faster][round]);
+                    slow.push_back(samples[than][round]);
+                }
+                const double fast_median = detail::compute_stats(fast, 1).median;
+                return fast_median > 0 ? detail::compute_stats(slow, 1).median / fast_median : 0.0;
+            };
+            Speedup result;
+            result.ratio = ratio([](size_t i) { return i; });
+            std::vector<double> resampled;
+            resampled.reserve(bootstrap_resamples);
+            for (size_t i = 0; i < bootstrap_resamples; ++i) {
+                resampled.push_back(ratio([&](size_t) { return size_t(random.below(rounds)); }));
+            }
+            std::sort(resampled.begin(), resampled.end());
+            result.low = resampled[size_t(0.025 * double(bootstrap_resamples))];
+            result.high = resampled[size_t(0.975 * double(bootstrap_resamples)) - 1];
+            return result;
+        }
+
+        BenchmarkOptions options_;
+        std::vector<Requirement> requirements_;
+    };
+
+    // Helper functions for unique_ptr creation of ComparisonTest from Simple and Pretty tests, e.g.
+    // make_comparison<PrettyTest>("push_back", [](auto& test) { ... }, [](auto& test) { ... })
+    template<template<typename> typename ActualTest, typename... Variants>
+    requires (sizeof...(Variants) >= 2)
+    auto make_comparison(std::string name, BenchmarkOptions options, Variants... variants) {
+        return std::make_unique<ComparisonTest<ActualTest, Variants...>>(std::move(name), options, std::move(variants)...);
+    }
+
+    template<template<typename> typename ActualTest, typename First, typename... Variants>
+    requires (sizeof...(Variants) >= 1 && !std::is_same_v<std::remove_cvref_t<First>, BenchmarkOptions>)
+    auto make_comparison(std::string name, First first, Variants... variants) {
+        return make_comparison<ActualTest>(std::move(name), BenchmarkOptions{}, std::move(first), std::move(variants)...);
+    }
+
+    // Requires variant `faster` of a comparison to be at least `ratio` times faster
+    // than variant `than` (lower bound of the 95% confidence interval), e.g.
+    // require_speedup(make_comparison<PrettyTest>("name", a, b), 1, 0, 1.5)
+    template<typename ActualTest>
+    std::unique_ptr<ActualTest> require_speedup(std::unique_ptr<ActualTest> test, size_t faster, size_t than, double ratio) {
+        test->requireSpeedup(faster, than, ratio);
+        return test;
+    }
+
+    template<typename T = void>
+    class Task;
+
+    namespace detail {
+        struct TaskPromiseBase {
+            // resumed when the task finishes, null for tasks started by `EventLoop::spawn`
+            std::coroutine_handle<> continuation;
+            std::exception_ptr error;
+
+            struct FinalAwaiter {
+                bool await_ready() noexcept {
+                    return false;
+                }
+
+                template<typename Promise>
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+                    const auto continuation = handle.promise().continuation;
+                    return continuation ? continuation : std::noop_coroutine();
+                }
+
+                void await_resume() noexcept {}
+            };
+
+            std::suspend_always initial_suspend() noexcept {
+                return {};
+            }
+
+            FinalAwaiter final_suspend() noexcept {
+                return {};
+            }
+
+            void unhandled_exception() {
+                error = std::current_exception();
+            }
+        };
+
+        template<typename T>
+        struct TaskPromise : TaskPromiseBase {
+            std::optional<T> value;
+
+            Task<T> get_return_object();
+
+            template<typename Value>
+            void return_value(Value&& result) {
+                value.emplace(std::forward<Value>(result));
+            }
+
+            T result() {
+                if (error) {
+                    std::rethrow_exception(error);
+                }
+                return std::move(*value);
+            }
+        };
+
+        template<>
+        struct TaskPromise<void> : TaskPromiseBase {
+            Task<void> get_return_object();
+
+            void return_void() {}
+
+            void result() {
+                if (error) {
+                    std::rethrow_exception(error);
+                }
+            }
+        };
+    }
+
+    // Lazily started coroutine: its body starts when it is awaited or given to
+    // `EventLoop::spawn`. Destroying a task destroys the coroutine frame together
+    // with all tasks it awaits, which is how stuck tasks are cancelled
+    template<typename T>
+    class [[nodiscard]] Task {
+    public:
+        using promise_type = detail::TaskPromise<T>;
+        using Handle = std::coroutine_handle<promise_type>;
+
+        Task(Task&& other) noexcept
+        : handle_(std::exchange(other.handle_, {})) {}
+
+        Task& operator=(Task&& other) noexcept {
+            if (this != &other) {
+                if (handle_) {
+                    handle_.destroy();
+                }
+                handle_ = std::exchange(other.handle_, {});
+            }
+            return *this;
+        }
+
+        ~Task() {
+            if (handle_) {
+                handle_.destroy();
+            }
+        }
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+            handle_.promise().continuation = awaiting;
+            return handle_;
+        }
+
+        T await_resume() {
+            return handle_.promise().result();
+        }
+
+        Handle handle() const {
+            return handle_;
+        }
+
+    private:
+        friend promise_type;
+
+        explicit Task(Handle handle)
+        : handle_(handle) {}
+
+        Handle handle_;
+    };
+
+    namespace detail {
+        template<typename T>
+        Task<T> TaskPromise<T>::get_return_object() {
+            return Task<T>(Task<T>::Handle::from_promise(*this));
+        }
+
+        inline Task<void> TaskPromise<void>::get_return_object() {
+            return Task<void>(Task<void>::Handle::from_promise(*this));
+        }
+
+        inline EventLoop*& current_event_loop() {
+            static thread_local EventLoop* loop = nullptr;
+            return loop;
+        }
+    }
+
+    // Single-threaded scheduler of tasks: many of them are run interleaved, each one
+    // until it awaits a timer (`sleep_for`), another iteration (`yield`) or, on POSIX,
+    // a file descriptor (`readable`, `writable`). Wake-ups of cancelled tasks are dropped
+    class EventLoop {
+    public:
+        using Clock = std::chrono::steady_clock;
+        // Called once the task ends: with its exception, if any, or with
+        // `timed_out` set if the deadline has passed and the task was destroyed
+        using Callback = std::function<void(std::exception_ptr error, bool timed_out)>;
+
+        EventLoop() = default;
+        EventLoop(const EventLoop&) = delete;
+
+        // Loop `run` is executing on this thread, null outside of tasks
+        static EventLoop* current() {
+            return detail::current_event_loop();
+        }
+
+        // Starts `task` on the next iteration of `run`
+        void spawn(Task<> task, Clock::time_point deadline, Callback done) {
+            const uint64_t id = ++last_id_;
+            ready_.push_back({task.handle(), id});
+            if (deadline != Clock::time_point::max()) {
+                timers_.emplace(deadline, Entry{nullptr, id});
+            }
+            tasks_.emplace(id, Spawned{std::move(task), std::move(done)});
+        }
+
+        // Runs until all spawned tasks end. Tasks waiting for nothing
+        // that could wake them up are failed
+        void run() {
+            EventLoop* const previous = std::exchange(detail::current_event_loop(), this);
+            while (!tasks_.empty()) {
+                while (!ready_.empty()) {
+                    const Entry entry = ready_.front();
+                    ready_.pop_front();
+                    resume(entry);
+                }
+                if (!tasks_.empty()) {
+                    wait();
+                }
+            }
+            detail::current_event_loop() = previous;
+        }
+
+        // Wake-ups for the task that is running now
+        void schedule(std::coroutine_handle<> handle) {
+            ready_.push_back({handle, running_});
+        }
+
+        void scheduleAt(Clock::time_point time, std::coroutine_handle<> handle) {
+            timers_.emplace(time, Entry{handle, running_});
+        }
+
+#if TINY_TEST__HAS_POLL
+        void scheduleIo(int fd, short events, std::coroutine_handle<> handle) {
+            io_.push_back({fd, events, {handle, running_}});
+        }
+#endif
+
+    private:
+        struct Entry {
+            // null for a deadline of the task
+            std::coroutine_handle<> handle;
+            uint64_t task;
+        };
+
+        struct Spawned {
+            Task<> task;
+            Callback done;
+        };
+
+#if TINY_TEST__HAS_POLL
+        struct IoWait {
+            int fd;
+            short events;
+            Entry entry;
+        };
+#endif
+
+        void resume(const Entry& entry) {
+            const auto it = tasks_.find(entry.task);
+            if (it == tasks_.end()) {
+                return;
+            }
+            running_ = entry.task;
+            entry.handle.resume();
+            running_ = 0;
+            const auto root = it->second.task.handle();
+            if (root.done()) {
+                finish(it, root.promise().error, false);
+            }
+        }
+
+        void finish(std::map<uint64_t, Spawned>::iterator it, std::exception_ptr error, bool timed_out) {
+            Callback done = std::move(it->second.done);
+            tasks_.erase(it);
+            done(std::move(error), timed_out);
+        }
+
+        // Sleeps until the nearest timer or descriptor event, then makes woken tasks ready
+        void wait() {
+            while (!timers_.empty() && !tasks_.contains(timers_.begin()->second.task)) {
+                timers_.erase(timers_.begin());
+            }
+            const auto next = timers_.empty() ? Clock::time_point::max() : timers_.begin()->first;
+#if TINY_TEST__HAS_POLL
+            std::erase_if(io_, [&](const IoWait& wait) {
+                return !tasks_.contains(wait.entry.task);
+            });
+            if (!io_.empty()) {
+                std::vector<pollfd> fds;
+                for (const auto& wait : io_) {
+                    fds.push_back({wait.fd, wait.events, 0});
+                }
+                int timeout = -1;
+                if (next != Clock::time_point::max()) {
+                    const auto left = std::chrono::ceil<std::chrono::milliseconds>(next - Clock::now());
+                    timeout = int(std::clamp<int64_t>(left.count(), 0, std::numeric_limits<int>::max()));
+                }
+                if (::poll(fds.data(), nfds_t(fds.size()), timeout) > 0) {
+                    size_t kept = 0;
+                    for (size_t i = 0; i < io_.size(); ++i) {
+                        if (fds[i].revents != 0) {
+                            ready_.push_back(io_[i].entry);
+                        } else {
+                            io_[kept++] = io_[i];
+                        }
+                    }
+                    io_.resize(kept);
+                }
+            } else
+#endif
+            if (next != Clock::time_point::max()) {
+                std::this_thread::sleep_until(next);
+            } else {
+                while (!tasks_.empty()) {
+                    finish(tasks_.begin(), std::make_exception_ptr(std::logic_error("task is suspended and nothing can resume it")), false);
+                }
+                return;
+            }
+
+            const auto now = Clock::now();
+            while (!timers_.empty() && timers_.begin()->first <= now) {
+                const Entry entry = timers_.begin()->second;
+                timers_.erase(timers_.begin());
+                if (entry.handle) {
+                    ready_.push_back(entry);
+                } else if (const auto it = tasks_.find(entry.task); it != tasks_.end()) {
+                    finish(it, nullptr, true);
+                }
+            }
+        }
+
+        std::map<uint64_t, Spawned> tasks_;
+        std::deque<Entry> ready_;
+        std::multimap<Clock::time_point, Entry> timers_;
+#if TINY_TEST__HAS_POLL
+        std::vector<IoWait> io_;
+#endif
+        uint64_t last_id_ = 0;
+        uint64_t running_ = 0;
+    };
+
+    namespace detail {
+        inline EventLoop& awaited_loop() {
+            EventLoop* loop = EventLoop::current();
+            if (loop == nullptr) {
+                throw std::logic_error("awaited outside of a task run by testing::EventLoop");
+            }
+            return *loop;
+        }
+
+        struct TimerAwaiter {
+            EventLoop::Clock::time_point time;
+
+            bool await_ready() const noexcept {
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<> handle) const {
+                awaited_loop().scheduleAt(time, handle);
+            }
+
+            void await_resume() const noexcept {}
+        };
+
+        struct YieldAwaiter {
+            bool await_ready() const noexcept {
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<> handle) const {
+                awaited_loop().schedule(handle);
+            }
+
+            void await_resume() const noexcept {}
+        };
+
+#if TINY_TEST__HAS_POLL
+        struct IoAwaiter {
+            int fd;
+            short events;
+
+            bool await_ready() const noexcept {
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<> handle) const {
+                awaited_loop().scheduleIo(fd, events, handle);
+            }
+
+            void await_resume() const noexcept {}
+        };
+#endif
+    }
+
+    // `co_await testing::sleep_for(10ms)` suspends the task, other tasks keep running
+    inline detail::TimerAwaiter sleep_for(std::chrono::nanoseconds duration) {
+        return {EventLoop::Clock::now() + std::chrono::duration_cast<EventLoop::Clock::duration>(duration)};
+    }
+
+    inline detail::TimerAwaiter sleep_until(EventLoop::Clock::time_point time) {
+        return {time};
+    }
+
+    // Lets other ready tasks run before the calling one continues
+    inline detail::YieldAwaiter yield() {
+        return {};
+    }
+
+#if TINY_TEST__HAS_POLL
+    // Suspends the task until `fd` can be read without blocking (or is closed)
+    inline detail::IoAwaiter readable(int fd) {
+        return {fd, POLLIN};
+    }
+
+    inline detail::IoAwaiter writable(int fd) {
+        return {fd, POLLOUT};
+    }
+#endif
+
+    // Test which body is a coroutine: functor accepts AsyncTest& and returns `Task<>`,
+    // checks are the same as in PrettyTest. Tests of a group are run interleaved on one
+    // `EventLoop` per worker thread, so tests waiting for timers or I/O do not occupy
+    // threads. If the deadline passes, the test fails and its coroutine is destroyed.
+    // Run interleaved, tests report no allocations or counters, they would include other tests
+    template<typename Functor>
+    class AsyncTest: public Checker {
+    public:
+        AsyncTest(const AsyncTest&) = delete;
+        AsyncTest(AsyncTest&&) = delete;
+
+        // Zero deadline means `RunOptions::timeout`, no deadline if it is zero too
+        AsyncTest(std::string name, Functor f, std::chrono::nanoseconds deadline = {})
+        : Checker(std::move(name))
+        , f_(std::move(f))
+        , deadline_(deadline) {}
+
+        bool doTest() override {
+            EventLoop loop;
+            bool passed = false;
+            start(loop, options(), [&](bool result) {
+                passed = result;
+            });
+            loop.run();
+            return passed;
+        }
+
+        bool isAsync() const override {
+            return true;
+        }
+
+        void startAsync(EventLoop& loop, TestResult& result, const RunOptions* options, std::function<void()> done) override {
+            beginRun(result, options);
+            const auto started = std::chrono::steady_clock::now();
+            start(loop, options, [this, &result, started, done = std::move(done)](bool passed) {
+                result.duration = std::chrono::steady_clock::now() - started;
+                result.counters = {};
+                result.allocations = {};
+                endRun(result, passed);
+                done();
+            });
+        }
+
+        std::chrono::nanoseconds timeLimit(const RunOptions& options) const override {
+            return deadline_ != std::chrono::nanoseconds::zero() ? deadline_ : std::chrono::nanoseconds(options.timeout);
+        }
+
+    private:
+        template<typename Done>
+        void start(EventLoop& loop, const RunOptions* options, Done done) {
+            startChecks();
+            const auto limit = timeLimit(options != nullptr ? *options : RunOptions{});
+            const auto deadline = limit > std::chrono::nanoseconds::zero()
+                ? EventLoop::Clock::now() + limit
+                : EventLoop::Clock::time_point::max();
+            loop.spawn(f_(*this), deadline, [this, limit, done = std::move(done)](std::exception_ptr error, bool timed_out) {
+                if (!error && !timed_out) {
+                    done(finishChecks());
+                    return;
+                }
+                abortChecks();
+                if (error) {
+                    reportException(error);
+                } else {
+                    out() << "TIMED OUT after " << detail::format_duration(double(limit.count())) << ", coroutine was destroyed\n";
+                }
+                done(false);
+            });
+        }
+
+        Functor f_;
+        std::chrono::nanoseconds deadline_;
+    };
+
+    // Helper function for unique_ptr creation of AsyncTest, e.g.
+    // make_async_test(1s, "name", [](auto& test) -> testing::Task<> { co_await testing::sleep_for(1ms); });
+    template<typename Functor>
+    std::unique_ptr<AsyncTest<Functor>> make_async_test(std::string name, Functor f) {
+        return std::make_unique<AsyncTest<Functor>>(std::move(name), std::move(f));
+    }
+
+    template<typename Functor>
+    std::unique_ptr<AsyncTest<Functor>> make_async_test(std::chrono::nanoseconds deadline, std::string name, Functor f) {
+        return std::make_unique<AsyncTest<Functor>>(std::move(name), std::move(f), deadline);
+    }
+
+    namespace detail {
+        // Tests of one group in declaration order
+        struct GroupTests {
+            std::string_view name;
+            std::span<const std::unique_ptr<Test>> tests;
+        };
+    }
+
+#if TINY_TEST__RUNNER
+    // Durations of tests measured in previous runs, kept in a compact binary file:
+    // a header followed by (hash of "group/name", nanoseconds) pairs
+    class DurationHistory {
+    public:
+        DurationHistory(const DurationHistory&) = delete;
+
+        explicit DurationHistory(std::string path)
+        : path_(std::move(path)) {
+            load();
+        }
+
+        // Missing file is treated as empty history
+        bool load() {
+            std::ifstream file(path_, std::ios::binary);
+            if (!file) {
+                return false;
+            }
+            char magic[sizeof(file_magic)] = {};
+            uint64_t count = 0;
+            file.read(magic, sizeof(magic));
+            file.read(reinterpret_cast<char*>(&count), sizeof(count));
+            if (!file || std::string_view(magic, sizeof(magic)) != std::string_view(file_magic, sizeof(file_magic))) {
+                return false;
+            }
+            std::vector<Record> records(count);
+            file.read(reinterpret_cast<char*>(records.data()), std::streamsize(count * sizeof(Record)));
+            if (!file) {
+                return false;
+            }
+            std::lock_guard lock(mutex_);
+            for (const auto& record : records) {
+                durations_[record.hash] = record.nanoseconds;
+            }
+            return true;
+        }
+
+        bool save() const {
+            std::lock_guard lock(mutex_);
+            std::ofstream file(path_, std::ios::binary | std::ios::trunc);
+            const uint64_t count = durations_.size();
+            file.write(file_magic, sizeof(file_magic));
+            file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+            for (const auto& [hash, nanoseconds] : durations_) {
+                const Record record{hash, nanoseconds};
+                file.write(reinterpret_cast<const char*>(&record), sizeof(record));
+            }
+            return bool(file);
+        }
+
+        // Averaged with the previous value to smooth out noise
+        void record(uint64_t key_hash, std::chrono::nanoseconds duration) {
+            std::lock_guard lock(mutex_);
+            const uint64_t nanoseconds = uint64_t(std::max<int64_t>(duration.count(), 0));
+            auto [it, inserted] = durations_.try_emplace(key_hash, nanoseconds);
+            if (!inserted) {
+                it->second = (it->second + nanoseconds) / 2;
+            }
+        }
+
+        std::optional<std::chrono::nanoseconds> find(uint64_t key_hash) const {
+            std::lock_guard lock(mutex_);
+            auto it = durations_.find(key_hash);
+            if (it == durations_.end()) {
+                return std::nullopt;
+            }
+            return std::chrono::nanoseconds(it->second);
+        }
+
+        // Expected durations of given tests, tests without history get the mean of known ones
+        std::vector<double> expected(std::span<const uint64_t> key_hashes) const {
+            std::vector<double> result(key_hashes.size(), -1);
+            double known = 0;
+            size_t known_count = 0;
+            for (size_t i = 0; i < key_hashes.size(); ++i) {
+                if (auto duration = find(key_hashes[i])) {
+                    result[i] = double(duration->count());
+                    known += result[i];
+                    ++known_count;
+                }
+            }
+            const double fallback = known_count != 0 ? known / double(known_count) : 0;
+            for (double& duration : result) {
+                if (duration < 0) {
+                    duration = fallback;
+                }
+            }
+            return result;
+        }
+
+    private:
+        static constexpr char file_magic[8] = {'T', 'T', 'D', 'U', 'R', '0', '0', '1'};
+
+        struct Record {
+            uint64_t hash;
+            uint64_t nanoseconds;
+        };
+
+        std::string path_;
+        mutable std::mutex mutex_;
+        std::map<uint64_t, uint64_t> durations_;
+    };
+
+    namespace detail {
+        // Fast non-cryptographic hash of file contents, 8 bytes per step
+        inline uint64_t content_hash(std::span<const std::byte> data, uint64_t hash = 0x243f6a8885a308d3ull) {
+            auto mix = [&](uint64_t word) {
+                hash = (hash ^ word) * 0x9e3779b97f4a7c15ull;
+                hash ^= hash >> 29;
+            };
+            size_t i = 0;
+            for (; i + 8 <= data.size(); i += 8) {
+                uint64_t word;
+                std::memcpy(&word, data.data() + i, 8);
+                mix(word);
+            }
+            uint64_t tail = 0;
+            if (i != data.size()) {
+                std::memcpy(&tail, data.data() + i, data.size() - i);
+            }
+            mix(tail ^ (uint64_t(data.size()) << 56));
+            return hash;
+        }
+    }
+
+    // Results of previous runs, kept in a compact binary file of
+    // (hash of "group/name", hash of inputs, passed) records.
+    // Inputs of a test are the running executable, the files it declares (see `depends_on`)
+    // and run options that can change its outcome: the seed, isolation, timeouts, timing CPUs
+    // and the snapshot directory. A test is skipped if it passed last time with the same inputs
+    class ResultCache {
+    public:
+        ResultCache(const ResultCache&) = delete;
+
+        explicit ResultCache(std::string path)
+        : path_(std::move(path)) {
+            load();
+        }
+
+        // Missing file is treated as empty cache
+        bool load() {
+            std::ifstream file(path_, std::ios::binary);
+            if (!file) {
+                return false;
+            }
+            char magic[sizeof(file_magic)] = {};
+            uint64_t count = 0;
+            file.read(magic, sizeof(magic));
+            file.read(reinterpret_cast<char*>(&count), sizeof(count));
+            if (!file || std::string_view(magic, sizeof(magic)) != std::string_view(file_magic, sizeof(file_magic))) {
+                return false;
+            }
+            std::vector<Record> records(count);
+            file.read(reinterpret_cast<char*>(records.data()), std::streamsize(count * sizeof(Record)));
+            if (!file) {
+                return false;
+            }
+            std::lock_guard lock(mutex_);
+            for (const auto& record : records) {
+                results_[record.key] = {record.inputs, record.passed != 0};
+            }
+            return true;
+        }
+
+        bool save() const {
+            std::lock_guard lock(mutex_);
+            std::ofstream file(path_, std::ios::binary | std::ios::trunc);
+            const uint64_t count = results_.size();
+            file.write(file_magic, sizeof(file_magic));
+            file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+            for (const auto& [key, result] : results_) {
+                const Record record{key, result.inputs, uint64_t(result.passed)};
+                file.write(reinterpret_cast<const char*>(&record), sizeof(record));
+            }
+            return bool(file);
+        }
+
+        // Hash of everything the test depends on, including options that can change its
+        // outcome, nullopt if the executable cannot be read and caching is impossible
+        std::optional<uint64_t> inputs(const Test& test, uint64_t key_hash, const RunOptions& options) {
+            const auto executable = executableHash();
+            if (!executable) {
+                return std::nullopt;
+            }
+            uint64_t hash = *executable ^ key_hash;
+            for (const auto& path : test.dependencies()) {
+                hash = (hash ^ fileHash(path)) * 0x100000001b3ull;
+            }
+            return hash ^ optionsHash(options);
+        }
+
+        bool passed(uint64_t key_hash, uint64_t inputs) const {
+            std::lock_guard lock(mutex_);
+            auto it = results_.find(key_hash);
+            return it != results_.end() && it->second.passed && it->second.inputs == inputs;
+        }
+
+        void record(uint64_t key_hash, uint64_t inputs, bool passed) {
+            std::lock_guard lock(mutex_);
+            results_[key_hash] = {inputs, passed};
+        }
+
+    private:
+        static constexpr char file_magic[8] = {'T', 'T', 'C', 'A', 'C', 'H', '0', '1'};
+
+        // Zero seed means one derived from the test name, which is already a part of the key
+        static uint64_t optionsHash(const RunOptions& options) {
+            uint64_t hash = detail::stable_hash(options.snapshots);
+            auto add = [&](uint64_t value) {
+                hash = (hash ^ value) * 0x100000001b3ull;
+            };
+            add(options.seed);
+            add(uint64_t(options.isolation));
+            add(uint64_t(options.timeout.count()));
+            add(uint64_t(options.timeout_grace.count()));
+            for (int cpu : options.timing_cpus) {
+                add(uint64_t(cpu));
+            }
+            return hash;
+        }
+
+        struct Record {
+            uint64_t key;
+            uint64_t inputs;
+            uint64_t passed;
+        };
+
+        struct Result {
+            uint64_t inputs;
+            bool passed;
+        };
+
+        std::optional<uint64_t> executableHash() {
+            std::lock_guard lock(mutex_);
+            if (!executable_hashed_) {
+                executable_hashed_ = true;
+#if defined(__linux__)
+                const MappedFile file("/proc/self/exe");
+                if (file.error().empty()) {
+                    executable_hash_ = detail::content_hash({file.data(), file.size()});
+                }
+#endif
+            }
+            return executable_hash_;
+        }
+
+        // Missing files get a hash of their own, so creating them invalidates results
+        uint64_t fileHash(const std::string& path) {
+            std::lock_guard lock(mutex_);
+            auto [it, inserted] = file_hashes_.try_emplace(path, 0);
+            if (inserted) {
+                const MappedFile file(path);
+                it->second = file.error().empty()
+                    ? detail::content_hash({file.data(), file.size()})
+                    : detail::stable_hash(path);
+            }
+            return it->second;
+        }
+
+        std::string path_;
+        mutable std::mutex mutex_;
+        std::map<uint64_t, Result> results_;
+        bool executable_hashed_ = false;
+        std::optional<uint64_t> executable_hash_;
+        std::map<std::string, uint64_t> file_hashes_;
+    };
+
+    // Histogram of durations with fixed memory and about 3% precision: every power
+    // of two range is split into 32 equal buckets, as in HDR histograms.
+    // Recording is lock-free and may be done from several threads
+    class LatencyHistogram {
+    public:
+        static constexpr size_t sub_bucket_bits = 5;
+        static constexpr size_t sub_buckets = size_t(1) << sub_bucket_bits;
+        static constexpr size_t bucket_count = sub_buckets * (64 - sub_bucket_bits + 1);
+
+        void record(std::chrono::nanoseconds duration) {
+            const uint64_t value = uint64_t(std::max<int64_t>(duration.count(), 0));
+            buckets_[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+            count_.fetch_add(1, std::memory_order_relaxed);
+            uint64_t max = max_.load(std::memory_order_relaxed);
+            while (value > max && !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {}
+        }
+
+        uint64_t count() const {
+            return count_.load(std::memory_order_relaxed);
+        }
+
+        std::chrono::nanoseconds max() const {
+            return std::chrono::nanoseconds(max_.load(std::memory_order_relaxed));
+        }
+
+        // Smallest recorded duration not exceeded by `quantile` of all durations
+        // (rounded up to the bucket end), e.g. `percentile(0.99)`
+        std::chrono::nanoseconds percentile(double quantile) const {
+            const uint64_t total = count();
+            if (total == 0) {
+                return {};
+            }
+            const uint64_t rank = std::max<uint64_t>(uint64_t(std::ceil(quantile * double(total))), 1);
+            uint64_t seen = 0;
+            for (size_t i = 0; i < bucket_count; ++i) {
+                seen += buckets_[i].load(std::memory_order_relaxed);
+                if (seen >= rank) {
+                    return std::min(std::chrono::nanoseconds(upperBound(i)), max());
+                }
+            }
+            return max();
+        }
+
+        // Prints counts of durations by power of two ranges, one line per non-empty range
+        void print(std::ostream& stream) const {
+            uint64_t rows[64 - sub_bucket_bits + 1] = {};
+            uint64_t largest = 0;
+            for (size_t i = 0; i < bucket_count; ++i) {
+                rows[i / sub_buckets] += buckets_[i].load(std::memory_order_relaxed);
+            }
+            for (uint64_t row : rows) {
+                largest = std::max(largest, row);
+            }
+            for (size_t row = 0; row < std::size(rows); ++row) {
+                if (rows[row] == 0) {
+                    continue;
+                }
+                const uint64_t begin = lowerBound(row * sub_buckets);
+                const double end = double(upperBound(row * sub_buckets + sub_buckets - 1)) + 1;
+                const size_t width = size_t((rows[row] * 40 + largest - 1) / largest);
+                stream << std::setw(8) << detail::format_duration(double(begin)) << " - "
+                    << std::setw(8) << detail::format_duration(end) << ' '
+                    << std::setw(8) << rows[row] << ' ' << std::string(width, '#') << '\n';
+            }
+        }
+
+    private:
+        static size_t bucketOf(uint64_t value) {
+            if (value < sub_buckets) {
+                return size_t(value);
+            }
+            const size_t magnitude = size_t(std::bit_width(value)) - 1 - sub_bucket_bits;
+            return sub_buckets * (magnitude + 1) + size_t(value >> magnitude) - sub_buckets;
+        }
+
+        static uint64_t lowerBound(size_t bucket) {
+            if (bucket < sub_buckets) {
+                return bucket;
+            }
+            const size_t magnitude = bucket / sub_buckets - 1;
+            return uint64_t(sub_buckets + bucket % sub_buckets) << magnitude;
+        }
+
+        static uint64_t upperBound(size_t bucket) {
+            if (bucket < sub_buckets) {
+                return bucket;
+            }
+            const size_t magnitude = bucket / sub_buckets - 1;
+            return lowerBound(bucket) + (uint64_t(1) << magnitude) - 1;
+        }
+
+        std::atomic<uint64_t> buckets_[bucket_count] = {};
+        std::atomic<uint64_t> count_ = 0;
+        std::atomic<uint64_t> max_ = 0;
+    };
+
+    namespace detail {
+        // Test known by its names only, it may be not constructed yet
+        struct Candidate {
+            std::string_view group;
+            std::string_view name;
+        };
+
+        // Applies `RunOptions::filter` and sharding, returns mask of selected candidates.
+        // Without duration history shards are assigned by hash of "group/name". With it,
+        // tests are packed longest first, each into the least loaded shard, so shards
+        // take about the same time. All shards must use the same history to agree on the split
+        inline std::vector<bool> select(std::span<const Candidate> candidates, const RunOptions& options) {
+            std::vector<bool> mask(candidates.size(), false);
+            std::vector<size_t> matched;
+            std::vector<uint64_t> hashes;
+            for (size_t i = 0; i < candidates.size(); ++i) {
+                const auto& candidate = candidates[i];
+                if (options.filter.empty() || filter_match(options.filter, test_key(candidate.group, candidate.name))) {
+                    matched.push_back(i);
+                    hashes.push_back(key_hash(candidate.group, candidate.name));
+                }
+            }
+
+            if (options.shard_count <= 1) {
+                for (size_t i : matched) {
+                    mask[i] = true;
+                }
+                return mask;
+            }
+            if (options.durations == nullptr) {
+                for (size_t i = 0; i < matched.size(); ++i) {
+                    mask[matched[i]] = hashes[i] % options.shard_count == options.shard_index;
+                }
+                return mask;
+            }
+
+            const std::vector<double> expected = options.durations->expected(hashes);
+            std::vector<size_t> order(matched.size());
+            for (size_t i = 0; i < order.size(); ++i) {
+                order[i] = i;
+            }
+            std::sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs) {
+                if (expected[lhs] != expected[rhs]) {
+                    return expected[lhs] > expected[rhs];
+                }
+                return hashes[lhs] < hashes[rhs];
+            });
+            std::vector<double> loads(options.shard_count, 0);
+            for (size_t i : order) {
+                const size_t shard = size_t(std::min_element(loads.begin(), loads.end()) - loads.begin());
+                loads[shard] += expected[i];
+                mask[matched[i]] = shard == options.shard_index;
+            }
+            return mask;
+        }
+
+        // Group of consecutive selected tests
+        struct GroupRange {
+            std::string_view name;
+            size_t size;
+        };
+
+        struct SelectedTests {
+            std::vector<Test*> tests;
+            std::vector<std::string_view> groups;
+            std::vector<GroupRange> ranges;
+
+            void beginGroup(std::string_view name) {
+                ranges.push_back({name, 0});
+            }
+
+            void add(Test* test) {
+                tests.push_back(test);
+                groups.push_back(ranges.back().name);
+                ++ranges.back().size;
+            }
+
+            // groups with no selected tests are skipped entirely
+            void endGroup(bool empty) {
+                if (ranges.back().size == 0 && !empty) {
+                    ranges.pop_back();
+                }
+            }
+        };
+
+        // Wall-clock limits of a test, zero if there are none. The watchdog stops the test at `stop`:
+        // own time limit of the test plus `RunOptions::timeout_grace` or `RunOptions::timeout`,
+        // whichever is less. Isolated tests are killed at `kill`, which is the same except that
+        // `RunOptions::timeout` gets the grace period too
+        struct TestLimits {
+            std::chrono::nanoseconds stop{};
+            std::chrono::nanoseconds kill{};
+        };
+
+        inline TestLimits test_limits(const Test& test, const RunOptions& options) {
+            auto stop = std::chrono::nanoseconds::max();
+            auto kill = std::chrono::nanoseconds::max();
+            const auto own_limit = test.timeLimit(options);
+            if (own_limit > std::chrono::nanoseconds::zero()) {
+                stop = own_limit + options.timeout_grace;
+                kill = stop;
+            }
+            if (options.timeout > std::chrono::milliseconds::zero()) {
+                stop = std::min<std::chrono::nanoseconds>(stop, options.timeout);
+                kill = std::min<std::chrono::nanoseconds>(kill, options.timeout + options.timeout_grace);
+            }
+            if (stop == std::chrono::nanoseconds::max()) {
+                return {};
+            }
+            return {stop, kill};
+        }
+
+        // Limit after which the watchdog stops the test, see `TestLimits`
+        inline std::chrono::nanoseconds watchdog_limit(const Test& test, const RunOptions& options) {
+            return test_limits(test, options).stop;
+        }
+
+        // Return addresses of a thread interrupted by `stack_sample_signal`. It is written
+        // by the signal handler, so a sample of a worker process can be kept in shared memory
+        struct StackSample {
+            static constexpr int max_frames = 64;
+            std::atomic<int> ready{0};
+            int count = 0;
+            void* frames[max_frames];
+        };
+
+#if TINY_TEST__HAS_BACKTRACE
+        inline constexpr int stack_sample_signal = SIGUSR2;
+
+        // Where the handler writes, replaced in isolated workers by shared memory
+        inline std::atomic<StackSample*>& stack_sample_slot() {
+            static StackSample sample;
+            static std::atomic<StackSample*> slot{&sample};
+            return slot;
+        }
+
+        inline void stack_sample_handler(int) {
+            StackSample* const sample = stack_sample_slot().load(std::memory_order_acquire);
+            const int saved_errno = errno;
+            // pairs with the reset by the requester, which has read the previous sample
+            (void)sample->ready.load(std::memory_order_acquire);
+            sample->count = ::backtrace(sample->frames, StackSample::max_frames);
+            sample->ready.store(1, std::memory_order_release);
+            errno = saved_errno;
+        }
+
+        inline void install_stack_sampler() {
+            static const bool installed = [] {
+                // the first call of backtrace() may allocate, it must not happen in the handler
+                void* frame = nullptr;
+                ::backtrace(&frame, 1);
+                struct sigaction action = {};
+                action.sa_handler = stack_sample_handler;
+                action.sa_flags = SA_RESTART;
+                sigemptyset(&action.sa_mask);
+                return ::sigaction(stack_sample_signal, &action, nullptr) == 0;
+            }();
+            (void)installed;
+        }
+
+        // Waits a little for the handler to fill `sample`, then formats it
+        inline std::string describe_stack(StackSample& sample) {
+            const auto deadline = std::chrono::steady_clock::now() + 100ms;
+            while (sample.ready.load(std::memory_order_acquire) == 0) {
+                if (std::chrono::steady_clock::now() > deadline) {
+                    return "stack sample is not available\n";
+                }
+                std::this_thread::sleep_for(1ms);
+            }
+            // the handler and the signal trampoline come first, outer frames are cut
+            constexpr int skipped = 2;
+            constexpr int shown = 16;
+            const int count = std::min(sample.count, skipped + shown);
+            std::string text = "stack sample:\n";
+            for (const auto& name : symbolize(sample.frames + skipped, count - skipped)) {
+                text += "  ";
+                text += name;
+                text += '\n';
+            }
+            return text;
+        }
+
+        inline std::string sample_stack(pthread_t thread) {
+            StackSample& sample = *stack_sample_slot().load(std::memory_order_acquire);
+            sample.ready.store(0, std::memory_order_release);
+            if (::pthread_kill(thread, stack_sample_signal) != 0) {
+                return "stack sample is not available\n";
+            }
+            return describe_stack(sample);
+        }
+#endif
+
+        // Thread which tracks deadlines of running tests. When a test passes its
+        // deadline, its stop token is requested (see `Test::stopToken`) and a stack
+        // sample of its thread is taken. Tests that ignore the request still run to the end,
+        // run them with `Isolation::Fork` to have them killed `RunOptions::timeout_grace` later
+        class Watchdog {
+        public:
+            using Clock = std::chrono::steady_clock;
+
+            struct Ticket {
+                uint64_t id;
+                std::stop_token token;
+            };
+
+            Watchdog() {
+#if TINY_TEST__HAS_BACKTRACE
+                install_stack_sampler();
+#endif
+                thread_ = std::thread([this] { loop(); });
+            }
+
+            Watchdog(const Watchdog&) = delete;
+
+            ~Watchdog() {
+                {
+                    std::lock_guard lock(mutex_);
+                    stopping_ = true;
+                }
+                wake_.notify_one();
+                thread_.join();
+            }
+
+            // Starts watching the calling thread
+            Ticket watch(std::chrono::nanoseconds limit) {
+                std::lock_guard lock(mutex_);
+                const uint64_t id = ++last_id_;
+                auto& watched = watched_[id];
+                watched.deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(limit);
+#if TINY_TEST__HAS_BACKTRACE
+                watched.thread = ::pthread_self();
+#endif
+                wake_.notify_one();
+                return {id, watched.stop.get_token()};
+            }
+
+            // Stops watching, returns the stack sample if the deadline has passed.
+            // Waits for a sample being taken, so that it is complete and the thread
+            // is not signalled when it already runs something else
+            std::optional<std::string> release(uint64_t id) {
+                std::unique_lock lock(mutex_);
+                auto it = watched_.find(id);
+                sampled_.wait(lock, [&] { return !it->second.sampling; });
+                std::optional<std::string> sample;
+                if (it->second.fired) {
+                    sample = std::move(it->second.sample);
+                }
+                watched_.erase(it);
+                return sample;
+            }
+
+        private:
+            struct Watched {
+                Clock::time_point deadline;
+                std::stop_source stop;
+#if TINY_TEST__HAS_BACKTRACE
+                pthread_t thread{};
+#endif
+                bool fired = false;
+                // the stack sample is being taken, the entry must stay until it is done
+                bool sampling = false;
+                std::string sample;
+            };
+
+            void loop() {
+#if TINY_TEST__HAS_BACKTRACE
+                // process-directed samples of isolated workers go to the test thread
+                sigset_t signals;
+                sigemptyset(&signals);
+                sigaddset(&signals, stack_sample_signal);
+                ::pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+#endif
+                std::unique_lock lock(mutex_);
+                while (!stopping_) {
+                    auto next = Clock::time_point::max();
+                    uint64_t expired = 0;
+                    const auto now = Clock::now();
+                    for (auto& [id, watched] : watched_) {
+                        if (watched.fired) {
+                            continue;
+                        }
+                        if (watched.deadline <= now) {
+                            expired = id;
+                            break;
+                        }
+                        next = std::min(next, watched.deadline);
+                    }
+                    if (expired == 0) {
+                        if (next == Clock::time_point::max()) {
+                            wake_.wait(lock);
+                        } else {
+                            wake_.wait_until(lock, next);
+                        }
+                        continue;
+                    }
+
+                    // the sample is taken first, a cooperative test returns as soon as it is stopped
+                    auto& watched = watched_[expired];
+                    watched.fired = true;
+#if TINY_TEST__HAS_BACKTRACE
+                    // `release` waits for the sample, so the entry and its thread stay the same
+                    watched.sampling = true;
+                    const pthread_t thread = watched.thread;
+                    lock.unlock();
+                    std::string sample = sample_stack(thread);
+                    lock.lock();
+                    watched.sample = std::move(sample);
+                    watched.sampling = false;
+                    watched.stop.request_stop();
+                    sampled_.notify_all();
+#else
+                    watched.stop.request_stop();
+#endif
+                }
+            }
+
+            std::mutex mutex_;
+            std::condition_variable wake_;
+            std::condition_variable sampled_;
+            std::map<uint64_t, Watched> watched_;
+            uint64_t last_id_ = 0;
+            bool stopping_ = false;
+            std::thread thread_;
+        };
+
+        // Runs the test under the watchdog if it has a time limit
+        inline void run_watched(Test& test, TestResult& result, const RunOptions& options, Watchdog* watchdog) {
+            const auto limit = watchdog != nullptr ? watchdog_limit(test, options) : std::chrono::nanoseconds::zero();
+            if (limit == std::chrono::nanoseconds::zero()) {
+                test.run(result, &options);
+                return;
+            }
+            const auto ticket = watchdog->watch(limit);
+            test.run(result, &options, ticket.token);
+            if (auto sample = watchdog->release(ticket.id)) {
+                result.passed = false;
+                result.output += "TIMED OUT: stop was requested after ";
+                result.output += format_duration(double(limit.count()));
+                result.output += ", test finished after ";
+                result.output += format_duration(double(result.duration.count()));
+                result.output += '\n';
+                result.output += *sample;
+            }
+        }
+
+        // Prints progress of a run to stderr every `RunOptions::progress` from its own
+        // thread: finished tests, tests per second, ETA, percentiles of test durations
+        // and the longest running tests. Workers only do a few atomic operations per test
+        class ProgressMonitor {
+        public:
+            static constexpr size_t shown_running = 3;
+
+            ProgressMonitor(std::span<Test* const> tests, std::span<const std::string_view> groups, std::chrono::milliseconds interval)
+            : tests_(tests)
+            , groups_(groups)
+            , started_(tests.size())
+            , interval_(interval)
+            , run_started_(Clock::now())
+#if TINY_TEST__HAS_FORK
+            , terminal_(::isatty(STDERR_FILENO) != 0)
+#endif
+            , thread_([this] { loop(); }) {}
+
+            ProgressMonitor(const ProgressMonitor&) = delete;
+
+            ~ProgressMonitor() {
+                {
+                    std::lock_guard lock(mutex_);
+                    stopped_ = true;
+                }
+                wake_.notify_one();
+                thread_.join();
+                std::string line = status(Clock::now());
+                line += '\n';
+                std::ostringstream histogram;
+                histogram << "durations of " << histogram_.count() << " tests:\n";
+                histogram_.print(histogram);
+                line += std::move(histogram).str();
+                std::cerr << line << std::flush;
+            }
+
+            void running(size_t index) {
+                started_[index].store(ticks(Clock::now()), std::memory_order_relaxed);
+            }
+
+            void finished(size_t index, const TestResult& result) {
+                started_[index].store(0, std::memory_order_relaxed);
+                if (!result.skipped) {
+                    histogram_.record(result.duration);
+                }
+                finished_.fetch_add(1, std::memory_order_relaxed);
+            }
+
+        private:
+            using Clock = std::chrono::steady_clock;
+
+            // zero marks tests which are not running
+            static int64_t ticks(Clock::time_point time) {
+                return std::max<int64_t>(time.time_since_epoch().count(), 1);
+            }
+
+            void loop() {
+                std::unique_lock lock(mutex_);
+                while (!wake_.wait_for(lock, interval_, [this] { return stopped_; })) {
+                    std::string line = terminal_ ? "\r\033[K" : "";
+                    line += status(Clock::now());
+                    if (!terminal_) {
+                        line += '\n';
+                    }
+                    std::cerr << line << std::flush;
+                }
+                if (terminal_) {
+                    std::cerr << "\r\033[K";
+                }
+            }
+
+            std::string status(Clock::time_point now) const {
+                const size_t finished = finished_.load(std::memory_order_relaxed);
+                const double elapsed = std::chrono::duration<double>(now - run_started_).count();
+                const double rate = elapsed > 0 ? double(finished) / elapsed : 0;
+                std::ostringstream line;
+                line << '[' << finished << '/' << tests_.size() << "] "
+                    << std::fixed << std::setprecision(1) << rate << " tests/s";
+                if (finished != 0 && finished < tests_.size()) {
+                    const double remaining = double(tests_.size() - finished) / rate;
+                    line << ", ETA " << format_duration(remaining * 1e9);
+                }
+                if (histogram_.count() != 0) {
+                    line << ", p50 " << format_duration(double(histogram_.percentile(0.5).count()))
+                        << " p99 " << format_duration(double(histogram_.percentile(0.99).count()))
+                        << " max " << format_duration(double(histogram_.max().count()));
+                }
+
+                // a scan per refresh keeps workers free of any shared bookkeeping
+                std::pair<int64_t, size_t> oldest[shown_running];
+                size_t count = 0;
+                for (size_t i = 0; i < started_.size(); ++i) {
+                    const int64_t started = started_[i].load(std::memory_order_relaxed);
+                    if (started == 0 || (count == shown_running && started >= oldest[count - 1].first)) {
+                        continue;
+                    }
+                    if (count < shown_running) {
+                        ++count;
+                    }
+                    size_t position = count - 1;
+                    for (; position > 0 && oldest[position - 1].first > started; --position) {
+                        oldest[position] = oldest[position - 1];
+                    }
+                    oldest[position] = {started, i};
+                }
+                for (size_t i = 0; i < count; ++i) {
+                    const auto [started, index] = oldest[i];
+                    line << (i == 0 ? ", running: " : ", ") << groups_[index] << '/' << tests_[index]->name()
+                        << ' ' << format_duration(double(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::duration(ticks(now) - started)).count()));
+                }
+                return std::move(line).str();
+            }
+
+            std::span<Test* const> tests_;
+            std::span<const std::string_view> groups_;
+            std::vector<std::atomic<int64_t>> started_;
+            std::atomic<size_t> finished_ = 0;
+            LatencyHistogram histogram_;
+            std::chrono::milliseconds interval_;
+            Clock::time_point run_started_;
+            bool terminal_ = false;
+            std::mutex mutex_;
+            std::condition_variable wake_;
+            bool stopped_ = false;
+            std::thread thread_;
+        };
+
+        // Passes results to the reporter in declaration order, no matter in which
+        // order tests actually finish. Also recycles tests' output buffers
+        class OrderedReporter {
+        public:
+            OrderedReporter(std::span<const GroupRange> groups, size_t tests, Reporter& reporter, const RunOptions& options)
+            : groups_(groups)
+            , results_(tests)
+            , finished_(tests, false)
+            , reporter_(reporter)
+            , output_capacity_(options.output_capacity)
+            , durations_(options.durations)
+            , cache_(options.cache) {
+                reporter_.runStarted();
+            }
+
+            // Prepares result slot for the test with given index
+            TestResult& start(size_t index, std::string_view group) {
+                auto& result = results_[index];
+                result.group = group;
+                result.skipped = false;
+                result.cacheable = true;
+                std::lock_guard lock(buffers_mutex_);
+                if (!buffers_.empty()) {
+                    result.output = std::move(buffers_.back());
+                    buffers_.pop_back();
+                } else {
+                    result.output.reserve(output_capacity_);
+                }
+                return result;
+            }
+
+            // Result slot of a test after `start`
+            TestResult& slot(size_t index) {
+                return results_[index];
+            }
+
+            // Hashes of test inputs, results are recorded in `RunOptions::cache` with them
+            void setInputs(std::vector<std::optional<uint64_t>> inputs) {
+                inputs_ = std::move(inputs);
+            }
+
+            void setProgress(ProgressMonitor* progress) {
+                progress_ = progress;
+            }
+
+            // Called right before the test with given index starts running, its name must be set.
+            // The reporter learns about the test if all tests before it are already reported
+            void running(size_t index) {
+                if (progress_ != nullptr) {
+                    progress_->running(index);
+                }
+                std::lock_guard lock(mutex_);
+                flushReady();
+                if (index == next_) {
+                    reporter_.testStarted(results_[index].group, results_[index].name);
+                }
+            }
+
+            void finished(size_t index) {
+                if (progress_ != nullptr) {
+                    progress_->finished(index, results_[index]);
+                }
+                std::lock_guard lock(mutex_);
+                finished_[index] = true;
+                flushReady();
+            }
+
+            bool finish() {
+                std::lock_guard lock(mutex_);
+                flushReady();
+                reporter_.runFinished(failed_, results_.size());
+                return failed_ == 0;
+            }
+
+        private:
+            void flushReady() {
+                while (group_ < groups_.size()) {
+                    const auto& group = groups_[group_];
+                    if (!group_started_) {
+                        group_started_ = true;
+                        reporter_.groupStarted(group.name);
+                    }
+                    while (position_ < group.size && finished_[next_]) {
+                        auto& result = results_[next_];
+                        reporter_.testFinished(result);
+                        if (durations_ != nullptr && !result.skipped) {
+                            durations_->record(key_hash(result.group, result.name), result.duration);
+                        }
+                        if (cache_ != nullptr && !result.skipped && next_ < inputs_.size() && inputs_[next_]) {
+                            // uncacheable results are recorded as failed, so that they are never skipped
+                            cache_->record(key_hash(result.group, result.name), *inputs_[next_], result.passed && result.cacheable);
+                        }
+                        if (!result.passed) {
+                            ++group_failed_;
+                            ++failed_;
+                        }
+                        recycle(result.output);
+                        ++position_;
+                        ++next_;
+                    }
+                    if (position_ < group.size) {
+                        return;
+                    }
+                    reporter_.groupFinished(group.name, group_failed_, group.size);
+                    ++group_;
+                    position_ = 0;
+                    group_failed_ = 0;
+                    group_started_ = false;
+                }
+            }
+
+            void recycle(std::string& output) {
+                output.clear();
+                std::lock_guard lock(buffers_mutex_);
+                buffers_.push_back(std::move(output));
+                output = {};
+            }
+
+            std::span<const GroupRange> groups_;
+            std::vector<TestResult> results_;
+            std::vector<bool> finished_;
+            Reporter& reporter_;
+            size_t output_capacity_;
+            DurationHistory* durations_;
+            ResultCache* cache_;
+            ProgressMonitor* progress_ = nullptr;
+            std::vector<std::optional<uint64_t>> inputs_;
+            std::mutex mutex_;
+            std::mutex buffers_mutex_;
+            std::vector<std::string> buffers_;
+            size_t failed_ = 0;
+            size_t group_ = 0;
+            size_t position_ = 0;
+            size_t next_ = 0;
+            size_t group_failed_ = 0;
+            bool group_started_ = false;
+        };
+
+        // Reports repetitions of a run as one run: forwards every call but `runStarted`
+        // and `runFinished`, which reach the reporter once with totals of all repetitions.
+        // Otherwise reporters writing documents, like JUnit XML, would write one per repetition
+        class RepeatedRunReporter : public Reporter {
+        public:
+            explicit RepeatedRunReporter(Reporter& reporter)
+            : reporter_(reporter) {
+                reporter_.runStarted();
+            }
+
+            void environment(const Environment& environment) override {
+                reporter_.environment(environment);
+            }
+
+            void groupStarted(std::string_view group) override {
+                reporter_.groupStarted(group);
+            }
+
+            void testStarted(std::string_view group, std::string_view name) override {
+                reporter_.testStarted(group, name);
+            }
+
+            void testFinished(const TestResult& result) override {
+                reporter_.testFinished(result);
+            }
+
+            void groupFinished(std::string_view group, size_t failed, size_t total) override {
+                reporter_.groupFinished(group, failed, total);
+            }
+
+            void runFinished(size_t failed, size_t total) override {
+                failed_ += failed;
+                total_ += total;
+            }
+
+            // Finishes the run, true if no test failed in any repetition
+            bool finish() {
+                reporter_.runFinished(failed_, total_);
+                return failed_ == 0;
+            }
+
+        private:
+            Reporter& reporter_;
+            size_t failed_ = 0;
+            size_t total_ = 0;
+        };
+
+#if TINY_TEST__HAS_FORK
+        inline bool write_all(int fd, const void* data, size_t size) {
+            auto* bytes = static_cast<const char*>(data);
+            while (size != 0) {
+                const ssize_t written = ::write(fd, bytes, size);
+                if (written < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    return false;
+                }
+                bytes += written;
+                size -= size_t(written);
+            }
+            return true;
+        }
+
+        // False on error or if the other side is closed before `size` bytes are read
+        inline bool read_all(int fd, void* data, size_t size) {
+            auto* bytes = static_cast<char*>(data);
+            while (size != 0) {
+                const ssize_t received = ::read(fd, bytes, size);
+                if (received < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (received <= 0) {
+                    return false;
+                }
+                bytes += received;
+                size -= size_t(received);
+            }
+            return true;
+        }
+
+        // Fixed-size part of a result sent by an isolated worker, followed by the output
+        // Final result of a test, or only output (`last` is false) sent by a dying worker
+        struct ResultMessage {
+            bool last;
+            bool passed;
+            bool cacheable;
+            std::chrono::nanoseconds duration;
+            CounterValues counters;
+            AllocationStats allocations;
+            uint64_t output_size;
+        };
+
+        inline bool write_result(int fd, const TestResult& result) {
+            const ResultMessage message{true, result.passed, result.cacheable, result.duration, result.counters, result.allocations, result.output.size()};
+            return write_all(fd, &message, sizeof(message))
+                && write_all(fd, result.output.data(), result.output.size());
+        }
+
+        // Reads one message, output is appended to `result.output`. `last` is false
+        // for output sent by `flush_pending_output`
+        inline bool read_message(int fd, TestResult& result, bool& last) {
+            ResultMessage message;
+            if (!read_all(fd, &message, sizeof(message))) {
+                return false;
+            }
+            const size_t offset = result.output.size();
+            result.output.resize(offset + message.output_size);
+            if (!read_all(fd, result.output.data() + offset, message.output_size)) {
+                return false;
+            }
+            last = message.last;
+            if (!last) {
+                return true;
+            }
+            result.passed = message.passed;
+            result.cacheable = message.cacheable;
+            result.duration = message.duration;
+            result.counters = message.counters;
+            result.allocations = message.allocations;
+            return true;
+        }
+
+        // Reads messages up to the final result, output sent before a crash is kept on failure
+        inline bool read_result(int fd, TestResult& result) {
+            bool last = false;
+            while (!last) {
+                if (!read_message(fd, result, last)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Sent by the parent to a worker whose test runs past its deadline, before it is killed
+        inline constexpr int output_flush_signal = SIGUSR1;
+
+        // Sends output and pending failures of the running test as a message which is not the last.
+        // Called from signal handlers, so it only reads memory and calls write(). The test thread can
+        // be interrupted in the middle of writing output, such output may be cut short
+        inline void flush_pending_output() {
+            auto& pending = pending_output();
+            const int fd = pending.fd.exchange(-1, std::memory_order_acquire);
+            if (fd < 0) {
+                return;
+            }
+            const std::string_view output = *pending.output;
+            const std::string_view failures = pending.test->pendingOutput();
+            const ResultMessage message{false, false, false, {}, {}, {}, output.size() + failures.size()};
+            (void)(write_all(fd, &message, sizeof(message))
+                && write_all(fd, output.data(), output.size())
+                && write_all(fd, failures.data(), failures.size()));
+        }
+
+        inline void flush_signal_handler(int) {
+            const int saved_errno = errno;
+            flush_pending_output();
+            errno = saved_errno;
+        }
+
+        // The default action is restored first, so the signal kills the worker once output is sent
+        inline void fatal_signal_handler(int signal) {
+            flush_pending_output();
+            ::raise(signal);
+        }
+
+        // Installs handlers of `flush_pending_output` in a worker, fatal signals are handled
+        // on an alternate stack, so that output is sent after a stack overflow too
+        inline void install_output_flush() {
+            static const size_t stack_size = std::max<size_t>(SIGSTKSZ, 1 << 16);
+            static const auto stack = std::make_unique<char[]>(stack_size);
+            stack_t alternate = {};
+            alternate.ss_sp = stack.get();
+            alternate.ss_size = stack_size;
+            ::sigaltstack(&alternate, nullptr);
+            struct sigaction action = {};
+            sigemptyset(&action.sa_mask);
+            action.sa_handler = fatal_signal_handler;
+            action.sa_flags = SA_RESETHAND | SA_NODEFER | SA_ONSTACK;
+            for (int signal : {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT}) {
+                ::sigaction(signal, &action, nullptr);
+            }
+            action.sa_handler = flush_signal_handler;
+            action.sa_flags = SA_RESTART;
+            ::sigaction(output_flush_signal, &action, nullptr);
+        }
+
+        // Runs tests in pre-forked worker processes, so that a crash or a hang fails
+        // only the test that caused it. Workers receive test indices over a pipe and
+        // send results back over another one. They are reused between tests and
+        // replaced when they die or get killed on timeout
+        class IsolatedRunner {
+        public:
+            // Tests are started in given `order`
+            IsolatedRunner(
+                    std::span<Test* const> tests,
+                    std::span<const std::string_view> groups,
+                    std::span<const size_t> order,
+                    const RunOptions& options,
+                    OrderedReporter& ordered,
+                    size_t workers)
+            : tests_(tests)
+            , groups_(groups)
+            , order_(order)
+            , options_(options)
+            , ordered_(ordered)
+            , workers_(std::max<size_t>(workers, 1)) {}
+
+            void run() {
+                using Clock = std::chrono::steady_clock;
+                auto previous_handler = std::signal(SIGPIPE, SIG_IGN);
+                size_t next = 0;
+                size_t running = 0;
+                bool serial_running = false;
+                std::vector<pollfd> fds;
+                while (next < order_.size() || running != 0) {
+                    for (auto& worker : workers_) {
+                        if (next == order_.size() || serial_running) {
+                            break;
+                        }
+                        if (worker.busy) {
+                            continue;
+                        }
+                        const size_t index = order_[next];
+                        if (tests_[index]->serialOnly() && running != 0) {
+                            break;
+                        }
+                        serial_running = tests_[index]->serialOnly();
+                        ++next;
+                        if (start(worker, index)) {
+                            ++running;
+                        } else {
+                            serial_running = false;
+                        }
+                    }
+                    if (running == 0) {
+                        continue;
+                    }
+
+                    // wait for any result or for the nearest deadline
+                    auto now = Clock::now();
+                    int timeout_ms = -1;
+                    fds.clear();
+                    for (auto& worker : workers_) {
+                        if (!worker.busy) {
+                            continue;
+                        }
+                        fds.push_back({worker.results, POLLIN, 0});
+                        if (worker.deadline != Clock::time_point::max()) {
+                            auto left = std::chrono::ceil<std::chrono::milliseconds>(worker.deadline - now).count();
+                            left = std::max<decltype(left)>(left, 0);
+                            timeout_ms = timeout_ms < 0 ? int(left) : std::min(timeout_ms, int(left));
+                        }
+                    }
+                    if (::poll(fds.data(), nfds_t(fds.size()), timeout_ms) < 0 && errno != EINTR) {
+                        break;
+                    }
+
+                    now = Clock::now();
+                    size_t polled = 0;
+                    for (auto& worker : workers_) {
+                        if (!worker.busy) {
+                            continue;
+                        }
+                        const short events = fds[polled++].revents;
+                        if (events != 0) {
+                            collect(worker);
+                        } else if (now >= worker.deadline) {
+                            timeout(worker, now - worker.started);
+                        } else {
+                            continue;
+                        }
+                        --running;
+                        serial_running = false;
+                    }
+                }
+                for (auto& worker : workers_) {
+                    stop(worker, false);
+                }
+                std::signal(SIGPIPE, previous_handler);
+            }
+
+        private:
+            using Clock = std::chrono::steady_clock;
+
+            struct Worker {
+                pid_t pid = -1;
+                int commands = -1;
+                int results = -1;
+                bool busy = false;
+                size_t task = 0;
+                Clock::time_point started;
+                Clock::time_point deadline;
+                // shared with the worker, which writes stack samples here
+                StackSample* sample = nullptr;
+            };
+
+            bool spawn(Worker& worker) {
+                int commands[2];
+                int results[2];
+                if (::pipe(commands) != 0) {
+                    return false;
+                }
+                if (::pipe(results) != 0) {
+                    ::close(commands[0]);
+                    ::close(commands[1]);
+                    return false;
+                }
+#if TINY_TEST__HAS_BACKTRACE
+                void* shared = ::mmap(nullptr, sizeof(StackSample), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+                worker.sample = shared != MAP_FAILED ? new (shared) StackSample : nullptr;
+#endif
+                // do not let buffered output be written twice
+                std::cout.flush();
+                std::fflush(nullptr);
+                const pid_t pid = ::fork();
+                if (pid < 0) {
+                    for (int fd : {commands[0], commands[1], results[0], results[1]}) {
+                        ::close(fd);
+                    }
+                    releaseSample(worker);
+                    return false;
+                }
+                if (pid == 0) {
+                    for (auto& other : workers_) {
+                        if (other.pid >= 0) {
+                            ::close(other.commands);
+                            ::close(other.results);
+                        }
+                    }
+                    ::close(commands[1]);
+                    ::close(results[0]);
+#if TINY_TEST__HAS_BACKTRACE
+                    if (worker.sample != nullptr) {
+                        stack_sample_slot().store(worker.sample, std::memory_order_release);
+                    }
+#endif
+                    serve(commands[0], results[1]);
+                }
+                ::close(commands[0]);
+                ::close(results[1]);
+                worker.pid = pid;
+                worker.commands = commands[1];
+                worker.results = results[0];
+                return true;
+            }
+
+            [[noreturn]] void serve(int commands, int results) {
+                // asks tests to stop before the parent kills the process
+                Watchdog watchdog;
+                install_output_flush();
+                TestResult result;
+                result.output.reserve(options_.output_capacity);
+                auto& pending = pending_output();
+                pending.output = &result.output;
+                uint64_t index = 0;
+                while (read_all(commands, &index, sizeof(index))) {
+                    result.output.clear();
+                    result.group = groups_[index];
+                    pending.test = tests_[index];
+                    pending.fd.store(results, std::memory_order_release);
+                    run_watched(*tests_[index], result, options_, &watchdog);
+                    // the exchange makes sure a flush is not running or never starts
+                    if (pending.fd.exchange(-1, std::memory_order_acquire) < 0) {
+                        break;
+                    }
+                    if (!write_result(results, result)) {
+                        break;
+                    }
+                }
+                ::_exit(0);
+            }
+
+            void stop(Worker& worker, bool kill) {
+                if (worker.pid < 0) {
+                    return;
+                }
+                if (kill) {
+                    ::kill(worker.pid, SIGKILL);
+                }
+                ::close(worker.commands);
+                ::close(worker.results);
+                int status = 0;
+                while (::waitpid(worker.pid, &status, 0) < 0 && errno == EINTR) {}
+                releaseSample(worker);
+                worker = Worker{};
+                last_status_ = status;
+            }
+
+            void releaseSample(Worker& worker) {
+                if (worker.sample != nullptr) {
+                    ::munmap(worker.sample, sizeof(StackSample));
+                    worker.sample = nullptr;
+                }
+            }
+
+            // Sends test to the worker, runs it in this process if no worker can be started
+            bool start(Worker& worker, size_t index) {
+                TestResult& result = ordered_.start(index, groups_[index]);
+                result.name = tests_[index]->name();
+                ordered_.running(index);
+                const uint64_t command = index;
+                for (int attempt = 0; attempt < 2; ++attempt) {
+                    if (worker.pid < 0 && !spawn(worker)) {
+                        break;
+                    }
+                    if (write_all(worker.commands, &command, sizeof(command))) {
+                        worker.busy = true;
+                        worker.task = index;
+                        worker.started = Clock::now();
+                        worker.deadline = deadline(*tests_[index], worker.started);
+                        return true;
+                    }
+                    // worker has died while waiting for a task
+                    stop(worker, true);
+                }
+                tests_[index]->run(result, &options_);
+                ordered_.finished(index);
+                return false;
+            }
+
+            // the worker's watchdog asks the test to stop at `TestLimits::stop`, the process is killed at `TestLimits::kill`
+            Clock::time_point deadline(const Test& test, Clock::time_point started) const {
+                const auto limits = test_limits(test, options_);
+                if (limits.kill == std::chrono::nanoseconds::zero()) {
+                    return Clock::time_point::max();
+                }
+                return started + std::chrono::duration_cast<Clock::duration>(limits.kill);
+            }
+
+            void collect(Worker& worker) {
+                const size_t index = worker.task;
+                worker.busy = false;
+                // result slot was prepared in `start`
+                TestResult& result = ordered_.slot(index);
+                if (!read_result(worker.results, result)) {
+                    // recorded in `DurationHistory`, so that a crashing test is not scheduled as a quick one
+                    result.duration = Clock::now() - worker.started;
+                    stop(worker, true);
+                    result.passed = false;
+                    result.output += crashDescription(last_status_);
+                }
+                ordered_.finished(index);
+            }
+
+            void timeout(Worker& worker, Clock::duration elapsed) {
+                const size_t index = worker.task;
+                std::string sample;
+#if TINY_TEST__HAS_BACKTRACE
+                if (worker.sample != nullptr) {
+                    // the worker has the same memory layout, its addresses are symbolized here
+                    worker.sample->ready.store(0, std::memory_order_release);
+                    if (::kill(worker.pid, stack_sample_signal) == 0) {
+                        sample = describe_stack(*worker.sample);
+                    }
+                }
+#endif
+                // output and failures recorded so far explain the hang, the worker sends them when asked
+                TestResult& result = ordered_.slot(index);
+                if (::kill(worker.pid, output_flush_signal) == 0) {
+                    pollfd fd = {worker.results, POLLIN, 0};
+                    bool last = false;
+                    while (!last && ::poll(&fd, 1, 100) > 0 && read_message(worker.results, result, last)) {}
+                }
+                stop(worker, true);
+                result.passed = false;
+                result.duration = elapsed;
+                std::ostringstream message;
+                message << "TIMED OUT after " << std::setprecision(3)
+                    << std::chrono::duration<double, std::milli>(elapsed).count()
+                    << "ms, test process was killed\n";
+                result.output += std::move(message).str();
+                result.output += sample;
+                ordered_.finished(index);
+            }
+
+            static std::string crashDescription(int status) {
+                std::ostringstream message;
+                if (WIFSIGNALED(status)) {
+                    message << "test process CRASHED with signal " << WTERMSIG(status)
+                        << " (" << ::strsignal(WTERMSIG(status)) << ")\n";
+                } else if (WIFEXITED(status)) {
+                    message << "test process EXITED with code " << WEXITSTATUS(status) << '\n';
+                } else {
+                    message << "test process was lost\n";
+                }
+                return std::move(message).str();
+            }
+
+            std::span<Test* const> tests_;
+            std::span<const std::string_view> groups_;
+            std::span<const size_t> order_;
+            const RunOptions& options_;
+            OrderedReporter& ordered_;
+            std::vector<Worker> workers_;
+            int last_status_ = 0;
+        };
+#endif
+
+        inline bool run_selected(const SelectedTests& selected, const RunOptions& options) {
+            const auto& tests = selected.tests;
+            Reporter& reporter = options.reporter != nullptr ? *options.reporter : default_reporter();
+            OrderedReporter ordered(selected.ranges, tests.size(), reporter, options);
+            if (std::any_of(tests.begin(), tests.end(), [](const Test* test) { return test->timingSensitive(); })) {
+                reporter.environment(detect_environment(options));
+            }
+            const size_t jobs = options.jobs == 0
+                ? std::max<size_t>(std::thread::hardware_concurrency(), 1)
+                : options.jobs;
+            std::optional<ProgressMonitor> progress;
+            if (options.progress > std::chrono::milliseconds::zero()) {
+                ordered.setProgress(&progress.emplace(tests, selected.groups, options.progress));
+            }
+            // the watchdog thread is started only if some test has a time limit
+            std::optional<Watchdog> watchdog;
+            if (options.isolation == Isolation::None && std::any_of(tests.begin(), tests.end(), [&](const Test* test) {
+                return watchdog_limit(*test, options) > std::chrono::nanoseconds::zero();
+            })) {
+                watchdog.emplace();
+            }
+            auto run_one = [&](size_t index) {
+                auto& result = ordered.start(index, selected.groups[index]);
+                result.name = tests[index]->name();
+                ordered.running(index);
+                run_watched(*tests[index], result, options, watchdog ? &*watchdog : nullptr);
+                ordered.finished(index);
+            };
+            // async tests number `batch`, `batch + batches`, ... of `indices` share one event loop
+            auto run_interleaved = [&](std::span<const size_t> indices, size_t batch, size_t batches) {
+                EventLoop loop;
+                for (size_t i = batch; i < indices.size(); i += batches) {
+                    const size_t index = indices[i];
+                    auto& result = ordered.start(index, selected.groups[index]);
+                    result.name = tests[index]->name();
+                    ordered.running(index);
+                    tests[index]->startAsync(loop, result, &options, [&ordered, index] {
+                        ordered.finished(index);
+                    });
+                }
+                loop.run();
+            };
+            // runs tests which are not serial-only, one event loop per worker takes all async ones
+            auto run_segment = [&](std::span<const size_t> segment, WorkStealingPool* pool) {
+                std::vector<size_t> sync;
+                std::vector<size_t> async;
+                for (size_t index : segment) {
+                    (tests[index]->isAsync() ? async : sync).push_back(index);
+                }
+                const size_t batches = std::min(pool != nullptr ? pool->size() : 1, async.size());
+                auto run_item = [&](size_t item) {
+                    if (item < sync.size()) {
+                        run_one(sync[item]);
+                    } else {
+                        run_interleaved(async, item - sync.size(), batches);
+                    }
+                };
+                if (pool == nullptr) {
+                    for (size_t item = 0; item < sync.size() + batches; ++item) {
+                        run_item(item);
+                    }
+                } else {
+                    pool->parallelFor(sync.size() + batches, run_item, WorkStealingPool::Distribution::RoundRobin);
+                }
+            };
+
+            // with known durations longest tests are started first,
+            // serial-only tests keep their places
+            std::vector<size_t> order(tests.size());
+            for (size_t i = 0; i < order.size(); ++i) {
+                order[i] = i;
+            }
+            if (options.durations != nullptr && jobs > 1) {
+                std::vector<uint64_t> hashes;
+                for (size_t i = 0; i < tests.size(); ++i) {
+                    hashes.push_back(key_hash(selected.groups[i], tests[i]->name()));
+                }
+                const std::vector<double> expected = options.durations->expected(hashes);
+                for (size_t begin = 0; begin < order.size();) {
+                    size_t end = begin;
+                    while (end < order.size() && !tests[end]->serialOnly()) {
+                        ++end;
+                    }
+                    std::stable_sort(order.begin() + long(begin), order.begin() + long(end), [&](size_t lhs, size_t rhs) {
+                        return expected[lhs] > expected[rhs];
+                    });
+                    begin = end + 1;
+                }
+            }
+
+            // tests that passed last time with the same inputs are reported right away
+            if (options.cache != nullptr) {
+                std::vector<std::optional<uint64_t>> inputs(tests.size());
+                for (size_t i = 0; i < tests.size(); ++i) {
+                    inputs[i] = options.cache->inputs(*tests[i], key_hash(selected.groups[i], tests[i]->name()), options);
+                }
+                if (options.repeat <= 1) {
+                    std::erase_if(order, [&](size_t index) {
+                        if (!inputs[index] || !options.cache->passed(key_hash(selected.groups[index], tests[index]->name()), *inputs[index])) {
+                            return false;
+                        }
+                        auto& result = ordered.start(index, selected.groups[index]);
+                        result.name = tests[index]->name();
+                        result.passed = true;
+                        result.skipped = true;
+                        ordered.finished(index);
+                        return true;
+                    });
+                }
+                ordered.setInputs(std::move(inputs));
+            }
+
+#if TINY_TEST__HAS_FORK
+            if (options.isolation == Isolation::Fork) {
+                IsolatedRunner(tests, selected.groups, order, options, ordered, std::min(jobs, std::max<size_t>(order.size(), 1))).run();
+                return ordered.finish();
+            }
+#endif
+
+            // serial-only tests split the list into segments,
+            // segments are run one after another on the pool
+            std::optional<WorkStealingPool> pool;
+            if (jobs > 1 && order.size() > 1) {
+                pool.emplace(std::min(jobs, order.size()));
+            }
+            size_t begin = 0;
+            while (begin < order.size()) {
+                if (tests[order[begin]]->serialOnly()) {
+                    run_one(order[begin++]);
+                    continue;
+                }
+                size_t end = begin;
+                while (end < order.size() && !tests[order[end]]->serialOnly()) {
+                    ++end;
+                }
+                run_segment(std::span(order).subspan(begin, end - begin), pool ? &*pool : nullptr);
+                begin = end;
+            }
+            return ordered.finish();
+        }
+
+        // Runs selected tests `options.repeat` times
+        inline bool run_repeated(const SelectedTests& selected, const RunOptions& options) {
+            if (options.repeat <= 1) {
+                return run_selected(selected, options);
+            }
+            RepeatedRunReporter reporter(options.reporter != nullptr ? *options.reporter : default_reporter());
+            RunOptions repeat_options = options;
+            repeat_options.reporter = &reporter;
+            bool success = true;
+            for (size_t i = 0; i < options.repeat; ++i) {
+                success &= run_selected(selected, repeat_options);
+            }
+            return reporter.finish() && success;
+        }
+
+        inline void add_candidates(std::vector<Candidate>& candidates, std::span<const GroupTests> groups) {
+            for (const auto& group : groups) {
+                for (const auto& test : group.tests) {
+                    candidates.push_back({group.name, test->name()});
+                }
+            }
+        }
+
+        // Adds selected tests of `groups`, `mask` starts with their candidates
+        inline size_t add_selected(SelectedTests& selected, std::span<const GroupTests> groups, const std::vector<bool>& mask) {
+            size_t index = 0;
+            for (const auto& group : groups) {
+                selected.beginGroup(group.name);
+                for (const auto& test : group.tests) {
+                    if (mask[index++]) {
+                        selected.add(test.get());
+                    }
+                }
+                selected.endGroup(group.tests.empty());
+            }
+            return index;
+        }
+
+        // Runs tests of `groups` selected by `options.filter` and sharding
+        TINY_TEST__RUNNER_API bool run_groups(std::span<const GroupTests> groups, const RunOptions& options) {
+            std::vector<Candidate> candidates;
+            add_candidates(candidates, groups);
+            SelectedTests selected;
+            add_selected(selected, groups, select(candidates, options));
+            return run_repeated(selected, options);
+        }
+    }
+#else
+    namespace detail {
+        bool run_groups(std::span<const GroupTests> groups, const RunOptions& options);
+    }
+#endif
+
+    namespace detail {
+        // Fixture part known to TestGroup
+        class FixtureBase {
+        public:
+            virtual ~FixtureBase() = default;
+
+            // Every group the fixture is added to attaches to it,
+            // the last detached group tears it down
+            void attach() {
+                groups_.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            void detach() {
+                if (groups_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    teardown();
+                }
+            }
+
+            virtual void teardown() = 0;
+
+        private:
+            std::atomic<size_t> groups_ = 0;
+        };
+    }
+
+    // Copy-on-write view of a fixture value: reads use the shared value,
+    // the first `write()` makes a private copy
+    template<typename T>
+    class CowRef {
+    public:
+        explicit CowRef(const T& shared)
+        : shared_(&shared) {}
+
+        const T& operator*() const {
+            return copy_ ? *copy_ : *shared_;
+        }
+
+        const T* operator->() const {
+            return &**this;
+        }
+
+        T& write() {
+            if (!copy_) {
+                copy_.emplace(*shared_);
+            }
+            return *copy_;
+        }
+
+    private:
+        const T* shared_;
+        std::optional<T> copy_;
+    };
+
+    // Expensive setup shared by tests. The value is built by `factory` on first use,
+    // then shared read-only by all tests, including ones on other workers.
+    // Adding the fixture to a TestGroup scopes it to the group: the value is destroyed
+    // when the group is. Adding it to several groups makes it suite-scoped: it lives
+    // until the last of them is destroyed. If factory throws, the test using the fixture
+    // fails and the next one tries to build it again
+    template<typename T>
+    class Fixture : public detail::FixtureBase {
+    public:
+        // `factory` may be move-only, e.g. a lambda owning a unique_ptr
+        template<typename Factory>
+            requires std::is_invocable_r_v<T, std::decay_t<Factory>&>
+        explicit Fixture(Factory&& factory)
+        : factory_(std::make_unique<FactoryOf<std::decay_t<Factory>>>(std::forward<Factory>(factory))) {}
+
+        const T& get() const {
+            if (const T* value = ready_.load(std::memory_order_acquire)) [[likely]] {
+                return *value;
+            }
+            return build();
+        }
+
+        const T& operator*() const {
+            return get();
+        }
+
+        const T* operator->() const {
+            return &get();
+        }
+
+        // For tests that modify the fixture
+        CowRef<T> clone() const {
+            return CowRef<T>(get());
+        }
+
+        bool built() const {
+            return ready_.load(std::memory_order_acquire) != nullptr;
+        }
+
+        void teardown() override {
+            std::lock_guard lock(mutex_);
+            ready_.store(nullptr, std::memory_order_release);
+            value_.reset();
+        }
+
+    private:
+        struct AnyFactory {
+            virtual ~AnyFactory() = default;
+            virtual T make() = 0;
+        };
+
+        template<typename Factory>
+        struct FactoryOf : AnyFactory {
+            explicit FactoryOf(Factory factory)
+            : factory(std::move(factory)) {}
+
+            T make() override {
+                return factory();
+            }
+
+            Factory factory;
+        };
+
+        TINY_TEST__COLD const T& build() const {
+            std::lock_guard lock(mutex_);
+            if (!value_) {
+                value_ = std::make_unique<T>(factory_->make());
+                ready_.store(value_.get(), std::memory_order_release);
+            }
+            return *value_;
+        }
+
+        std::unique_ptr<AnyFactory> factory_;
+        mutable std::mutex mutex_;
+        mutable std::unique_ptr<T> value_;
+        mutable std::atomic<const T*> ready_ = nullptr;
+    };
+
+    // Copyable handle of a Fixture, captured by tests and added to groups
+    template<typename T>
+    class FixtureRef {
+    public:
+        explicit FixtureRef(std::shared_ptr<Fixture<T>> fixture)
+        : fixture_(std::move(fixture)) {}
+
+        const T& operator*() const {
+            return fixture_->get();
+        }
+
+        const T* operator->() const {
+            return &fixture_->get();
+        }
+
+        CowRef<T> clone() const {
+            return fixture_->clone();
+        }
+
+        Fixture<T>& fixture() const {
+            return *fixture_;
+        }
+
+        operator std::shared_ptr<detail::FixtureBase>() const {
+            return fixture_;
+        }
+
+    private:
+        std::shared_ptr<Fixture<T>> fixture_;
+    };
+
+    // Fixture built by `factory` on first use, see `Fixture`
+    template<typename Factory>
+    auto make_fixture(Factory factory) {
+        using T = std::remove_cvref_t<std::invoke_result_t<Factory&>>;
+        return FixtureRef<T>(std::make_shared<Fixture<T>>(std::move(factory)));
+    }
+
+    // Owning container for a group of tests and fixtures they use
+    class TestGroup {
+    public:
+        TestGroup(const TestGroup&) = delete;
+        TestGroup(TestGroup&&) = default;
+        TestGroup(std::string name): name_(std::move(name)) {}
+
+        // Arguments are tests and fixtures in any order
+        template<typename... Tests>
+        TestGroup(std::string name, Tests... tests)
+        : TestGroup(std::move(name))
+        {
+            (add(std::move(tests)), ...);
+        }
+
+        // Tears down attached fixtures
+        ~TestGroup() {
+            for (auto& fixture : fixtures_) {
+                fixture->detach();
+            }
+        }
+
+        void add(std::unique_ptr<Test> test) {
+            tests_.push_back(std::move(test));
+        }
+
+        void add(std::shared_ptr<detail::FixtureBase> fixture) {
+            fixture->attach();
+            fixtures_.push_back(std::move(fixture));
+        }
+
+        const std::string& name() const {
+            return name_;
+        }
+
+        std::span<const std::unique_ptr<Test>> tests() const {
+            return tests_;
+        }
+
+        bool run(const RunOptions& options = {}) {
+            const detail::GroupTests group{name_, tests_};
+            return detail::run_groups({&group, 1}, options);
+        }
+
+    private:
+        std::string name_;
+        std::vector<std::unique_ptr<Test>> tests_;
+        std::vector<std::shared_ptr<detail::FixtureBase>> fixtures_;
+    };
+
+    // Runs several groups, with `options.jobs` > 1 tests from all groups are
+    // spread over the same thread pool. Reports are printed in declaration order
+#if TINY_TEST__RUNNER
+    TINY_TEST__RUNNER_API bool run_all(std::span<TestGroup> groups, const RunOptions& options = {}) {
+        std::vector<detail::GroupTests> group_tests;
+        for (const auto& group : groups) {
+            group_tests.push_back({group.name(), group.tests()});
+        }
+        return detail::run_groups(group_tests, options);
+    }
+#else
+    bool run_all(std::span<TestGroup> groups, const RunOptions& options = {});
+#endif
+
+    // Descriptor of a test in the global registry, see `TINY_TEST`. Descriptors are
+    // static objects linked into an intrusive list during static initialization,
+    // so registration never allocates. The test itself is constructed by `factory`
+    // only when it is about to run
+    class Registration {
+    public:
+        using Factory = std::unique_ptr<Test> (*)();
+
+        Registration(const Registration&) = delete;
+
+        Registration(const char* group, const char* name, Factory factory) noexcept
+        : group_(group)
+        , name_(name)
+        , factory_(factory) {
+            auto& list = registry();
+            if (list.last != nullptr) {
+                list.last->next_ = this;
+            } else {
+                list.first = this;
+            }
+            list.last = this;
+        }
+
+        std::string_view group() const {
+            return group_;
+        }
+
+        std::string_view name() const {
+            return name_;
+        }
+
+        std::unique_ptr<Test> make() const {
+            return factory_();
+        }
+
+        const Registration* next() const {
+            return next_;
+        }
+
+        // All registered tests in registration order
+        static const Registration* first() {
+            return registry().first;
+        }
+
+    private:
+        struct List {
+            Registration* first = nullptr;
+            Registration* last = nullptr;
+        };
+
+        static List& registry() {
+            static constinit List list;
+            return list;
+        }
+
+        const char* group_;
+        const char* name_;
+        Factory factory_;
+        Registration* next_ = nullptr;
+    };
+
+    // Output of `list_tests`
+    enum class ListFormat {
+        // "group/name" lines
+        Text,
+        // {"group":"...","name":"..."} lines, read by `drive`
+        JsonLines,
+    };
+
+    // Result of `parse_command_line`
+    struct CommandLine {
+        RunOptions options;
+        bool list = false;
+        ListFormat list_format = ListFormat::Text;
+        bool help = false;
+        std::optional<Baseline::Mode> baseline_mode;
+        std::string baseline_path = "tiny_test.baseline";
+        // `RunOptions::durations` is loaded from and saved to this file if not empty
+        std::string durations_path;
+        // `RunOptions::cache` is loaded from and saved to this file if not empty
+        std::string cache_path = "tiny_test.cache";
+        // "KIND" or "KIND:FILE" for every reporter given by --reporter, see `make_reporter`
+        std::vector<std::string> reporters;
+        // if not empty, tests of these binaries are run by `drive` instead of own tests
+        std::vector<std::string> drive;
+        // command prefixes of remote hosts used by `drive`, e.g. "ssh host"
+        std::vector<std::string> remotes;
+        // run by `drive`, results are written to stdout as soon as tests finish
+        bool run_shard = false;
+        // not empty if arguments are invalid
+        std::string error;
+    };
+
+    inline constexpr const char* command_line_help =
+        "Options:\n"
+        "  --list[=jsonl]           print selected tests and exit\n"
+        "  --filter=GLOBS           run tests with \"group/name\" matching one of ':'-separated globs,\n"
+        "                           globs after '-' exclude tests, e.g. \"strings/*-*slow*\"\n"
+        "  --shard-count=N          split tests into N shards by hash of their names\n"
+        "  --shard-index=I          run only shard I (0-based)\n"
+        "  --repeat=N               run selected tests N times\n"
+        "  --jobs=N                 number of worker threads or processes, 0 for all cores\n"
+        "  --isolate                run tests in separate processes\n"
+        "  --timeout=MS             stop tests running longer than MS milliseconds, kill them if isolated\n"
+        "  --perf-counters          read hardware performance counters\n"
+        "  --save-baseline[=FILE]   save timings of timed tests, not with --isolate\n"
+        "  --baseline[=FILE]        compare timings of timed tests with saved ones\n"
+        "  --durations=FILE         record test durations, use them to balance shards\n"
+        "  --seed=N                 seed of property tests, e.g. to reproduce a failure\n"
+        "  --cache=FILE             skip tests that passed with the same binary and data files,\n"
+        "                           \"tiny_test.cache\" by default\n"
+        "  --no-cache               run all selected tests, do not record results\n"
+        "  --progress[=MS]          print progress to stderr every MS milliseconds, 1000 by default\n"
+        "  --profile=DIR            profile timed tests, write stacks of slow ones to DIR/*.folded\n"
+        "  --pin-cpus[=CPUS]        pin timed tests and benchmarks to CPUS, e.g. \"2,3\" or \"4-7\", and raise\n"
+        "                           their priority, isolated CPUs (or the last one) by default\n"
+        "  --snapshots=DIR          directory of snapshots, \"snapshots\" by default\n"
+        "  --update-snapshots       rewrite snapshots that differ instead of failing, runs all tests\n"
+        "  --reporter=SPECS         ','-separated reporters, each is KIND or KIND:FILE, where KIND\n"
+        "                           is console, junit, jsonl or tap, e.g. \"console,junit:report.xml\"\n"
+        "  --drive=BINARIES         run tests of ','-separated TinyTest binaries in parallel shards\n"
+        "                           and report them together, --jobs shards run at once\n"
+        "  --remote=PREFIX          also run shards with command PREFIX, e.g. \"ssh host\", repeatable\n"
+        "  --run-shard=I/N          run shard I of N for --drive, report results as JSON Lines\n"
+        "  --help                   print this message\n";
+
+#if TINY_TEST__RUNNER
+    namespace detail {
+        inline std::vector<GroupTests> group_tests(std::span<TestGroup> groups) {
+            std::vector<GroupTests> result;
+            for (const auto& group : groups) {
+                result.push_back({group.name(), group.tests()});
+            }
+            return result;
+        }
+
+        // Candidates of `groups` followed by all registered tests
+        inline std::vector<Candidate> all_candidates(std::span<const GroupTests> groups) {
+            std::vector<Candidate> candidates;
+            add_candidates(candidates, groups);
+            for (auto* registration = Registration::first(); registration != nullptr; registration = registration->next()) {
+                candidates.push_back({registration->group(), registration->name()});
+            }
+            return candidates;
+        }
+    }
+
+    // Runs `groups` and then all registered tests. Registered tests are grouped
+    // by group name, groups are ordered by their first registered test.
+    // Only selected registered tests are constructed
+    TINY_TEST__RUNNER_API bool run_registered(std::span<TestGroup> groups = {}, const RunOptions& options = {}) {
+        const auto group_tests = detail::group_tests(groups);
+        const auto mask = detail::select(detail::all_candidates(group_tests), options);
+        detail::SelectedTests selected;
+        size_t index = detail::add_selected(selected, group_tests, mask);
+
+        std::vector<std::string_view> names;
+        std::vector<std::vector<std::unique_ptr<Test>>> registered;
+        std::map<std::string_view, size_t> group_indices;
+        for (auto* registration = Registration::first(); registration != nullptr; registration = registration->next()) {
+            if (!mask[index++]) {
+                continue;
+            }
+            auto [it, inserted] = group_indices.try_emplace(registration->group(), names.size());
+            if (inserted) {
+                names.push_back(registration->group());
+                registered.emplace_back();
+            }
+            registered[it->second].push_back(registration->make());
+        }
+        for (size_t i = 0; i < names.size(); ++i) {
+            selected.beginGroup(names[i]);
+            for (const auto& test : registered[i]) {
+                selected.add(test.get());
+            }
+        }
+        return detail::run_repeated(selected, options);
+    }
+
+    // Default entry point: runs `groups` and all registered tests, returns exit code
+    TINY_TEST__RUNNER_API int tiny_test_main(std::span<TestGroup> groups = {}, const RunOptions& options = {}) {
+        return run_registered(groups, options) ? 0 : 1;
+    }
+
+    // Prints every selected test in given format, registered tests are not constructed
+    TINY_TEST__RUNNER_API void list_tests(std::ostream& stream, std::span<TestGroup> groups = {}, const RunOptions& options = {},
+        ListFormat format = ListFormat::Text) {
+        const auto candidates = detail::all_candidates(detail::group_tests(groups));
+        const auto mask = detail::select(candidates, options);
+        std::string line;
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            if (!mask[i]) {
+                continue;
+            }
+            line.clear();
+            if (format == ListFormat::JsonLines) {
+                line += "{\"group\":";
+                detail::append_json_string(line, candidates[i].group);
+                line += ",\"name\":";
+                detail::append_json_string(line, candidates[i].name);
+                line += '}';
+            } else {
+                line += detail::test_key(candidates[i].group, candidates[i].name);
+            }
+            line += '\n';
+            stream << line;
+        }
+    }
+
+#if TINY_TEST__HAS_FORK
+    namespace detail {
+        // Reads JSON objects the way `JsonLinesReporter` writes them. Nested objects are
+        // flattened into "outer.inner" keys, strings are unescaped, other values are kept
+        // as written and arrays are skipped
+        class JsonReader {
+        public:
+            using Fields = std::vector<std::pair<std::string, std::string>>;
+
+            static std::optional<Fields> parse(std::string_view text) {
+                JsonReader reader(text);
+                Fields fields;
+                if (!reader.object({}, fields)) {
+                    return std::nullopt;
+                }
+                return fields;
+            }
+
+            static std::string_view find(const Fields& fields, std::string_view key) {
+                for (const auto& [name, value] : fields) {
+                    if (name == key) {
+                        return value;
+                    }
+                }
+                return {};
+            }
+
+        private:
+            explicit JsonReader(std::string_view text)
+            : text_(text) {}
+
+            bool object(const std::string& prefix, Fields& fields) {
+                if (!consume('{')) {
+                    return false;
+                }
+                if (consume('}')) {
+                    return true;
+                }
+                do {
+                    std::string key;
+                    if (!string(key) || !consume(':')) {
+                        return false;
+                    }
+                    if (!value(prefix + key, fields)) {
+                        return false;
+                    }
+                } while (consume(','));
+                return consume('}');
+            }
+
+            bool value(std::string key, Fields& fields) {
+                skipSpaces();
+                if (text_.empty()) {
+                    return false;
+                } else if (text_.front() == '{') {
+                    return object(key + '.', fields);
+                } else if (text_.front() == '[') {
+                    Fields ignored;
+                    consume('[');
+                    if (consume(']')) {
+                        return true;
+                    }
+                    do {
+                        if (!value({}, ignored)) {
+                            return false;
+                        }
+                    } while (consume(','));
+                    return consume(']');
+                } else if (text_.front() == '"') {
+                    std::string text;
+                    if (!string(text)) {
+                        return false;
+                    }
+                    fields.emplace_back(std::move(key), std::move(text));
+                    return true;
+                }
+                size_t end = 0;
+                while (end < text_.size() && text_[end] != ',' && text_[end] != '}' && text_[end] != ']' && text_[end] != ' ') {
+                    ++end;
+                }
+                fields.emplace_back(std::move(key), std::string(text_.substr(0, end)));
+                text_.remove_prefix(end);
+                return end != 0;
+            }
+
+            bool string(std::string& result) {
+                if (!consume('"')) {
+                    return false;
+                }
+                while (!text_.empty() && text_.front() != '"') {
+                    char c = text_.front();
+                    text_.remove_prefix(1);
+                    if (c != '\\') {
+                        result += c;
+                        continue;
+                    }
+                    if (text_.empty()) {
+                        return false;
+                    }
+                    c = text_.front();
+                    text_.remove_prefix(1);
+                    switch (c) {
+                    case 'n': result += '\n'; break;
+                    case 't': result += '\t'; break;
+                    case 'r': result += '\r'; break;
+                    case 'b': result += '\b'; break;
+                    case 'f': result += '\f'; break;
+                    case 'u': {
+                        unsigned code = 0;
+                        if (text_.size() < 4 || std::from_chars(text_.data(), text_.data() + 4, code, 16).ptr != text_.data() + 4) {
+                            return false;
+                        }
+                        text_.remove_prefix(4);
+                        // only control characters are escaped by the reporter, the rest is kept as UTF-8
+                        if (code < 0x80) {
+                            result += char(code);
+                        } else if (code < 0x800) {
+                            result += char(0xC0 | (code >> 6));
+                            result += char(0x80 | (code & 0x3F));
+                        } else {
+                            result += char(0xE0 | (code >> 12));
+                            result += char(0x80 | ((code >> 6) & 0x3F));
+                            result += char(0x80 | (code & 0x3F));
+                        }
+                        break;
+                    }
+                    default: result += c;
+                    }
+                }
+                return consume('"');
+            }
+
+            bool consume(char c) {
+                skipSpaces();
+                if (text_.empty() || text_.front() != c) {
+                    return false;
+                }
+                text_.remove_prefix(1);
+                return true;
+            }
+
+            void skipSpaces() {
+                while (!text_.empty() && (text_.front() == ' ' || text_.front() == '\t' || text_.front() == '\r')) {
+                    text_.remove_prefix(1);
+                }
+            }
+
+            std::string_view text_;
+        };
+
+        template<typename Number>
+        Number parse_number(std::string_view text) {
+            Number number{};
+            std::from_chars(text.data(), text.data() + text.size(), number);
+            return number;
+        }
+
+        // Single-quoted for /bin/sh
+        inline std::string shell_quote(std::string_view text) {
+            std::string quoted = "'";
+            for (char c : text) {
+                if (c == '\'') {
+                    quoted += "'\\''";
+                } else {
+                    quoted += c;
+                }
+            }
+            quoted += '\'';
+            return quoted;
+        }
+
+        // `/bin/sh -c command` with stdout read through a pipe, stderr is shared with the driver
+        class ChildProcess {
+        public:
+            ChildProcess(const ChildProcess&) = delete;
+
+            explicit ChildProcess(const std::string& command) {
+                int pipe_fds[2];
+                if (::pipe(pipe_fds) != 0) {
+                    return;
+                }
+                pid_ = ::fork();
+                if (pid_ == 0) {
+                    ::dup2(pipe_fds[1], STDOUT_FILENO);
+                    ::close(pipe_fds[0]);
+                    ::close(pipe_fds[1]);
+                    ::execl("/bin/sh", "sh", "-c", command.c_str(), static_cast<char*>(nullptr));
+                    ::_exit(127);
+                }
+                ::close(pipe_fds[1]);
+                if (pid_ < 0) {
+                    ::close(pipe_fds[0]);
+                    return;
+                }
+                ::fcntl(pipe_fds[0], F_SETFD, FD_CLOEXEC);
+                fd_ = pipe_fds[0];
+            }
+
+            ~ChildProcess() {
+                wait();
+            }
+
+            bool started() const {
+                return fd_ >= 0;
+            }
+
+            int fd() const {
+                return fd_;
+            }
+
+            // Appends what is available to `output`, false once the child closes stdout
+            bool read(std::string& output) {
+                char chunk[65536];
+                ssize_t received = 0;
+                while ((received = ::read(fd_, chunk, sizeof(chunk))) < 0 && errno == EINTR) {}
+                if (received <= 0) {
+                    return false;
+                }
+                output.append(chunk, size_t(received));
+                return true;
+            }
+
+            // Exit status as returned by waitpid
+            int wait() {
+                if (fd_ >= 0) {
+                    ::close(fd_);
+                    fd_ = -1;
+                }
+                if (pid_ > 0) {
+                    while (::waitpid(pid_, &status_, 0) < 0 && errno == EINTR) {}
+                    pid_ = -1;
+                }
+                return status_;
+            }
+
+        private:
+            pid_t pid_ = -1;
+            int fd_ = -1;
+            int status_ = -1;
+        };
+
+        // Test of one of the driven binaries
+        struct DrivenTest {
+            size_t binary;
+            std::string group;
+            std::string name;
+            // `key_hash` of the test, as the binary uses it for sharding
+            uint64_t shard_hash;
+            // hash of the binary and the test, key of the driver's duration history
+            uint64_t history_hash;
+        };
+
+        // Part of a binary's tests run by one process
+        struct DriveItem {
+            size_t binary;
+            size_t shard_index;
+            size_t shard_count;
+            std::vector<size_t> tests;
+            double expected = 0;
+        };
+
+        // Result line of `--run-shard` output
+        inline void result_from_fields(const JsonReader::Fields& fields, TestResult& result) {
+            using Fields = JsonReader;
+            result.passed = Fields::find(fields, "passed") == "true";
+            result.skipped = Fields::find(fields, "skipped") == "true";
+            result.duration = std::chrono::nanoseconds(parse_number<int64_t>(Fields::find(fields, "duration_ns")));
+            result.output += Fields::find(fields, "output");
+            result.allocations = {};
+            if (!Fields::find(fields, "allocations.count").empty()) {
+                result.allocations.valid = true;
+                result.allocations.allocations = parse_number<uint64_t>(Fields::find(fields, "allocations.count"));
+                result.allocations.bytes = parse_number<uint64_t>(Fields::find(fields, "allocations.bytes"));
+                result.allocations.peak_bytes = parse_number<int64_t>(Fields::find(fields, "allocations.peak_bytes"));
+            }
+            result.counters = {};
+            if (!Fields::find(fields, "counters.cycles").empty()) {
+                result.counters.valid = true;
+                result.counters.cycles = parse_number<uint64_t>(Fields::find(fields, "counters.cycles"));
+                result.counters.instructions = parse_number<uint64_t>(Fields::find(fields, "counters.instructions"));
+                result.counters.cache_misses = parse_number<uint64_t>(Fields::find(fields, "counters.cache_misses"));
+                result.counters.branch_misses = parse_number<uint64_t>(Fields::find(fields, "counters.branch_misses"));
+            }
+        }
+    }
+
+    // Runs tests of other TinyTest binaries and merges their results into one report,
+    // in the order of binaries and of tests in them. Every binary is asked for its tests
+    // with `--list=jsonl`, then it is split into shards run as `--run-shard=I/N`, which
+    // streams results as JSON Lines. Shards are sized and started longest first by
+    // `options.durations`, and run on `options.jobs` local processes and one process per
+    // element of `remotes`, a command prefix such as "ssh host" (binaries must have the
+    // same path there). `filter`, `timeout`, `seed`, `perf_counters`, `isolation` and snapshot
+    // options are passed to the binaries, `repeat` runs all shards again. Tests of a binary
+    // that crashes or is killed fail
+    TINY_TEST__RUNNER_API bool drive(std::span<const std::string> binaries, const RunOptions& options, std::span<const std::string> remotes = {}) {
+        std::string arguments;
+        if (!options.filter.empty()) {
+            arguments += " --filter=" + detail::shell_quote(options.filter);
+        }
+        if (options.timeout.count() != 0) {
+            arguments += " --timeout=" + std::to_string(options.timeout.count());
+        }
+        if (options.seed != 0) {
+            arguments += " --seed=" + std::to_string(options.seed);
+        }
+        if (options.perf_counters) {
+            arguments += " --perf-counters";
+        }
+        if (options.isolation == Isolation::Fork) {
+            arguments += " --isolate";
+        }
+        if (options.snapshots != RunOptions().snapshots) {
+            arguments += " --snapshots=" + detail::shell_quote(options.snapshots);
+        }
+        if (options.update_snapshots) {
+            arguments += " --update-snapshots";
+        }
+
+        bool success = true;
+        std::vector<detail::DrivenTest> tests;
+        for (size_t binary = 0; binary < binaries.size(); ++binary) {
+            detail::ChildProcess lister("exec " + detail::shell_quote(binaries[binary]) + " --list=jsonl" + arguments);
+            std::string listing;
+            const bool started = lister.started();
+            while (started && lister.read(listing)) {}
+            const int status = lister.wait();
+            if (!started || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                std::cerr << "failed to list tests of " << binaries[binary] << ": " << detail::describe_exit(status) << '\n';
+                success = false;
+                continue;
+            }
+            std::string_view lines = listing;
+            while (!lines.empty()) {
+                const std::string_view line = lines.substr(0, lines.find('\n'));
+                lines.remove_prefix(std::min(lines.size(), line.size() + 1));
+                if (auto fields = detail::JsonReader::parse(line)) {
+                    std::string group(detail::JsonReader::find(*fields, "group"));
+                    std::string name(detail::JsonReader::find(*fields, "name"));
+                    const uint64_t shard_hash = detail::key_hash(group, name);
+                    const uint64_t history_hash = detail::stable_hash(binaries[binary], shard_hash);
+                    tests.push_back({binary, std::move(group), std::move(name), shard_hash, history_hash});
+                }
+            }
+        }
+
+        // consecutive tests of a group in one binary form a group of the report
+        std::deque<std::string> group_names;
+        std::vector<detail::GroupRange> groups;
+        std::vector<std::string_view> test_groups;
+        for (size_t i = 0; i < tests.size(); ++i) {
+            if (i == 0 || tests[i].binary != tests[i - 1].binary || tests[i].group != tests[i - 1].group) {
+                group_names.push_back(binaries[tests[i].binary] + ": " + tests[i].group);
+                groups.push_back({group_names.back(), 0});
+            }
+            ++groups.back().size;
+            test_groups.push_back(group_names.back());
+        }
+
+        std::vector<uint64_t> history_hashes;
+        for (const auto& test : tests) {
+            history_hashes.push_back(test.history_hash);
+        }
+        std::vector<double> expected = options.durations != nullptr
+            ? options.durations->expected(history_hashes)
+            : std::vector<double>(tests.size(), 0);
+        double total = 0;
+        for (double& duration : expected) {
+            // without history every test counts the same
+            duration = std::max(duration, 1.0);
+            total += duration;
+        }
+
+        // about two items per process, so that long ones start first and short ones fill gaps
+        const size_t local = options.jobs == 0 ? std::max<size_t>(std::thread::hardware_concurrency(), 1) : options.jobs;
+        const size_t slots = local + remotes.size();
+        std::vector<detail::DriveItem> items;
+        for (size_t begin = 0; begin < tests.size();) {
+            size_t end = begin;
+            double binary_total = 0;
+            while (end < tests.size() && tests[end].binary == tests[begin].binary) {
+                binary_total += expected[end++];
+            }
+            const size_t shards = std::clamp<size_t>(size_t(std::ceil(binary_total * double(2 * slots) / total)), 1, end - begin);
+            const size_t first = items.size();
+            for (size_t shard = 0; shard < shards; ++shard) {
+                items.push_back({tests[begin].binary, shard, shards, {}, 0});
+            }
+            for (size_t i = begin; i < end; ++i) {
+                auto& item = items[first + (shards == 1 ? 0 : tests[i].shard_hash % shards)];
+                item.tests.push_back(i);
+                item.expected += expected[i];
+            }
+            begin = end;
+        }
+        std::erase_if(items, [](const detail::DriveItem& item) { return item.tests.empty(); });
+        std::sort(items.begin(), items.end(), [](const detail::DriveItem& lhs, const detail::DriveItem& rhs) {
+            return lhs.expected > rhs.expected;
+        });
+
+        // repetitions are reported as one run
+        detail::RepeatedRunReporter reporter(options.reporter != nullptr ? *options.reporter : default_reporter());
+        // durations are recorded with hashes of binaries, results are not cached
+        RunOptions report_options;
+        report_options.output_capacity = options.output_capacity;
+        for (size_t repetition = 0; repetition < std::max<size_t>(options.repeat, 1); ++repetition) {
+            detail::OrderedReporter ordered(groups, tests.size(), reporter, report_options);
+
+            struct Running {
+                std::unique_ptr<detail::ChildProcess> process;
+                const detail::DriveItem* item;
+                std::optional<size_t> remote;
+                std::string buffer;
+                // indices of not yet reported tests by "group\0name", in declaration order
+                std::map<std::string, std::deque<size_t>, std::less<>> pending;
+            };
+            std::vector<Running> running;
+            std::vector<size_t> free_remotes;
+            for (size_t i = remotes.size(); i > 0; --i) {
+                free_remotes.push_back(i - 1);
+            }
+            size_t free_local = local;
+            size_t next_item = 0;
+            auto finish_test = [&](size_t index, auto&& fill) {
+                auto& result = ordered.start(index, test_groups[index]);
+                result.name = tests[index].name;
+                fill(result);
+                if (options.durations != nullptr && !result.skipped) {
+                    options.durations->record(tests[index].history_hash, result.duration);
+                }
+                ordered.finished(index);
+            };
+            auto start_item = [&](std::optional<size_t> remote) {
+                const auto& item = items[next_item++];
+                // exec keeps the status of a crashed binary instead of the shell's exit code
+                std::string command = "exec " + detail::shell_quote(binaries[item.binary]);
+                command += " --run-shard=" + std::to_string(item.shard_index) + '/' + std::to_string(item.shard_count);
+                // a remote host runs one shard at a time on all of its cores
+                command += remote ? " --jobs=0" : " --jobs=1";
+                command += arguments;
+                if (remote) {
+                    // ssh-like prefixes pass their arguments to a remote shell, which parses them once more
+                    command = "exec " + remotes[*remote] + ' ' + detail::shell_quote(command);
+                }
+                Running child{std::make_unique<detail::ChildProcess>(command), &item, remote, {}, {}};
+                for (size_t index : item.tests) {
+                    child.pending[tests[index].group + '\0' + tests[index].name].push_back(index);
+                }
+                running.push_back(std::move(child));
+            };
+            auto process_lines = [&](Running& child) {
+                size_t begin = 0;
+                for (size_t end; (end = child.buffer.find('\n', begin)) != std::string::npos; begin = end + 1) {
+                    const auto fields = detail::JsonReader::parse(std::string_view(child.buffer).substr(begin, end - begin));
+                    if (!fields || detail::JsonReader::find(*fields, "type") != "test") {
+                        continue;
+                    }
+                    const std::string key = std::string(detail::JsonReader::find(*fields, "group")) + '\0'
+                        + std::string(detail::JsonReader::find(*fields, "name"));
+                    auto it = child.pending.find(key);
+                    if (it == child.pending.end() || it->second.empty()) {
+                        continue;
+                    }
+                    const size_t index = it->second.front();
+                    it->second.pop_front();
+                    finish_test(index, [&](TestResult& result) { detail::result_from_fields(*fields, result); });
+                }
+                child.buffer.erase(0, begin);
+            };
+
+            while (next_item < items.size() || !running.empty()) {
+                while (next_item < items.size() && (free_local != 0 || !free_remotes.empty())) {
+                    if (free_local != 0) {
+                        --free_local;
+                        start_item(std::nullopt);
+                    } else {
+                        start_item(free_remotes.back());
+                        free_remotes.pop_back();
+                    }
+                }
+                std::vector<pollfd> fds;
+                int timeout = -1;
+                for (const auto& child : running) {
+                    fds.push_back({child.process->fd(), POLLIN, 0});
+                    // processes that failed to start are handled right away
+                    timeout = child.process->started() ? timeout : 0;
+                }
+                if (::poll(fds.data(), nfds_t(fds.size()), timeout) < 0 && errno != EINTR) {
+                    break;
+                }
+                for (size_t i = running.size(); i > 0; --i) {
+                    auto& child = running[i - 1];
+                    if (child.process->started() && fds[i - 1].revents == 0) {
+                        continue;
+                    }
+                    if (child.process->started() && child.process->read(child.buffer)) {
+                        process_lines(child);
+                        continue;
+                    }
+                    child.buffer += '\n';
+                    process_lines(child);
+                    const std::string reason = binaries[child.item->binary] + ' ' + detail::describe_exit(child.process->wait())
+                        + " before reporting this test\n";
+                    for (auto& [key, indices] : child.pending) {
+                        for (size_t index : indices) {
+                            finish_test(index, [&](TestResult& result) {
+                                result.passed = false;
+                                result.duration = {};
+                                result.counters = {};
+                                result.allocations = {};
+                                result.output += reason;
+                            });
+                        }
+                    }
+                    if (child.remote) {
+                        free_remotes.push_back(*child.remote);
+                    } else {
+                        ++free_local;
+                    }
+                    running.erase(running.begin() + std::ptrdiff_t(i - 1));
+                }
+            }
+            success &= ordered.finish();
+        }
+        return reporter.finish() && success;
+    }
+#endif
+
+    // Parses arguments described in `command_line_help`, options not given keep values from `defaults`
+    TINY_TEST__RUNNER_API CommandLine parse_command_line(int argc, char** argv, RunOptions defaults = {}) {
+        CommandLine command_line;
+        command_line.options = std::move(defaults);
+        auto& options = command_line.options;
+        for (int i = 1; i < argc; ++i) {
+            const std::string_view argument = argv[i];
+            const size_t equals = argument.find('=');
+            const std::string_view flag = argument.substr(0, equals);
+            const bool has_value = equals != std::string_view::npos;
+            const std::string_view value = has_value ? argument.substr(equals + 1) : std::string_view{};
+            auto number = [&](size_t& target) {
+                char* end = nullptr;
+                const std::string text(value);
+                const unsigned long long parsed = std::strtoull(text.c_str(), &end, 10);
+                if (!has_value || text.empty() || *end != '\0') {
+                    command_line.error = "invalid value of " + std::string(flag);
+                    return;
+                }
+                target = size_t(parsed);
+            };
+
+            auto list = [&](std::vector<std::string>& target, std::string_view items) {
+                do {
+                    const size_t comma = items.find(',');
+                    target.emplace_back(items.substr(0, comma));
+                    items.remove_prefix(comma == std::string_view::npos ? items.size() : comma + 1);
+                } while (!items.empty());
+            };
+
+            if (flag == "--list") {
+                command_line.list = true;
+                if (value == "jsonl") {
+                    command_line.list_format = ListFormat::JsonLines;
+                } else if (has_value) {
+                    command_line.error = "invalid value of --list";
+                }
+            } else if (flag == "--help") {
+                command_line.help = true;
+            } else if (flag == "--filter") {
+                options.filter = value;
+            } else if (flag == "--shard-count") {
+                number(options.shard_count);
+            } else if (flag == "--shard-index") {
+                number(options.shard_index);
+            } else if (flag == "--repeat") {
+                number(options.repeat);
+            } else if (flag == "--jobs") {
+                number(options.jobs);
+            } else if (flag == "--isolate") {
+                options.isolation = Isolation::Fork;
+            } else if (flag == "--timeout") {
+                size_t milliseconds = 0;
+                number(milliseconds);
+                options.timeout = std::chrono::milliseconds(milliseconds);
+            } else if (flag == "--perf-counters") {
+                options.perf_counters = true;
+            } else if (flag == "--cache") {
+                if (value.empty()) {
+                    command_line.error = "--cache requires a file name";
+                }
+                command_line.cache_path = value;
+            } else if (flag == "--no-cache") {
+                command_line.cache_path.clear();
+            } else if (flag == "--seed") {
+                size_t seed = 0;
+                number(seed);
+                options.seed = seed;
+            } else if (flag == "--progress") {
+                size_t milliseconds = 1000;
+                if (has_value) {
+                    number(milliseconds);
+                }
+                options.progress = std::chrono::milliseconds(milliseconds);
+            } else if (flag == "--profile") {
+                if (value.empty()) {
+                    command_line.error = "--profile requires a directory";
+                }
+                options.profile = value;
+            } else if (flag == "--pin-cpus") {
+                if (!has_value) {
+                    options.timing_cpus = detail::default_timing_cpus();
+                } else if (!detail::parse_cpu_list(value, options.timing_cpus)) {
+                    command_line.error = "invalid value of --pin-cpus";
+                }
+            } else if (flag == "--reporter") {
+                command_line.reporters.clear();
+                std::string_view specs = value;
+                do {
+                    const size_t comma = specs.find(',');
+                    const std::string_view spec = specs.substr(0, comma);
+                    const std::string_view kind = spec.substr(0, spec.find(':'));
+                    if (kind != "console" && kind != "junit" && kind != "jsonl" && kind != "tap") {
+                        command_line.error = "unknown reporter " + std::string(spec);
+                        break;
+                    }
+                    command_line.reporters.emplace_back(spec);
+                    specs.remove_prefix(comma == std::string_view::npos ? specs.size() : comma + 1);
+                } while (!specs.empty());
+            } else if (flag == "--snapshots") {
+                if (value.empty()) {
+                    command_line.error = "--snapshots requires a directory";
+                }
+                options.snapshots = value;
+            } else if (flag == "--update-snapshots") {
+                options.update_snapshots = true;
+            } else if (flag == "--drive") {
+                if (value.empty()) {
+                    command_line.error = "--drive requires binaries";
+                } else {
+                    list(command_line.drive, value);
+                }
+            } else if (flag == "--remote") {
+                if (value.empty()) {
+                    command_line.error = "--remote requires a command";
+                }
+                command_line.remotes.emplace_back(value);
+            } else if (flag == "--run-shard") {
+                // all results go to the driver, which also keeps the durations
+                const size_t slash = value.find('/');
+                char* end = nullptr;
+                const std::string text(value);
+                options.shard_index = std::strtoull(text.c_str(), &end, 10);
+                if (slash == std::string_view::npos || end != text.c_str() + slash) {
+                    command_line.error = "invalid value of --run-shard";
+                } else {
+                    options.shard_count = std::strtoull(text.c_str() + slash + 1, &end, 10);
+                    if (*end != '\0' || slash + 1 == text.size()) {
+                        command_line.error = "invalid value of --run-shard";
+                    }
+                }
+                command_line.reporters = {"jsonl"};
+                command_line.cache_path.clear();
+                command_line.run_shard = true;
+            } else if (flag == "--durations") {
+                if (value.empty()) {
+                    command_line.error = "--durations requires a file name";
+                }
+                command_line.durations_path = value;
+            } else if (flag == "--save-baseline" || flag == "--baseline") {
+                command_line.baseline_mode = flag == "--baseline" ? Baseline::Mode::Compare : Baseline::Mode::Save;
+                if (has_value) {
+                    command_line.baseline_path = value;
+                }
+            } else {
+                command_line.error = "unknown argument " + std::string(argument);
+            }
+            if (!command_line.error.empty()) {
+                break;
+            }
+        }
+        if (command_line.error.empty() && options.shard_count == 0) {
+            command_line.error = "--shard-count should be at least 1";
+        } else if (command_line.error.empty() && options.shard_index >= options.shard_count) {
+            command_line.error = "--shard-index should be less than --shard-count";
+        }
+        // isolated tests run in workers, samples recorded there would be lost with them
+        if (command_line.error.empty() && command_line.baseline_mode == Baseline::Mode::Save && options.isolation == Isolation::Fork) {
+            command_line.error = "--save-baseline can't be used with --isolate";
+        }
+        return command_line;
+    }
+
+    // Entry point with command line, see `command_line_help`. Runs `groups`
+    // and all registered tests, defaults are used for options not given in arguments
+    TINY_TEST__RUNNER_API int tiny_test_main(int argc, char** argv, std::span<TestGroup> groups = {}, RunOptions defaults = {}) {
+        CommandLine command_line = parse_command_line(argc, argv, std::move(defaults));
+        if (!command_line.error.empty()) {
+            std::cerr << command_line.error << '\n' << command_line_help;
+            return 2;
+        }
+        if (command_line.help) {
+            std::cout << command_line_help;
+            return 0;
+        }
+        std::optional<DurationHistory> durations;
+        if (!command_line.durations_path.empty()) {
+            durations.emplace(command_line.durations_path);
+            command_line.options.durations = &*durations;
+        }
+        if (command_line.list) {
+            list_tests(std::cout, groups, command_line.options, command_line.list_format);
+            return 0;
+        }
+
+        // timed tests of driven binaries are compared by themselves, results are not cached
+        const bool driving = !command_line.drive.empty();
+        std::optional<Baseline> baseline;
+        if (command_line.baseline_mode && !driving) {
+            baseline.emplace(command_line.baseline_path, *command_line.baseline_mode);
+            command_line.options.baseline = &*baseline;
+        }
+        // timings are compared and snapshots updated only for tests that actually run
+        std::optional<ResultCache> cache;
+        if (!command_line.cache_path.empty() && !baseline && !driving && !command_line.options.update_snapshots) {
+            cache.emplace(command_line.cache_path);
+            command_line.options.cache = &*cache;
+        }
+        // results reported before a crash must reach the driver
+        if (command_line.run_shard) {
+            std::cout << std::unitbuf;
+        }
+        // reporters write to stdout or to their files, several of them are joined by `MultiReporter`
+        std::deque<std::ofstream> files;
+        std::vector<std::unique_ptr<Reporter>> reporters;
+        for (std::string_view spec : command_line.reporters) {
+            const size_t colon = spec.find(':');
+            std::ostream* stream = &std::cout;
+            if (colon != std::string_view::npos) {
+                const std::string path(spec.substr(colon + 1));
+                stream = &files.emplace_back(path);
+                if (!files.back()) {
+                    std::cerr << "failed to open " << path << '\n';
+                    return 2;
+                }
+            }
+            reporters.push_back(make_reporter(spec.substr(0, colon), *stream));
+        }
+        std::optional<MultiReporter> multi_reporter;
+        if (reporters.size() == 1) {
+            command_line.options.reporter = reporters.front().get();
+        } else if (reporters.size() > 1) {
+            std::vector<Reporter*> targets;
+            for (const auto& reporter : reporters) {
+                targets.push_back(reporter.get());
+            }
+            command_line.options.reporter = &multi_reporter.emplace(std::move(targets));
+        }
+
+#if TINY_TEST__HAS_FORK
+        const bool success = driving
+            ? drive(command_line.drive, command_line.options, command_line.remotes)
+            : run_registered(groups, command_line.options);
+#else
+        const bool success = run_registered(groups, command_line.options);
+#endif
+        if (cache && !cache->save()) {
+            std::cerr << "failed to save test results to " << command_line.cache_path << '\n';
+        }
+        if (baseline && baseline->mode() == Baseline::Mode::Save && !baseline->save()) {
+            std::cerr << "failed to save baseline to " << command_line.baseline_path << '\n';
+        }
+        if (durations && !durations->save()) {
+            std::cerr << "failed to save durations to " << command_line.durations_path << '\n';
+        }
+        return success ? 0 : 1;
+    }
+#else
+    bool run_registered(std::span<TestGroup> groups = {}, const RunOptions& options = {});
+    int tiny_test_main(std::span<TestGroup> groups = {}, const RunOptions& options = {});
+    void list_tests(std::ostream& stream, std::span<TestGroup> groups = {}, const RunOptions& options = {},
+        ListFormat format = ListFormat::Text);
+#if TINY_TEST__HAS_FORK
+    bool drive(std::span<const std::string> binaries, const RunOptions& options, std::span<const std::string> remotes = {});
+#endif
+    CommandLine parse_command_line(int argc, char** argv, RunOptions defaults = {});
+    int tiny_test_main(int argc, char** argv, std::span<TestGroup> groups = {}, RunOptions defaults = {});
+#endif
+}
+
+#define TINY_TEST__CONCAT_IMPL(first, second) first##second
+#define TINY_TEST__CONCAT(first, second) TINY_TEST__CONCAT_IMPL(first, second)
+#define TINY_TEST__UNIQUE_NAME(prefix) TINY_TEST__CONCAT(prefix, __COUNTER__)
+
+// Registers `make_test<TestType>(name, functor)` in the global registry, e.g.
+// TINY_TEST(PrettyTest, "group", "name", [](auto& test) { ... });
+// `group` and `name` must be string literals
+#define TINY_TEST(TestType, group, name, ...) \
+    static const ::testing::Registration TINY_TEST__UNIQUE_NAME(tiny_test_registration_)( \
+        group, name, []() -> std::unique_ptr<::testing::Test> { \
+            return ::testing::make_test<TestType>(name, __VA_ARGS__); \
+        })
+
+// Registers `make_timed_test<TestType>(time_limit, name, functor)` in the global registry
+#define TINY_TIMED_TEST(TestType, time_limit, group, name, ...) \
+    static const ::testing::Registration TINY_TEST__UNIQUE_NAME(tiny_test_registration_)( \
+        group, name, []() -> std::unique_ptr<::testing::Test> { \
+            return ::testing::make_timed_test<TestType>(time_limit, name, __VA_ARGS__); \
+        })
+
+// Registers a LightTest with the following block as the body, `test` is the LightTest&, e.g.
+// TINY_LIGHT_TEST("group", "name") { test.check(2 + 2 == 4); }
+#define TINY_LIGHT_TEST(group, name) TINY_TEST__LIGHT_TEST(group, name, TINY_TEST__UNIQUE_NAME(tiny_test_light_body_))
+
+#define TINY_TEST__LIGHT_TEST(group, name, body) \
+    static void body(::testing::LightTest& test); \
+    static const ::testing::Registration TINY_TEST__CONCAT(body, _registration)( \
+        group, name, []() -> std::unique_ptr<::testing::Test> { \
+            return ::testing::make_light_test(name, &body); \
+        }); \
+    static void body([[maybe_unused]] ::testing::LightTest& test)
+
+#ifdef TINY_TEST__DEFINE_MAIN
+// Define TINY_TEST__DEFINE_MAIN in one source file to get `main` which runs all registered tests
+int main(int argc, char** argv) {
+    return testing::tiny_test_main(argc, argv);
+}
+#endif
+
+#ifdef TINY_TEST__TRACK_ALLOCATIONS
+// Counting replacements of global operator new/delete. Every block has a 16 byte
+// header in front of it with the block size and whether the block was counted
+#include <cstdlib>
+#include <new>
+
+namespace testing::detail {
+    constexpr size_t allocation_header = 16;
+
+    inline void* tracked_allocate(size_t size, size_t alignment) noexcept {
+        const size_t header = std::max(alignment, allocation_header);
+        void* raw = nullptr;
+        if (alignment <= allocation_header) {
+            raw = std::malloc(size + header);
+        } else {
+#ifdef _MSC_VER
+            raw = _aligned_malloc(size + header, alignment);
+#else
+            raw = std::aligned_alloc(alignment, (size + header + alignment - 1) / alignment * alignment);
+#endif
+        }
+        if (raw == nullptr) {
+            return nullptr;
+        }
+        char* block = static_cast<char*>(raw) + header;
+        auto& counters = allocation_counters;
+        const bool counted = counters.paused == 0;
+        reinterpret_cast<size_t*>(block)[-2] = size;
+        reinterpret_cast<size_t*>(block)[-1] = counted;
+        if (counted) {
+            ++counters.allocations;
+            counters.bytes += size;
+            counters.live_bytes += int64_t(size);
+            counters.peak_bytes = std::max(counters.peak_bytes, counters.live_bytes);
+        }
+        return block;
+    }
+
+    inline void* tracked_allocate_or_throw(size_t size, size_t alignment) {
+        while (true) {
+            if (void* block = tracked_allocate(size, alignment)) {
+                return block;
+            }
+            auto handler = std::get_new_handler();
+            if (handler == nullptr) {
+                throw std::bad_alloc();
+            }
+            handler();
+        }
+    }
+
+    inline void tracked_free(void* block, size_t alignment) noexcept {
+        if (block == nullptr) {
+            return;
+        }
+        const size_t size = static_cast<size_t*>(block)[-2];
+        if (static_cast<size_t*>(block)[-1] != 0) {
+            auto& counters = allocation_counters;
+            ++counters.deallocations;
+            counters.live_bytes -= int64_t(size);
+        }
+        void* raw = static_cast<char*>(block) - std::max(alignment, allocation_header);
+#ifdef _MSC_VER
+        if (alignment > allocation_header) {
+            _aligned_free(raw);
+            return;
+        }
+#endif
+        std::free(raw);
+    }
+
+    inline const bool allocation_tracking_registered = (allocation_tracking() = true);
+}
+
+void* operator new(std::size_t size) {
+    return testing::detail::tracked_allocate_or_throw(size, 0);
+}
+
+void* operator new[](std::size_t size) {
+    return testing::detail::tracked_allocate_or_throw(size, 0);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return testing::detail::tracked_allocate(size, 0);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return testing::detail::tracked_allocate(size, 0);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    return testing::detail::tracked_allocate_or_throw(size, size_t(alignment));
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+    return testing::detail::tracked_allocate_or_throw(size, size_t(alignment));
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return testing::detail::tracked_allocate(size, size_t(alignment));
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return testing::detail::tracked_allocate(size, size_t(alignment));
+}
+
+void operator delete(void* block) noexcept {
+    testing::detail::tracked_free(block, 0);
+}
+
+void operator delete[](void* block) noexcept {
+    testing::detail::tracked_free(block, 0);
+}
+
+void operator delete(void* block, std::size_t) noexcept {
+    testing::detail::tracked_free(block, 0);
+}
+
+void operator delete[](void* block, std::size_t) noexcept {
+    testing::detail::tracked_free(block, 0);
+}
+
+void operator delete(void* block, const std::nothrow_t&) noexcept {
+    testing::detail::tracked_free(block, 0);
+}
+
+void operator delete[](void* block, const std::nothrow_t&) noexcept {
+    testing::detail::tracked_free(block, 0);
+}
+
+void operator delete(void* block, std::align_val_t alignment) noexcept {
+    testing::detail::tracked_free(block, size_t(alignment));
+}
+
+void operator delete[](void* block, std::align_val_t alignment) noexcept {
+    testing::detail::tracked_free(block, size_t(alignment));
+}
+
+void operator delete(void* block, std::size_t, std::align_val_t alignment) noexcept {
+    testing::detail::tracked_free(block, size_t(alignment));
+}
+
+void operator delete[](void* block, std::size_t, std::align_val_t alignment) noexcept {
+    testing::detail::tracked_free(block, size_t(alignment));
+}
+
+void operator delete(void* block, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    testing::detail::tracked_free(block, size_t(alignment));
+}
+
+void operator delete[](void* block, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    testing::detail::tracked_free(block, size_t(alignment));
+}
+#endif